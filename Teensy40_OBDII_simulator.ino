@@ -12,17 +12,34 @@ http://en.wikipedia.org/wiki/OBD-II_PIDs
 */
 
 #include "ecu_sim.h"
+#include "tx_schedule.h"
+#include "response_timing.h"
+#include "scheduler.h"
+#include "memory_map.h"
+#include "wcet.h"
 
 IntervalTimer timer;
 
 ecu_t ecu;
-uint16_t led_tick = 0;
-uint16_t pot_tick = 0;
-uint16_t flash_led_tick = 0;
 
 int led = 13;   // red LED on Teensy
 
-void setup() {
+static void heartbeat(void)
+{
+  digitalToggle(led);
+}
+
+static void read_pots(void)
+{
+  ecu_sim.update_pots();
+}
+
+static uint8_t poll(void)
+{
+  return ecu_sim.update();
+}
+
+FLASHMEM void setup() {
   pinMode(led,OUTPUT);
   pinMode(LED_red,OUTPUT);
   pinMode(LED_green,OUTPUT);
@@ -37,35 +54,27 @@ void setup() {
   
   Serial.println("****** Teensy 4.0 OBDII simulator skpang.co.uk 2022");
   
-  ecu_sim.init(500000);
+  ecu_sim.init(500000);  // CAN1 rate; CAN_BAUD_AUTO detects it on a bus with a third node
+  mem_report_print();
+
+  // Main loop work (scheduler.h); the loop sleeps when it is idle
+  sched_add(heartbeat, 1000);
+  sched_add(read_pots, 10);
+  sched_set_poll(poll);
+
   timer.begin(tick, 1000);    //1ms tick
 }
 
 void tick(void)
 {
-    led_tick++;
-    pot_tick++;
-    flash_led_tick++;
+    WCET_PROBE(WCET_TICK_ISR);
+
+    // Periodic broadcasts and delayed responses run here so request
+    // handling never delays them; the tick also wakes the main loop
+    tx_schedule_run();
+    resp_timing_run();
 }
 
 void loop() {
-  
-  ecu_sim.update();
-
-  if(led_tick > 1000)
-  {
-      led_tick = 0;
-      digitalToggle(led);
-  }
-
-  if(pot_tick>10)
-  {
-      pot_tick = 0;
-      ecu_sim.update_pots();
-  }
-  if(flash_led_tick > 50)
-  {
-      flash_led_tick =0;
-      digitalWrite(LED_green, LOW);
-  }
+  sched_run();
 }
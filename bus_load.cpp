@@ -0,0 +1,253 @@
+/*
+ * Background Bus Load Generator
+ *
+ * Message table, payload patterns, load-based message selection and the
+ * response latency bins. See bus_load.h.
+ */
+
+#include "bus_load.h"
+#include "ecu_sim.h"
+#include "tx_schedule.h"
+#include "host_link.h"
+#include "memory_map.h"
+#include "sim_clock.h"
+
+/*
+ * Background traffic, fastest first. Message selection walks the table
+ * in order, so the fast powertrain messages are the first to run.
+ */
+static const bus_load_msg_t bus_load_messages[] = {
+    // 10 ms - engine, transmission, brakes, steering
+    { 0x0A0, 10, 8, LOAD_PATTERN_SIGNAL },  { 0x0A8, 10, 8, LOAD_PATTERN_COUNTER },
+    { 0x0B0, 10, 8, LOAD_PATTERN_COUNTER }, { 0x0B8, 10, 8, LOAD_PATTERN_SIGNAL },
+    { 0x0C0, 10, 8, LOAD_PATTERN_COUNTER }, { 0x0C8, 10, 8, LOAD_PATTERN_RANDOM },
+    { 0x0D0, 10, 8, LOAD_PATTERN_COUNTER }, { 0x0D8, 10, 8, LOAD_PATTERN_SIGNAL },
+    { 0x0E0, 10, 8, LOAD_PATTERN_COUNTER }, { 0x0E8, 10, 8, LOAD_PATTERN_RANDOM },
+    { 0x0F0, 10, 8, LOAD_PATTERN_COUNTER }, { 0x0F8, 10, 8, LOAD_PATTERN_COUNTER },
+    { 0x100, 10, 8, LOAD_PATTERN_SIGNAL },  { 0x108, 10, 8, LOAD_PATTERN_COUNTER },
+    { 0x110, 10, 8, LOAD_PATTERN_RANDOM },  { 0x118, 10, 8, LOAD_PATTERN_COUNTER },
+    { 0x120, 10, 8, LOAD_PATTERN_COUNTER }, { 0x128, 10, 8, LOAD_PATTERN_SIGNAL },
+    { 0x130, 10, 8, LOAD_PATTERN_COUNTER }, { 0x138, 10, 8, LOAD_PATTERN_RANDOM },
+    // 20 ms - chassis and body control
+    { 0x180, 20, 8, LOAD_PATTERN_COUNTER }, { 0x188, 20, 8, LOAD_PATTERN_SIGNAL },
+    { 0x190, 20, 8, LOAD_PATTERN_COUNTER }, { 0x198, 20, 8, LOAD_PATTERN_RANDOM },
+    { 0x1A0, 20, 8, LOAD_PATTERN_COUNTER }, { 0x1A8, 20, 6, LOAD_PATTERN_COUNTER },
+    { 0x1B0, 20, 8, LOAD_PATTERN_SIGNAL },  { 0x1B8, 20, 8, LOAD_PATTERN_COUNTER },
+    { 0x1C0, 20, 8, LOAD_PATTERN_RANDOM },  { 0x1C8, 20, 4, LOAD_PATTERN_COUNTER },
+    { 0x1D0, 20, 8, LOAD_PATTERN_COUNTER }, { 0x1D8, 20, 8, LOAD_PATTERN_STATIC },
+    // 50 ms - climate, instrument cluster
+    { 0x240, 50, 8, LOAD_PATTERN_SIGNAL },  { 0x248, 50, 8, LOAD_PATTERN_COUNTER },
+    { 0x250, 50, 8, LOAD_PATTERN_STATIC },  { 0x258, 50, 5, LOAD_PATTERN_COUNTER },
+    { 0x260, 50, 8, LOAD_PATTERN_RANDOM },  { 0x268, 50, 8, LOAD_PATTERN_COUNTER },
+    { 0x270, 50, 8, LOAD_PATTERN_STATIC },  { 0x278, 50, 8, LOAD_PATTERN_COUNTER },
+    { 0x280, 50, 3, LOAD_PATTERN_COUNTER }, { 0x288, 50, 8, LOAD_PATTERN_SIGNAL },
+    { 0x290, 50, 8, LOAD_PATTERN_COUNTER }, { 0x298, 50, 8, LOAD_PATTERN_STATIC },
+    // 100 ms - status
+    { 0x320, 100, 8, LOAD_PATTERN_STATIC },  { 0x328, 100, 8, LOAD_PATTERN_COUNTER },
+    { 0x330, 100, 4, LOAD_PATTERN_STATIC },  { 0x338, 100, 8, LOAD_PATTERN_SIGNAL },
+    { 0x340, 100, 8, LOAD_PATTERN_COUNTER }, { 0x348, 100, 2, LOAD_PATTERN_STATIC },
+    { 0x350, 100, 8, LOAD_PATTERN_RANDOM },  { 0x358, 100, 8, LOAD_PATTERN_COUNTER },
+    // 500 ms - 1 s - network management, configuration
+    { 0x4A0, 500, 8, LOAD_PATTERN_STATIC },   { 0x4A8, 500, 8, LOAD_PATTERN_COUNTER },
+    { 0x4B0, 500, 2, LOAD_PATTERN_STATIC },   { 0x4B8, 500, 8, LOAD_PATTERN_STATIC },
+    { 0x5A0, 1000, 8, LOAD_PATTERN_STATIC },  { 0x5A8, 1000, 4, LOAD_PATTERN_STATIC },
+    { 0x5B0, 1000, 8, LOAD_PATTERN_COUNTER }, { 0x5B8, 1000, 8, LOAD_PATTERN_STATIC },
+};
+
+#define BUS_LOAD_MESSAGES (sizeof(bus_load_messages) / sizeof(bus_load_messages[0]))
+
+static bool message_active[CAN_BUS_COUNT][BUS_LOAD_MESSAGES];  // Read by the timer interrupt
+static uint16_t load_cpercent[CAN_BUS_COUNT];   // Selected load, 0.01 % units
+static uint32_t selected_baud[CAN_BUS_COUNT];   // Rate the selection was made for
+static uint8_t counters[BUS_LOAD_MESSAGES];
+static uint32_t random_state = 0x2545F491;
+static uint8_t target_percent = BUS_LOAD_TARGET_PERCENT;
+static bool traffic_enabled = false;
+
+static bus_load_latency_t latency[BUS_LOAD_LEVELS];
+static volatile uint32_t request_start_us;
+static volatile bool response_pending = false;   // Cleared from the timer interrupt
+
+static bool is_traffic_bus(uint8_t bus) {
+    return can_bus_config[bus].enabled && (can_bus_config[bus].ecu_mask & ECU_TRAFFIC);
+}
+
+/*
+ * Bits on the wire for an 11-bit data frame, with worst-case stuffing
+ * and the 3-bit interframe space
+ */
+static uint16_t frame_bits(uint8_t len) {
+    return 47 + 8 * len + (33 + 8 * len) / 4;
+}
+
+/*
+ * Pick the messages for one bus: walk the table, taking every message
+ * that still fits under the target at the bus's bit rate
+ */
+static void select_messages(uint8_t bus) {
+    uint32_t baud = can_channels[bus].link.baud;
+    uint32_t limit = (uint32_t)target_percent * 100;
+    uint32_t total = 0;
+
+    for(uint8_t i = 0; i < BUS_LOAD_MESSAGES; i++) {
+        const bus_load_msg_t* msg = &bus_load_messages[i];
+        uint32_t bits_per_s = (uint32_t)frame_bits(msg->len) * 1000 / msg->period_ms;
+        uint32_t cpercent = bits_per_s * 10000 / baud;
+
+        message_active[bus][i] = (total + cpercent <= limit);
+        if(message_active[bus][i]) total += cpercent;
+    }
+    load_cpercent[bus] = total;
+    selected_baud[bus] = baud;
+}
+
+/*
+ * Payload patterns
+ */
+static void fill_payload(uint8_t index, uint8_t* data) {
+    const bus_load_msg_t* msg = &bus_load_messages[index];
+    uint8_t len = msg->len;
+
+    switch(msg->pattern) {
+        case LOAD_PATTERN_COUNTER: {
+            uint8_t sum = 0;
+            data[0] = counters[index]++ & 0x0F;     // 4-bit alive counter
+            for(uint8_t i = 1; i < len; i++) data[i] = msg->id + i;
+            for(uint8_t i = 0; i + 1 < len; i++) sum += data[i];
+            if(len > 1) data[len - 1] = sum ^ 0xFF;  // Checksum
+            break;
+        }
+        case LOAD_PATTERN_RANDOM:
+            for(uint8_t i = 0; i < len; i++) {
+                random_state ^= random_state << 13;   // xorshift32
+                random_state ^= random_state >> 17;
+                random_state ^= random_state << 5;
+                data[i] = random_state & 0xFF;
+            }
+            break;
+        case LOAD_PATTERN_SIGNAL:
+            data[0] = sim_state.engine_rpm & 0xFF;
+            data[1] = sim_state.engine_rpm >> 8;
+            data[2] = sim_state.vehicle_speed;
+            data[3] = sim_state.throttle_position;
+            data[4] = sim_state.coolant_temp;
+            data[5] = sim_state.engine_load;
+            data[6] = counters[index]++;
+            data[7] = 0xFF;
+            break;
+        default:
+            for(uint8_t i = 0; i < len; i++) data[i] = msg->id + i * 0x11;
+            break;
+    }
+}
+
+// One table message, on every traffic bus where it is selected
+static void bus_load_job(uint16_t index) {
+    can_frame_t frame;
+
+    frame.id = bus_load_messages[index].id;
+    frame.extended = false;
+    frame.fd = false;
+    frame.len = bus_load_messages[index].len;
+    fill_payload(index, frame.buf);
+
+    for(uint8_t bus = 0; bus < CAN_BUS_COUNT; bus++) {
+        if(!message_active[bus][index] || can_channels[bus].link.detecting) continue;
+        can_channels[bus].transport->write(frame);
+    }
+}
+
+FLASHMEM void bus_load_init(void) {
+    for(uint8_t bus = 0; bus < CAN_BUS_COUNT; bus++) {
+        if(is_traffic_bus(bus)) traffic_enabled = true;
+    }
+    if(!traffic_enabled) {
+        return;
+    }
+
+    bus_load_set_target(target_percent);
+    for(uint8_t i = 0; i < BUS_LOAD_MESSAGES; i++) {
+        // Spread messages with the same period over their period
+        tx_schedule_add(bus_load_messages[i].period_ms, i % bus_load_messages[i].period_ms, bus_load_job, i);
+    }
+}
+
+void bus_load_set_target(uint8_t percent) {
+    target_percent = min(percent, (uint8_t)100);
+    for(uint8_t bus = 0; bus < CAN_BUS_COUNT; bus++) {
+        if(is_traffic_bus(bus)) select_messages(bus);
+    }
+}
+
+uint8_t bus_load_target(void) {
+    return target_percent;
+}
+
+uint8_t bus_load_actual(uint8_t bus) {
+    return load_cpercent[bus] / 100;
+}
+
+void bus_load_update(void) {
+    static uint32_t lastReport = 0;
+
+    if(!traffic_enabled) {
+        return;
+    }
+
+    // Bit rate changed (detection, LinkControl): same target, new selection
+    for(uint8_t bus = 0; bus < CAN_BUS_COUNT; bus++) {
+        if(is_traffic_bus(bus) && can_channels[bus].link.baud != selected_baud[bus]) {
+            select_messages(bus);
+        }
+    }
+
+    // Text report only while the binary host link is unused (same port)
+    if(clock_ms() - lastReport >= BUS_LOAD_REPORT_MS) {
+        lastReport = clock_ms();
+        if(!host_link_active()) {
+            bus_load_report();
+        }
+    }
+}
+
+/*
+ * Response latency
+ */
+void bus_load_request_received(uint32_t request_us) {
+    request_start_us = request_us;
+    response_pending = true;
+}
+
+void bus_load_response_sent(void) {
+    if(!response_pending) {
+        return;  // Only the first frame of a response counts
+    }
+    response_pending = false;
+
+    uint32_t elapsed = clock_us() - request_start_us;
+    bus_load_latency_t* bin = &latency[target_percent / 10];
+    bin->count++;
+    bin->total_us += elapsed;
+    if(elapsed > bin->max_us) bin->max_us = elapsed;
+}
+
+const bus_load_latency_t* bus_load_latency(uint8_t level) {
+    return (level < BUS_LOAD_LEVELS) ? &latency[level] : NULL;
+}
+
+void bus_load_report(void) {
+    Serial.print("Bus load target ");
+    Serial.print(target_percent);
+    Serial.println("% - response latency by load (count, avg us, max us):");
+    for(uint8_t level = 0; level < BUS_LOAD_LEVELS; level++) {
+        if(latency[level].count == 0) continue;
+        Serial.print("  ");
+        Serial.print(level * 10);
+        Serial.print("%: ");
+        Serial.print(latency[level].count);
+        Serial.print(", ");
+        Serial.print(latency[level].total_us / latency[level].count);
+        Serial.print(", ");
+        Serial.println(latency[level].max_us);
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef BUS_LOAD_H
+#define BUS_LOAD_H
+
+#include <Arduino.h>
+
+/*
+ * Background Bus Load Generator
+ *
+ * A real vehicle bus carries 40-70% load of periodic traffic between
+ * ECUs while a scan tool talks OBD, so tester frames and ECU responses
+ * must win arbitration against it. On every bus whose ecu_mask includes
+ * ECU_TRAFFIC (can_bus_config in ecu_sim.cpp) the simulator emulates that
+ * traffic from a table of periodic messages (bus_load.cpp):
+ *
+ * - ID SET AND PERIODS: 11-bit IDs below the diagnostic range, 10 ms to
+ *   1 s, lower IDs (higher priority) for the faster messages as on a
+ *   real powertrain bus.
+ * - PAYLOADS: static bytes, a rolling counter with checksum (like
+ *   end-to-end protected signals), pseudo-random data, or live signals
+ *   from the simulation (engine speed, vehicle speed, throttle, coolant).
+ * - TARGET LOAD: bus_load_set_target() selects which messages run on
+ *   each bus so the load at that bus's current bit rate gets as close to
+ *   the target as possible without exceeding it, counting worst-case bit
+ *   stuffing. The table tops out near 80% at 500 kbit/s and 40% at
+ *   1 Mbit/s; bus_load_actual() reports what a bus really gets.
+ *
+ * Each message is a job in the periodic transmit scheduler (tx_schedule.h)
+ * and is sent from the 1 ms timer interrupt, alongside diagnostics.
+ *
+ * RESPONSE LATENCY:
+ * The time from a request's arrival (the controller's receive timestamp,
+ * so the wait before the main loop picks it up counts) to the first
+ * response frame handed to the CAN controller is measured and binned by
+ * the target load in effect, in 10% steps. It ends when the response
+ * timing queue writes the frame (response_timing.h), so it includes the
+ * emulated response time and any wait behind other ECUs' responses.
+ * bus_load_report() prints count, average and maximum per step, so the
+ * cost of load on the simulator's own responses can be read next to the
+ * tool's view. The periodic report stops once the binary host link is in
+ * use, since it shares the USB serial port. Queueing behind traffic inside the controller and
+ * arbitration on the wire come on top and are seen by the tester.
+ */
+
+#define BUS_LOAD_TARGET_PERCENT   50        // Default target load
+#define BUS_LOAD_LEVELS           11        // Latency bins: 0%, 10%, ... 100%
+#define BUS_LOAD_REPORT_MS        10000     // Latency report interval (Serial, no host link)
+
+/*
+ * Payload patterns
+ */
+enum {
+    LOAD_PATTERN_STATIC,      // Fixed bytes derived from the ID
+    LOAD_PATTERN_COUNTER,     // Rolling counter in byte 0, checksum in the last byte
+    LOAD_PATTERN_RANDOM,      // Pseudo-random bytes
+    LOAD_PATTERN_SIGNAL       // Engine speed, vehicle speed, throttle, coolant
+};
+
+typedef struct {
+    uint16_t id;              // 11-bit CAN ID
+    uint16_t period_ms;       // Transmit period
+    uint8_t len;              // Data length (0-8)
+    uint8_t pattern;          // LOAD_PATTERN_*
+} bus_load_msg_t;
+
+typedef struct {
+    uint32_t count;           // Responses measured
+    uint32_t total_us;        // Sum, for the average
+    uint32_t max_us;          // Worst case
+} bus_load_latency_t;
+
+/*
+ * Bus Load Interface
+ */
+void bus_load_init(void);                       // Schedule the traffic (before the timer starts)
+void bus_load_update(void);                     // Main loop: track bit rate changes, report
+void bus_load_set_target(uint8_t percent);      // Reselects the messages on every bus
+uint8_t bus_load_target(void);
+uint8_t bus_load_actual(uint8_t bus);           // Generated load on a bus (%)
+
+void bus_load_request_received(uint32_t request_us);  // Request dispatched, with its receive timestamp
+void bus_load_response_sent(void);              // Response frame handed to the controller (response_timing.cpp)
+const bus_load_latency_t* bus_load_latency(uint8_t level);
+void bus_load_report(void);                     // Print the latency table
+
+#endif // BUS_LOAD_H
@@ -0,0 +1,107 @@
+/*
+ * CAN Bit Rate Detection and Switching
+ *
+ * Listen-only detection across the standard rates and runtime rate
+ * changes. See can_baud.h for the detection rules.
+ */
+
+#include "can_baud.h"
+#include "sim_clock.h"
+#include "host_link.h"
+
+const uint32_t can_baud_rates[CAN_BAUD_RATE_COUNT] = {
+    500000,     // OBD-II (ISO 15765-4), most vehicles since 2008
+    250000,     // OBD-II on older vehicles, J1939 heavy duty
+    125000,
+    1000000
+};
+
+bool can_baud_supported(uint32_t baud) {
+    for(uint8_t i = 0; i < CAN_BAUD_RATE_COUNT; i++) {
+        if(can_baud_rates[i] == baud) return true;
+    }
+    return false;
+}
+
+/*
+ * Listen at the current candidate rate
+ */
+static void can_baud_try_candidate(can_baud_t* link, CanTransport* transport) {
+    link->baud = can_baud_rates[link->candidate];
+    transport->set_baud(link->baud, true);
+    link->rx_errors = transport->rx_errors();
+    link->window_start = clock_ms();
+}
+
+static void can_baud_start_detection(can_baud_t* link, CanTransport* transport) {
+    link->auto_detect = true;
+    link->detecting = true;
+    link->candidate = 0;
+    can_baud_try_candidate(link, transport);
+}
+
+void can_baud_begin(can_baud_t* link, CanTransport* transport, uint32_t baud) {
+    link->switch_pending = false;
+    link->detecting = false;
+    link->auto_detect = false;
+
+    if(baud == CAN_BAUD_AUTO) {
+        transport->begin(can_baud_rates[0]);
+        can_baud_start_detection(link, transport);
+    } else {
+        transport->begin(baud);
+        link->baud = baud;
+    }
+}
+
+void can_baud_switch(can_baud_t* link, uint32_t baud) {
+    link->switch_to = baud;
+    link->switch_at = clock_ms() + CAN_BAUD_SWITCH_DELAY_MS;
+    link->switch_pending = true;
+}
+
+bool can_baud_update(can_baud_t* link, CanTransport* transport) {
+    // Runtime switch, once the queued response had time to leave
+    if(link->switch_pending && (int32_t)(clock_ms() - link->switch_at) >= 0) {
+        link->switch_pending = false;
+        if(link->switch_to == CAN_BAUD_AUTO) {
+            can_baud_start_detection(link, transport);
+        } else {
+            link->auto_detect = false;
+            link->detecting = false;
+            link->baud = link->switch_to;
+            transport->set_baud(link->baud, false);
+        }
+    }
+
+    if(!link->detecting) {
+        // A detected rate that keeps failing is wrong - detect again
+        uint8_t errors = transport->rx_errors();
+        if(link->auto_detect && errors >= CAN_BAUD_LOST_ERRORS && errors > link->rx_errors) {
+            can_baud_start_detection(link, transport);
+            return false;
+        }
+        return true;
+    }
+
+    // Listening: a clean frame locks the candidate rate
+    can_frame_t frame;
+    if(transport->read(frame)) {
+        link->detecting = false;
+        transport->set_baud(link->baud, false);
+        link->rx_errors = transport->rx_errors();
+        if(!host_link_active()) {  // Text only while the binary link is unused
+            Serial.print("CAN bit rate detected: ");
+            Serial.println(link->baud);
+        }
+        return true;
+    }
+
+    // Errors or silence - move on to the next candidate
+    uint8_t errors = transport->rx_errors() - link->rx_errors;
+    if(errors >= CAN_BAUD_ERROR_LIMIT || clock_ms() - link->window_start >= CAN_BAUD_LISTEN_MS) {
+        link->candidate = (link->candidate + 1) % CAN_BAUD_RATE_COUNT;
+        can_baud_try_candidate(link, transport);
+    }
+    return false;
+}
@@ -0,0 +1,70 @@
+#ifndef CAN_BAUD_H
+#define CAN_BAUD_H
+
+#include <Arduino.h>
+#include "can_transport.h"
+
+/*
+ * CAN Bit Rate Detection and Switching
+ *
+ * Passenger car OBD-II buses run at 500 kbit/s, but older vehicles and
+ * heavy-duty (J1939) rigs use 250 kbit/s, and test benches use 125k or
+ * 1M. A bus configured with CAN_BAUD_AUTO finds the rate by itself:
+ *
+ * - DETECTION: the controller is put in listen-only mode, so it never
+ *   sends an ACK or error frame and cannot disturb the bus while it is
+ *   at the wrong rate. Each standard rate is tried in turn. A rate is
+ *   rejected when the receive error counter climbs (frames at another
+ *   rate look like bit and stuff errors) or after CAN_BAUD_LISTEN_MS
+ *   without traffic. The first frame received cleanly locks the rate and
+ *   the controller goes back to normal mode.
+ * - LOST LOCK: a detected rate is dropped and detection restarts when the
+ *   receive error counter reaches error passive, e.g. when the simulator
+ *   is moved to a bus with another rate.
+ * - RUNTIME SWITCH: can_baud_switch() changes the rate of a running bus.
+ *   Only the controller's bit timing is reprogrammed, so a switch takes
+ *   a few milliseconds. It is delayed by CAN_BAUD_SWITCH_DELAY_MS so a
+ *   response already queued leaves at the old rate.
+ *
+ * Detection needs a third node that acknowledges the frames. With only
+ * the simulator and a scan tool on the bus, nobody ACKs the tool's
+ * request: the tool sends an error flag at the ACK delimiter, so no frame
+ * is ever received cleanly, and at the correct rate those form errors
+ * push the error counter past CAN_BAUD_ERROR_LIMIT and reject it.
+ * Detection then cycles forever. Give such a bench a fixed rate and keep
+ * CAN_BAUD_AUTO for buses where a vehicle or another ECU is present.
+ */
+
+#define CAN_BAUD_AUTO             0         // Detect the bit rate
+#define CAN_BAUD_RATE_COUNT       4
+#define CAN_BAUD_LISTEN_MS        250       // Listening time per candidate rate
+#define CAN_BAUD_ERROR_LIMIT      8         // Receive errors that reject a candidate
+#define CAN_BAUD_LOST_ERRORS      128       // Error passive: locked rate is wrong
+#define CAN_BAUD_SWITCH_DELAY_MS  5         // Lets a queued response leave first
+
+extern const uint32_t can_baud_rates[CAN_BAUD_RATE_COUNT];  // Candidates, most common first
+
+/*
+ * Bit rate state of one bus
+ */
+typedef struct {
+    uint32_t baud;                // Current rate (last candidate while detecting)
+    bool auto_detect;             // Rate comes from detection
+    bool detecting;               // Listen-only, trying candidates
+    uint8_t candidate;            // Index into can_baud_rates
+    uint8_t rx_errors;            // Receive error count when the candidate was set
+    uint32_t window_start;        // Candidate set at
+    bool switch_pending;          // Runtime switch requested
+    uint32_t switch_to;           // Rate to switch to, CAN_BAUD_AUTO to detect
+    uint32_t switch_at;           // Earliest time of the switch
+} can_baud_t;
+
+/*
+ * Bit Rate Interface
+ */
+void can_baud_begin(can_baud_t* link, CanTransport* transport, uint32_t baud);  // Start the bus
+bool can_baud_update(can_baud_t* link, CanTransport* transport);  // Main loop; false while detecting
+void can_baud_switch(can_baud_t* link, uint32_t baud);  // Change rate (or detect) at runtime
+bool can_baud_supported(uint32_t baud);  // One of the standard rates
+
+#endif // CAN_BAUD_H
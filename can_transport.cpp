@@ -0,0 +1,290 @@
+/*
+ * CAN Transport Implementations
+ *
+ * See can_transport.h. The classic and FD transports wrap FlexCAN_T4
+ * on the Teensy; the in-memory transport is for a build without ARDUINO,
+ * which this tree does not provide.
+ */
+
+#include "can_transport.h"
+#include "sim_clock.h"
+
+static can_tap_fn taps[CAN_TAP_MAX];
+static volatile uint8_t tap_count = 0;
+
+bool can_tap_add(can_tap_fn tap) {
+    bool added = false;
+
+    noInterrupts();           // The timer interrupt walks the list
+    for(uint8_t i = 0; i < tap_count; i++) {
+        if(taps[i] == tap) added = true;
+    }
+    if(!added && tap_count < CAN_TAP_MAX) {
+        taps[tap_count++] = tap;
+        added = true;
+    }
+    interrupts();
+    return added;
+}
+
+void can_tap_remove(can_tap_fn tap) {
+    noInterrupts();
+    for(uint8_t i = 0; i < tap_count; i++) {
+        if(taps[i] != tap) continue;
+        taps[i] = taps[--tap_count];
+        break;
+    }
+    interrupts();
+}
+
+void can_tap_frame(CanTransport* transport, const can_frame_t& frame, bool tx) {
+    for(uint8_t i = 0; i < tap_count; i++) {
+        taps[i](transport, frame, tx);
+    }
+}
+
+uint8_t can_fd_frame_len(uint8_t len) {
+    static const uint8_t fd_lengths[] = { 12, 16, 20, 24, 32, 48, 64 };
+
+    if(len <= CAN_MAX_LEN) {
+        return len;
+    }
+    for(uint8_t i = 0; i < sizeof(fd_lengths); i++) {
+        if(len <= fd_lengths[i]) return fd_lengths[i];
+    }
+    return CAN_FD_MAX_LEN;
+}
+
+void CanTransport::write(const CAN_message_t& msg) {
+    can_frame_t frame;
+
+    frame.id = msg.id;
+    frame.extended = msg.flags.extended;
+    frame.fd = last_rx_fd && fd_capable();
+    frame.len = msg.len;
+    memcpy(frame.buf, msg.buf, CAN_MAX_LEN);
+    write(frame);
+}
+
+#ifdef ARDUINO
+/*
+ * Receive time of a frame from its mailbox timestamp. The controller's
+ * 16-bit free-running timer counts nominal bit times, so the frame's age
+ * is the distance to the timer's current value (valid for 65535 bits -
+ * 65 ms at 1 Mbit/s, far longer than a frame waits to be read).
+ */
+static uint32_t rx_time_us(uint16_t stamp, uint16_t timer_now, uint32_t bit_rate) {
+    uint16_t age_bits = timer_now - stamp;
+    return clock_us() - (uint32_t)((uint64_t)age_bits * 1000000 / bit_rate);
+}
+
+/*
+ * Classic CAN on CAN1, CAN2 or CAN3
+ */
+template <CAN_DEV_TABLE controller>
+void ClassicCanTransport<controller>::begin(uint32_t baud) {
+    can.begin();
+    can.setBaudRate(baud);
+    bit_rate = baud;
+    can.setMBFilter(ACCEPT_ALL);
+    can.distribute();
+    can.mailboxStatus();
+}
+
+template <CAN_DEV_TABLE controller>
+void ClassicCanTransport<controller>::set_baud(uint32_t baud, bool listen_only) {
+    can.setBaudRate(baud, listen_only ? LISTEN_ONLY : TX);
+    bit_rate = baud;
+}
+
+template <CAN_DEV_TABLE controller>
+uint8_t ClassicCanTransport<controller>::rx_errors(void) {
+    return (FLEXCANb_ECR(controller) >> 8) & 0xFF;  // RXERRCNT
+}
+
+template <CAN_DEV_TABLE controller>
+bool ClassicCanTransport<controller>::read(can_frame_t& frame) {
+    CAN_message_t msg;
+
+    if(!can.readMB(msg)) {
+        return false;
+    }
+    frame.id = msg.id;
+    frame.extended = msg.flags.extended;
+    frame.fd = false;
+    frame.len = msg.len;
+    memcpy(frame.buf, msg.buf, CAN_MAX_LEN);
+    frame.time_us = rx_time_us(msg.timestamp, FLEXCANb_TIMER(controller), bit_rate);
+    can_tap_frame(this, frame, false);
+    return true;
+}
+
+template <CAN_DEV_TABLE controller>
+void ClassicCanTransport<controller>::write(const can_frame_t& frame) {
+    CAN_message_t msg;
+
+    msg.id = frame.id;
+    msg.flags.extended = frame.extended;
+    msg.len = min(frame.len, (uint8_t)CAN_MAX_LEN);
+    memcpy(msg.buf, frame.buf, CAN_MAX_LEN);
+
+    noInterrupts();           // Main loop and timer interrupt share the mailboxes
+    can.write(msg);
+    interrupts();
+    can_tap_frame(this, frame, true);
+}
+
+/*
+ * CAN FD on CAN3
+ * Nominal rate for arbitration, CAN_FD_DATA_RATE for the data phase.
+ */
+void FdCanTransport::set_timing(uint32_t baud, bool listen_only) {
+    CANFD_timings_t config;
+    config.clock = CLK_24MHz;
+    config.baudrate = baud;
+    config.baudrateFD = CAN_FD_DATA_RATE;
+    config.propdelay = 190;
+    config.bus_length = 1;
+    config.sample = 75;
+
+    can.setBaudRate(config, 1, 1, listen_only ? LISTEN_ONLY : TX);
+    bit_rate = baud;
+}
+
+void FdCanTransport::begin(uint32_t baud) {
+    can.begin();
+    set_timing(baud, false);
+    can.setRegions(64);       // 64-byte mailboxes
+    can.setMBFilter(ACCEPT_ALL);
+    can.mailboxStatus();
+}
+
+// Only the arbitration rate changes; the data phase stays at CAN_FD_DATA_RATE
+void FdCanTransport::set_baud(uint32_t baud, bool listen_only) {
+    set_timing(baud, listen_only);
+}
+
+uint8_t FdCanTransport::rx_errors(void) {
+    return (FLEXCANb_ECR(CAN3) >> 8) & 0xFF;  // RXERRCNT
+}
+
+bool FdCanTransport::read(can_frame_t& frame) {
+    CANFD_message_t msg;
+
+    if(!can.readMB(msg)) {
+        return false;
+    }
+    frame.id = msg.id;
+    frame.extended = msg.flags.extended;
+    frame.fd = msg.edl;
+    frame.len = msg.len;
+    memcpy(frame.buf, msg.buf, CAN_FD_MAX_LEN);
+    frame.time_us = rx_time_us(msg.timestamp, FLEXCANb_TIMER(CAN3), bit_rate);
+    last_rx_fd = frame.fd;
+    can_tap_frame(this, frame, false);
+    return true;
+}
+
+void FdCanTransport::write(const can_frame_t& frame) {
+    CANFD_message_t msg;
+
+    msg.id = frame.id;
+    msg.flags.extended = frame.extended;
+    msg.edl = frame.fd;
+    msg.brs = frame.fd;
+    msg.len = frame.fd ? can_fd_frame_len(frame.len) : min(frame.len, (uint8_t)CAN_MAX_LEN);
+    memcpy(msg.buf, frame.buf, CAN_FD_MAX_LEN);
+
+    noInterrupts();           // Main loop and timer interrupt share the mailboxes
+    can.write(msg);
+    interrupts();
+    can_tap_frame(this, frame, true);
+}
+
+static ClassicCanTransport<CAN1> can1_transport;
+static ClassicCanTransport<CAN2> can2_transport;
+#if USE_CAN_FD
+static FdCanTransport can3_transport;
+#else
+static ClassicCanTransport<CAN3> can3_transport;
+#endif
+
+CanTransport* const can_transports[CAN_BUS_COUNT] = {
+    &can1_transport, &can2_transport, &can3_transport
+};
+
+#else
+/*
+ * In-memory FD bus (builds without ARDUINO)
+ */
+void MemoryCanTransport::begin(uint32_t baud) {
+    rx_head = rx_count = 0;
+    tx_head = tx_count = 0;
+    set_baud(baud, false);
+}
+
+void MemoryCanTransport::set_baud(uint32_t baud, bool listen_only) {
+    this->baud = baud;
+    this->listen_only = listen_only;
+    rx_error_count = 0;
+}
+
+bool MemoryCanTransport::read(can_frame_t& frame) {
+    if(rx_count == 0) {
+        return false;
+    }
+    frame = rx_queue[rx_head];
+    rx_head = (rx_head + 1) % MEMORY_BUS_DEPTH;
+    rx_count--;
+    if(line_baud != 0 && line_baud != baud) {
+        // Wrong rate: the frame is seen as bit/stuff errors
+        rx_error_count = min(rx_error_count + 8, 255);
+        return false;
+    }
+    frame.time_us = clock_us();
+    last_rx_fd = frame.fd;
+    can_tap_frame(this, frame, false);
+    return true;
+}
+
+void MemoryCanTransport::write(const can_frame_t& frame) {
+    if(listen_only) {
+        return;  // Listen-only controllers never transmit
+    }
+    can_tap_frame(this, frame, true);
+    if(tx_count == MEMORY_BUS_DEPTH) {
+        return;  // Nobody is collecting responses - drop, like a bus with no listener
+    }
+    can_frame_t* slot = &tx_queue[(tx_head + tx_count) % MEMORY_BUS_DEPTH];
+    *slot = frame;
+    if(frame.fd) {
+        slot->len = can_fd_frame_len(frame.len);
+    }
+    tx_count++;
+}
+
+bool MemoryCanTransport::inject(const can_frame_t& frame) {
+    if(rx_count == MEMORY_BUS_DEPTH) {
+        return false;
+    }
+    rx_queue[(rx_head + rx_count) % MEMORY_BUS_DEPTH] = frame;
+    rx_count++;
+    return true;
+}
+
+bool MemoryCanTransport::take(can_frame_t& frame) {
+    if(tx_count == 0) {
+        return false;
+    }
+    frame = tx_queue[tx_head];
+    tx_head = (tx_head + 1) % MEMORY_BUS_DEPTH;
+    tx_count--;
+    return true;
+}
+
+MemoryCanTransport memory_bus[CAN_BUS_COUNT];
+
+CanTransport* const can_transports[CAN_BUS_COUNT] = {
+    &memory_bus[0], &memory_bus[1], &memory_bus[2]
+};
+#endif
@@ -0,0 +1,166 @@
+#ifndef CAN_TRANSPORT_H
+#define CAN_TRANSPORT_H
+
+#include <Arduino.h>
+#include <FlexCAN_T4.h>
+
+/*
+ * CAN Transport Abstraction
+ *
+ * Mode handlers and the ISO-TP engine send and receive frames through a
+ * CanTransport instead of a FlexCAN_T4 object, so the same code runs on
+ * a classic CAN controller or on a CAN FD controller:
+ *
+ * - ClassicCanTransport: CAN1, CAN2 or CAN3, 8-byte frames
+ * - FdCanTransport:      CAN3, up to 64-byte frames with bit-rate switch
+ *                        (set USE_CAN_FD to 1; needs an FD transceiver on
+ *                        the CAN3 pins)
+ * - MemoryCanTransport:  FD-capable in-memory bus for builds without
+ *                        ARDUINO, with injected requests and captured
+ *                        responses (no such build is part of this tree;
+ *                        it needs its own Arduino and FlexCAN_T4 shims)
+ *
+ * can_transports[] holds one transport per controller.
+ *
+ * Writes are interrupt-safe: periodic broadcasts (tx_schedule.h) are
+ * sent from the 1 ms timer interrupt while the main loop answers requests.
+ * Every frame read or written is passed to the frame taps (can_tap_add).
+ *
+ * Frames travel as can_frame_t, which holds up to 64 data bytes. Mode
+ * handlers keep building 8-byte CAN_message_t single frames; the
+ * transport sends them in the frame format of the last request, so a
+ * classic tester on an FD bus still gets classic frames back.
+ */
+
+#ifndef USE_CAN_FD
+#define USE_CAN_FD            0         // 1 = CAN FD on CAN3, 0 = classic CAN on CAN1
+#endif
+
+#define CAN_MAX_LEN           8         // Classic CAN data length
+#define CAN_FD_MAX_LEN        64        // CAN FD data length
+#define CAN_FD_DATA_RATE      2000000   // Data phase bit rate (BRS)
+
+// Teensy 4.0 controllers; CAN3 is the FD-capable one
+#define CAN_BUS_COUNT         3
+#define CAN_BUS_CAN1          0
+#define CAN_BUS_CAN2          1
+#define CAN_BUS_CAN3          2
+
+/*
+ * Transport-neutral frame
+ */
+typedef struct {
+    uint32_t id;              // CAN identifier
+    bool extended;            // 29-bit identifier
+    bool fd;                  // CAN FD frame (EDL set)
+    uint8_t len;              // Data bytes: 0-8 classic, 0-64 FD
+    uint8_t buf[CAN_FD_MAX_LEN];
+    uint32_t time_us;         // Received frames: clock_us() at the end of the frame,
+                              // from the controller's hardware timestamp
+} can_frame_t;
+
+/*
+ * Round a payload length up to the next valid CAN FD data length
+ * (0-8, 12, 16, 20, 24, 32, 48, 64)
+ */
+uint8_t can_fd_frame_len(uint8_t len);
+
+class CanTransport {
+public:
+    virtual void begin(uint32_t baud) = 0;
+    virtual bool read(can_frame_t& frame) = 0;      // Next received frame, false if none
+    virtual void write(const can_frame_t& frame) = 0;
+    virtual bool fd_capable(void) = 0;              // Can send frames longer than 8 bytes
+    virtual void set_baud(uint32_t baud, bool listen_only) = 0;  // Change bit timing only
+    virtual uint8_t rx_errors(void) = 0;            // Receive error counter (REC)
+
+    /*
+     * Send a handler's 8-byte frame in the format of the last request
+     */
+    void write(const CAN_message_t& msg);
+
+protected:
+    bool last_rx_fd = false;  // Last received frame was CAN FD
+    uint32_t bit_rate = 0;    // Nominal rate, for timestamp conversion
+};
+
+#ifdef ARDUINO
+template <CAN_DEV_TABLE controller>
+class ClassicCanTransport : public CanTransport {
+public:
+    void begin(uint32_t baud);
+    bool read(can_frame_t& frame);
+    void write(const can_frame_t& frame);
+    bool fd_capable(void) { return false; }
+    void set_baud(uint32_t baud, bool listen_only);
+    uint8_t rx_errors(void);
+    using CanTransport::write;
+
+private:
+    FlexCAN_T4<controller, RX_SIZE_256, TX_SIZE_16> can;
+};
+
+class FdCanTransport : public CanTransport {
+public:
+    void begin(uint32_t baud);
+    bool read(can_frame_t& frame);
+    void write(const can_frame_t& frame);
+    bool fd_capable(void) { return true; }
+    void set_baud(uint32_t baud, bool listen_only);
+    uint8_t rx_errors(void);
+    using CanTransport::write;
+
+private:
+    void set_timing(uint32_t baud, bool listen_only);
+    FlexCAN_T4FD<CAN3, RX_SIZE_256, TX_SIZE_16> can;
+};
+#else
+/*
+ * In-memory bus for a build without ARDUINO
+ * inject() queues a frame as if a tester had sent it; frames the ECU
+ * writes are collected and returned by take(). Setting line_baud makes
+ * the simulated tester send at that rate: while the ECU's rate differs,
+ * injected frames are lost as receive errors.
+ */
+#define MEMORY_BUS_DEPTH      32
+
+class MemoryCanTransport : public CanTransport {
+public:
+    void begin(uint32_t baud);
+    bool read(can_frame_t& frame);
+    void write(const can_frame_t& frame);
+    bool fd_capable(void) { return true; }
+    void set_baud(uint32_t baud, bool listen_only);
+    uint8_t rx_errors(void) { return rx_error_count; }
+    using CanTransport::write;
+
+    uint32_t line_baud = 0;                         // Tester's rate, 0 = always matches
+    bool inject(const can_frame_t& frame);          // Tester -> ECU
+    bool take(can_frame_t& frame);                  // ECU -> tester
+
+private:
+    can_frame_t rx_queue[MEMORY_BUS_DEPTH];
+    can_frame_t tx_queue[MEMORY_BUS_DEPTH];
+    uint8_t rx_head = 0, rx_count = 0;
+    uint8_t tx_head = 0, tx_count = 0;
+    uint32_t baud = 0;
+    bool listen_only = false;
+    uint8_t rx_error_count = 0;
+};
+#endif
+
+extern CanTransport* const can_transports[CAN_BUS_COUNT];  // Indexed by CAN_BUS_CANx
+
+/*
+ * Frame taps - see every frame a controller receives or sends (host link
+ * trace, SLCAN gateway). Broadcasts are written from the timer interrupt,
+ * so a tap must be short and interrupt-safe.
+ */
+#define CAN_TAP_MAX           4
+
+typedef void (*can_tap_fn)(CanTransport* transport, const can_frame_t& frame, bool tx);
+bool can_tap_add(can_tap_fn tap);       // No-op if present; false when all slots are taken
+void can_tap_remove(can_tap_fn tap);
+void can_tap_frame(CanTransport* transport, const can_frame_t& frame, bool tx);  // Transports
+
+#endif // CAN_TRANSPORT_H
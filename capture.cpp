@@ -0,0 +1,463 @@
+/*
+ * Triggered CAN Capture Buffer
+ *
+ * Block ring, delta encoder/decoder, triggers and the candump/ASC export.
+ * See capture.h for the record format.
+ */
+
+#include "capture.h"
+#include "memory_map.h"
+#include "sim_clock.h"
+
+#define BLOCK_HEADER            6         // Base time (4), bytes used (2)
+
+// Record flags
+#define REC_TX                  0x01
+#define REC_EXTENDED            0x02
+#define REC_FD                  0x04
+#define REC_DELTA               0x08
+#define REC_BUS_SHIFT           4
+
+#define RECORD_MAX              (1 + 5 + 5 + 1 + CAN_FD_MAX_LEN)
+
+typedef struct {
+    uint32_t key;                 // Bus, IDE and ID
+    uint32_t block;               // Block serial the entry belongs to
+    uint8_t len;
+    uint8_t data[CAN_MAX_LEN];
+} capture_slot_t;
+
+DMAMEM static uint8_t blocks[CAPTURE_BLOCKS][CAPTURE_BLOCK_SIZE];  // Not zeroed: read only once written
+static uint8_t oldest = 0;
+static uint8_t current = 0;
+static uint8_t block_count = 0;
+static uint32_t block_serial = 0;         // Bumped for every new block
+static uint32_t last_time;                // Time of the last record in the current block
+static capture_slot_t slots[CAPTURE_ID_SLOTS];
+
+static volatile capture_state_t state = CAPTURE_RECORDING;
+static capture_trigger_t trigger;
+static uint32_t trigger_time = 0;
+static uint32_t post_end;
+static bool truncated = false;
+static uint32_t frame_count = 0;
+static bool exporting = false;
+
+/*
+ * Block and slot helpers
+ */
+static uint16_t block_used(uint8_t block) {
+    return blocks[block][4] | (blocks[block][5] << 8);
+}
+
+static uint32_t block_base(uint8_t block) {
+    const uint8_t* p = blocks[block];
+    return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void set_block_used(uint8_t block, uint16_t used) {
+    blocks[block][4] = used & 0xFF;
+    blocks[block][5] = used >> 8;
+}
+
+static void start_block(uint32_t time) {
+    if(block_count == 0) {
+        block_count = 1;
+    } else {
+        current = (current + 1) % CAPTURE_BLOCKS;
+        if(block_count == CAPTURE_BLOCKS) {
+            oldest = (oldest + 1) % CAPTURE_BLOCKS;  // Drop the oldest history
+        } else {
+            block_count++;
+        }
+    }
+
+    uint8_t* p = blocks[current];
+    p[0] = time & 0xFF;
+    p[1] = (time >> 8) & 0xFF;
+    p[2] = (time >> 16) & 0xFF;
+    p[3] = (time >> 24) & 0xFF;
+    set_block_used(current, BLOCK_HEADER);
+    last_time = time;
+    block_serial++;               // Invalidates every slot
+}
+
+static uint32_t slot_key(uint8_t bus, const can_frame_t& frame) {
+    return (frame.id & 0x1FFFFFFF) | (frame.extended ? 0x20000000 : 0) | ((uint32_t)bus << 30);
+}
+
+static uint8_t slot_index(uint32_t key) {
+    return (uint32_t)(key * 2654435761u) >> 25;  // Multiplicative hash, 7 bits
+}
+
+static uint8_t put_varint(uint8_t* p, uint32_t value) {
+    uint8_t n = 0;
+    while(value >= 0x80) {
+        p[n++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    p[n++] = value;
+    return n;
+}
+
+static uint32_t get_varint(const uint8_t* p, uint16_t* offset) {
+    uint32_t value = 0;
+    uint8_t shift = 0;
+    uint8_t byte;
+    do {
+        byte = p[(*offset)++];
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while(byte & 0x80);
+    return value;
+}
+
+// Receive timestamps can be a little older than the last send: signed deltas
+static uint32_t zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+/*
+ * True once the ring is full and its oldest block holds frames inside the
+ * pre-trigger window, so starting a new block would evict them
+ */
+static bool pre_window_at_risk(void) {
+    if(state != CAPTURE_POST_TRIGGER || block_count < CAPTURE_BLOCKS) {
+        return false;
+    }
+    uint32_t start = trigger_time - (uint32_t)trigger.pre_ms * 1000;
+    return (int32_t)(block_base((oldest + 1) % CAPTURE_BLOCKS) - start) > 0;
+}
+
+/*
+ * Encoder - false if the frame was not stored (capture ended early)
+ */
+static bool capture_record(uint8_t bus, const can_frame_t& frame, bool tx, uint32_t time) {
+    uint8_t rec[RECORD_MAX];
+    uint8_t n = 0;
+    uint32_t key = slot_key(bus, frame);
+    capture_slot_t* slot = &slots[slot_index(key)];
+    bool delta = frame.len > 0 && frame.len <= CAN_MAX_LEN && slot->block == block_serial &&
+                 slot->key == key && slot->len == frame.len;
+
+    if(block_count == 0) {
+        start_block(time);
+    }
+
+    rec[n++] = (tx ? REC_TX : 0) | (frame.extended ? REC_EXTENDED : 0) |
+               (frame.fd ? REC_FD : 0) | (delta ? REC_DELTA : 0) | (bus << REC_BUS_SHIFT);
+    n += put_varint(&rec[n], zigzag(time - last_time));
+    n += put_varint(&rec[n], frame.id);
+    rec[n++] = frame.len;
+
+    if(delta) {
+        uint8_t* bitmap = &rec[n++];
+        *bitmap = 0;
+        for(uint8_t i = 0; i < frame.len; i++) {
+            if(frame.buf[i] == slot->data[i]) continue;
+            *bitmap |= (1 << i);
+            rec[n++] = frame.buf[i];
+        }
+    } else {
+        memcpy(&rec[n], frame.buf, frame.len);
+        n += frame.len;
+    }
+
+    // Records never straddle blocks; a new block starts without history
+    if(block_used(current) + n > CAPTURE_BLOCK_SIZE) {
+        if(pre_window_at_risk()) {
+            // pre_ms + post_ms does not fit at this bus load: keep the
+            // pre-trigger history and end the post window here
+            state = CAPTURE_FROZEN;
+            truncated = true;
+            post_end = last_time;
+            return false;
+        }
+        start_block(time);
+        return capture_record(bus, frame, tx, time);
+    }
+
+    memcpy(&blocks[current][block_used(current)], rec, n);
+    set_block_used(current, block_used(current) + n);
+    last_time = time;
+
+    if(frame.len <= CAN_MAX_LEN) {
+        slot->key = key;
+        slot->block = block_serial;
+        slot->len = frame.len;
+        memcpy(slot->data, frame.buf, frame.len);
+    }
+    return true;
+}
+
+/*
+ * Triggers
+ */
+static void capture_fire(uint32_t time) {
+    trigger_time = time ? time : 1;   // 0 means "not triggered"
+    post_end = time + (uint32_t)trigger.post_ms * 1000;
+    state = CAPTURE_POST_TRIGGER;
+}
+
+static bool frame_matches(const can_frame_t& frame) {
+    if((frame.id ^ trigger.id) & trigger.id_mask) {
+        return false;
+    }
+    for(uint8_t i = 0; i < CAN_MAX_LEN; i++) {
+        uint8_t byte = (i < frame.len) ? frame.buf[i] : 0;
+        if((byte ^ trigger.data[i]) & trigger.data_mask[i]) return false;
+    }
+    return true;
+}
+
+static void capture_tap(CanTransport* transport, const can_frame_t& frame, bool tx) {
+    uint32_t time = tx ? clock_us() : frame.time_us;
+    uint8_t bus = 0;
+
+    if(state == CAPTURE_FROZEN || exporting) {
+        return;
+    }
+    while(bus < CAN_BUS_COUNT - 1 && can_transports[bus] != transport) bus++;
+
+    noInterrupts();               // Main loop and timer interrupt both send
+    if(state == CAPTURE_POST_TRIGGER && (int32_t)(time - post_end) > 0) {
+        state = CAPTURE_FROZEN;   // Post window complete
+    } else if(capture_record(bus, frame, tx, time)) {
+        frame_count++;
+        if(state == CAPTURE_ARMED && (trigger.sources & CAPTURE_TRIG_FRAME) && frame_matches(frame)) {
+            capture_fire(time);
+        }
+    }
+    interrupts();
+}
+
+FLASHMEM void capture_init(void) {
+    state = CAPTURE_RECORDING;
+    can_tap_add(capture_tap);
+}
+
+void capture_arm(const capture_trigger_t* config) {
+    noInterrupts();
+    trigger = *config;
+    trigger_time = 0;
+    truncated = false;
+    exporting = false;
+    state = trigger.sources ? CAPTURE_ARMED : CAPTURE_RECORDING;
+    interrupts();
+}
+
+void capture_event(uint8_t source) {
+    noInterrupts();
+    if(state == CAPTURE_ARMED && (trigger.sources & source)) {
+        capture_fire(clock_us());
+    }
+    interrupts();
+}
+
+void capture_update(void) {
+    // Quiet bus: the post window still ends on time
+    noInterrupts();
+    if(state == CAPTURE_POST_TRIGGER && (int32_t)(clock_us() - post_end) > 0) {
+        state = CAPTURE_FROZEN;
+    }
+    interrupts();
+}
+
+capture_state_t capture_state(void) {
+    return state;
+}
+
+uint32_t capture_frames(void) {
+    return frame_count;
+}
+
+uint32_t capture_bytes_used(void) {
+    uint32_t total = 0;
+    for(uint8_t i = 0; i < block_count; i++) {
+        total += block_used((oldest + i) % CAPTURE_BLOCKS);
+    }
+    return total;
+}
+
+uint32_t capture_trigger_time(void) {
+    return trigger_time;
+}
+
+bool capture_truncated(void) {
+    return truncated;
+}
+
+/*
+ * Export - decodes the blocks oldest first with its own slot table
+ */
+static struct {
+    uint8_t format;
+    uint8_t header;               // Header lines written so far
+    uint8_t blocks_left;
+    uint8_t block;
+    uint16_t offset;
+    uint32_t time;
+    uint32_t serial;              // Decoder block serial, for dec_slots
+    bool windowed;
+    uint32_t start_us, end_us;
+    bool first;
+    uint32_t t0;                  // ASC: time of the first exported frame
+    bool trailer_done;
+} ex;
+
+DMAMEM static capture_slot_t dec_slots[CAPTURE_ID_SLOTS];  // A delta record always follows its slot's full record
+
+bool capture_export_start(uint8_t format) {
+    if(format > CAPTURE_FORMAT_ASC || state == CAPTURE_POST_TRIGGER) {
+        return false;
+    }
+    exporting = true;             // Hold the buffer still
+
+    ex.format = format;
+    ex.header = 0;
+    ex.blocks_left = block_count;
+    ex.block = oldest;
+    ex.offset = BLOCK_HEADER;
+    ex.time = block_count ? block_base(oldest) : 0;
+    ex.serial++;
+    ex.windowed = (state == CAPTURE_FROZEN && trigger_time != 0);
+    ex.start_us = trigger_time - (uint32_t)trigger.pre_ms * 1000;
+    ex.end_us = post_end;
+    ex.first = true;
+    ex.trailer_done = false;
+    return true;
+}
+
+// Next frame in the buffer, false at the end
+static bool decode_next(can_frame_t* frame, uint8_t* bus, bool* tx, uint32_t* time) {
+    while(ex.blocks_left > 0) {
+        const uint8_t* p = blocks[ex.block];
+
+        if(ex.offset >= block_used(ex.block)) {
+            ex.blocks_left--;
+            ex.block = (ex.block + 1) % CAPTURE_BLOCKS;
+            ex.offset = BLOCK_HEADER;
+            ex.time = block_base(ex.block);
+            ex.serial++;
+            continue;
+        }
+
+        uint8_t flags = p[ex.offset++];
+        ex.time += unzigzag(get_varint(p, &ex.offset));
+        frame->id = get_varint(p, &ex.offset);
+        frame->len = p[ex.offset++];
+        frame->extended = flags & REC_EXTENDED;
+        frame->fd = flags & REC_FD;
+        *tx = flags & REC_TX;
+        *bus = flags >> REC_BUS_SHIFT;
+        *time = ex.time;
+
+        uint32_t key = slot_key(*bus, *frame);
+        capture_slot_t* slot = &dec_slots[slot_index(key)];
+        if(flags & REC_DELTA) {
+            uint8_t bitmap = p[ex.offset++];
+            for(uint8_t i = 0; i < frame->len; i++) {
+                frame->buf[i] = (bitmap & (1 << i)) ? p[ex.offset++] : slot->data[i];
+            }
+        } else {
+            memcpy(frame->buf, &p[ex.offset], frame->len);
+            ex.offset += frame->len;
+        }
+
+        // Mirror the encoder's slot updates
+        if(frame->len <= CAN_MAX_LEN) {
+            slot->key = key;
+            slot->block = ex.serial;
+            slot->len = frame->len;
+            memcpy(slot->data, frame->buf, frame->len);
+        }
+        return true;
+    }
+    return false;
+}
+
+static uint8_t fd_dlc(uint8_t len) {
+    static const uint8_t sizes[] = { 12, 16, 20, 24, 32, 48, 64 };
+    uint8_t dlc = 9;
+    if(len <= CAN_MAX_LEN) return len;
+    for(uint8_t i = 0; i < sizeof(sizes) && len > sizes[i]; i++) dlc++;
+    return dlc;
+}
+
+static void format_data(char* out, const uint8_t* data, uint8_t len, bool spaced) {
+    static const char hex[] = "0123456789ABCDEF";
+    for(uint8_t i = 0; i < len; i++) {
+        if(spaced) *out++ = ' ';
+        *out++ = hex[data[i] >> 4];
+        *out++ = hex[data[i] & 0x0F];
+    }
+    *out = '\0';
+}
+
+bool capture_export_line(char* line) {
+    static const char* const asc_header[] = {
+        "date Thu Jan 1 12:00:00.000 am 1970\n",
+        "base hex  timestamps absolute\n",
+        "internal events logged\n",
+        "Begin Triggerblock Thu Jan 1 12:00:00.000 am 1970\n",
+    };
+    char data[CAN_FD_MAX_LEN * 3 + 1];
+    can_frame_t frame;
+    uint8_t bus;
+    bool tx;
+    uint32_t time;
+
+    if(!exporting) {
+        return false;
+    }
+    if(ex.format == CAPTURE_FORMAT_ASC && ex.header < 4) {
+        strcpy(line, asc_header[ex.header++]);
+        return true;
+    }
+
+    while(decode_next(&frame, &bus, &tx, &time)) {
+        if(ex.windowed && ((int32_t)(time - ex.start_us) < 0 || (int32_t)(time - ex.end_us) > 0)) {
+            continue;  // Outside the pre/post window
+        }
+        if(ex.first) {
+            ex.t0 = time;
+            ex.first = false;
+        }
+
+        if(ex.format == CAPTURE_FORMAT_CANDUMP) {
+            format_data(data, frame.buf, frame.len, false);
+            snprintf(line, CAPTURE_LINE_MAX, frame.extended ? "(%lu.%06lu) can%u %08lX#%s%s\n"
+                                                            : "(%lu.%06lu) can%u %03lX#%s%s\n",
+                     (unsigned long)(time / 1000000), (unsigned long)(time % 1000000), bus,
+                     (unsigned long)frame.id, frame.fd ? "#1" : "", data);
+        } else {
+            uint32_t rel = time - ex.t0;
+            char id[12];
+            format_data(data, frame.buf, frame.len, true);
+            snprintf(id, sizeof(id), frame.extended ? "%lXx" : "%lX", (unsigned long)frame.id);
+            if(frame.fd) {
+                snprintf(line, CAPTURE_LINE_MAX, "%4lu.%06lu CANFD %3u %-4s %8s %32s 1 0 %x %2u%s 0 0 0 0 0 0 0 0\n",
+                         (unsigned long)(rel / 1000000), (unsigned long)(rel % 1000000), bus + 1,
+                         tx ? "Tx" : "Rx", id, "", fd_dlc(frame.len), frame.len, data);
+            } else {
+                snprintf(line, CAPTURE_LINE_MAX, "%4lu.%06lu %u  %-15s %-4s d %u%s\n",
+                         (unsigned long)(rel / 1000000), (unsigned long)(rel % 1000000), bus + 1,
+                         id, tx ? "Tx" : "Rx", frame.len, data);
+            }
+        }
+        return true;
+    }
+
+    if(ex.format == CAPTURE_FORMAT_ASC && !ex.trailer_done) {
+        ex.trailer_done = true;
+        strcpy(line, "End TriggerBlock\n");
+        return true;
+    }
+
+    exporting = false;            // Recording resumes unless frozen
+    return false;
+}
@@ -0,0 +1,114 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <Arduino.h>
+#include "can_transport.h"
+
+/*
+ * Triggered CAN Capture Buffer
+ *
+ * Timing disputes with tool vendors come down to the exact frames around
+ * one event. The capture buffer records every frame on every bus, all the
+ * time, from a frame tap (can_tap_add). When an armed trigger fires it
+ * keeps recording for the post-trigger window, then freezes so the frames
+ * around the event are kept until exported:
+ *
+ *   |<------ pre_ms ------>|<----- post_ms ----->|
+ *   ......................TRIGGER.................FROZEN
+ *
+ * Once triggered the ring never evicts a block that still holds frames of
+ * the pre-trigger window. If pre_ms + post_ms does not fit at the current
+ * bus load, the post window ends early where the ring is full and
+ * capture_truncated() reports it.
+ *
+ * TRIGGERS (any combination, CAPTURE_TRIG_*):
+ * - FRAME:        a frame whose ID and payload match under masks
+ *                 (e.g. one tester request, or any frame with byte 1 = 0x22)
+ * - NRC:          the simulator sends a negative response (7F), reported
+ *                 by the code that builds it, so background traffic
+ *                 that happens to look like one never fires it
+ * - FC_TIMEOUT:   no flow control from the tester within N_Bs
+ * - ISOTP_ABORT:  a transfer aborted by the tester (flow status overflow)
+ *                 or a request left incomplete (N_Cr)
+ *
+ * DELTA COMPRESSION:
+ * The buffer is a ring of CAPTURE_BLOCK_SIZE blocks; the oldest block is
+ * dropped as a whole when a new one is needed. Within a block, a frame
+ * with the same bus, ID and length as the previous frame on that ID is
+ * stored as a bitmap of the changed bytes and those bytes only, so a
+ * periodic message whose counter ticks takes 2 data bytes instead of 8.
+ * Times are stored as the microseconds since the previous frame. Every
+ * block starts without history, so each block decodes on its own:
+ *
+ *   block:  base time (4), bytes used (2), records...
+ *   record: flags (1), time delta (varint), ID (varint),
+ *           length (1), data - or bitmap + changed bytes
+ *
+ * A periodic frame with a ticking counter takes about 6 bytes instead of
+ * the 16+ of a raw frame; even random 8-byte payloads (the background
+ * traffic generator) average 10. The default 48 KB holds about 3 seconds
+ * of a 40% loaded 500 kbit/s bus, and proportionally more of a quiet one.
+ *
+ * EXPORT:
+ * capture_export_line() turns the frozen window (or the whole buffer if
+ * nothing triggered) into candump log or Vector ASC text, one line per
+ * call, so the host link can stream it without stalling the main loop.
+ * Recording pauses while an export runs.
+ */
+
+#define CAPTURE_BLOCK_SIZE      1024
+#define CAPTURE_BLOCKS          48        // 48 KB of history
+#define CAPTURE_ID_SLOTS        128       // Delta history, direct-mapped by ID
+#define CAPTURE_LINE_MAX        320       // Longest export line (ASC, 64 data bytes)
+
+/*
+ * Trigger sources (bitmask)
+ */
+#define CAPTURE_TRIG_FRAME      0x01
+#define CAPTURE_TRIG_NRC        0x02
+#define CAPTURE_TRIG_FC_TIMEOUT 0x04
+#define CAPTURE_TRIG_ISOTP_ABORT 0x08
+
+/*
+ * Recorder state
+ */
+typedef enum {
+    CAPTURE_RECORDING,        // Continuous, no trigger armed
+    CAPTURE_ARMED,            // Continuous, waiting for the trigger
+    CAPTURE_POST_TRIGGER,     // Triggered, recording the post window
+    CAPTURE_FROZEN            // Window complete, kept until re-armed
+} capture_state_t;
+
+/*
+ * Export formats
+ */
+#define CAPTURE_FORMAT_CANDUMP  0         // (sec.usec) canN ID#DATA
+#define CAPTURE_FORMAT_ASC      1         // Vector ASCII log
+
+typedef struct {
+    uint8_t sources;          // CAPTURE_TRIG_*
+    uint16_t pre_ms;          // History kept before the trigger
+    uint16_t post_ms;         // Recording after the trigger
+    uint32_t id;              // FRAME: frame matches if (id ^ frame id) & id_mask == 0
+    uint32_t id_mask;
+    uint8_t data[CAN_MAX_LEN];  // ... and (data ^ payload) & data_mask == 0
+    uint8_t data_mask[CAN_MAX_LEN];
+} capture_trigger_t;
+
+/*
+ * Capture Interface
+ */
+void capture_init(void);                        // Start recording
+void capture_arm(const capture_trigger_t* trigger);  // Re-arm; unfreezes the buffer
+void capture_event(uint8_t source);             // Internal event (CAPTURE_TRIG_NRC ...)
+void capture_update(void);                      // Main loop: end of the post window
+capture_state_t capture_state(void);
+uint32_t capture_frames(void);                  // Frames recorded since init
+uint32_t capture_bytes_used(void);
+uint32_t capture_trigger_time(void);            // clock_us() of the trigger, 0 if none
+bool capture_truncated(void);                   // Post window ended early (ring full)
+
+bool capture_export_start(uint8_t format);      // False while recording a post window
+bool capture_export_line(char* line);           // Next text line, false when done
+
+#endif // CAPTURE_H
@@ -0,0 +1,190 @@
+/*
+ * Drive Cycles
+ *
+ * Trace player and vehicle model. The traces themselves are in
+ * drive_cycle_tables.cpp. See drive_cycle.h.
+ */
+
+#include "drive_cycle.h"
+
+// Vehicle model: a 1.5 t, 2.0 L, 100 kW petrol car
+#define DC_MASS_KG              1500.0f
+#define DC_ROLLING_N            150.0f    // Rolling resistance
+#define DC_DRAG_N_PER_MS2       0.40f     // Aerodynamic drag / (m/s)^2
+#define DC_POWER_W_PER_RPM      16.7f     // Available power, ~100 kW at 6000 rpm
+#define DC_DISPLACEMENT_L       2.0f
+#define DC_AIR_G_PER_L          1.2f
+#define DC_IDLE_RPM             700
+#define DC_MAX_RPM              6000
+#define DC_GEARS                6
+#define DC_DOWNSHIFT_KMH        8         // Shift hysteresis
+#define DC_KICKDOWN_LOAD        0.85f     // Shift down above this load...
+#define DC_KICKDOWN_RPM         4500      // ...unless the lower gear would exceed this
+
+// Road speed per 1000 rpm in each gear (km/h)
+static const float gear_kmh_per_krpm[DC_GEARS] = { 8.5f, 15.0f, 22.0f, 30.0f, 38.0f, 47.0f };
+// Upshift out of gear n+1 above this speed (km/h)
+static const uint8_t gear_upshift_kmh[DC_GEARS - 1] = { 20, 35, 50, 65, 80 };
+
+static const drive_cycle_def_t* cycle = NULL;
+static uint8_t cycle_id = DRIVE_CYCLE_NONE;
+static bool looping = false;
+static bool finished = false;
+static uint16_t sample = 0;       // Sample at or before the current time
+static uint16_t fraction_ms = 0;  // Time past that sample
+static int16_t speed_at = 0;      // Speed at sample (0.1 km/h)
+static int16_t speed_next = 0;    // Speed one second later
+static uint8_t gear = 1;
+
+// Speed of the next sample, wrapping to the start when looping
+static int16_t drive_cycle_next_speed(void) {
+    if(sample + 1 < cycle->samples) {
+        return speed_at + cycle->deltas[sample + 1];
+    }
+    return looping ? cycle->deltas[0] : speed_at;
+}
+
+static void drive_cycle_rewind(void) {
+    sample = 0;
+    fraction_ms = 0;
+    speed_at = cycle->deltas[0];
+    speed_next = drive_cycle_next_speed();
+    finished = false;
+    gear = 1;
+}
+
+// Move on one sample; false at the end of a cycle played once.
+// The end of a trace is a key-off/key-on, so each pass of a looping
+// cycle is a drive cycle for the monitors and IUMPR
+static bool drive_cycle_advance(void) {
+    if(sample + 1 >= cycle->samples) {
+        sim_state_ignition_cycle();
+        if(!looping) {
+            finished = true;
+            return false;
+        }
+        sample = 0;
+        speed_at = cycle->deltas[0];
+    } else {
+        sample++;
+        speed_at = speed_next;
+    }
+    speed_next = drive_cycle_next_speed();
+    return true;
+}
+
+bool drive_cycle_select(uint8_t id, bool loop) {
+    if(id >= DRIVE_CYCLE_COUNT || (id != DRIVE_CYCLE_NONE && drive_cycle_defs[id].samples == 0)) {
+        return false;  // Unknown, or its trace is not in the tree
+    }
+    cycle_id = id;
+    looping = loop;
+    cycle = (id == DRIVE_CYCLE_NONE) ? NULL : &drive_cycle_defs[id];
+    if(cycle != NULL) {
+        drive_cycle_rewind();
+    }
+    return true;
+}
+
+uint8_t drive_cycle_current(void) {
+    return cycle_id;
+}
+
+bool drive_cycle_finished(void) {
+    return finished;
+}
+
+uint32_t drive_cycle_position_ms(void) {
+    return (uint32_t)sample * 1000 + fraction_ms;
+}
+
+uint8_t drive_cycle_gear(void) {
+    return gear;
+}
+
+// Gear for the road speed, holding the current one inside the hysteresis
+static void drive_cycle_shift(float kmh) {
+    while(gear < DC_GEARS && kmh > gear_upshift_kmh[gear - 1]) {
+        gear++;
+    }
+    while(gear > 1 && kmh < gear_upshift_kmh[gear - 2] - DC_DOWNSHIFT_KMH) {
+        gear--;
+    }
+}
+
+// Engine speed at a road speed in a gear; at least idle
+static float drive_cycle_rpm(float kmh, uint8_t in_gear) {
+    float rpm = kmh * 1000.0f / gear_kmh_per_krpm[in_gear - 1];
+    return constrain(rpm, (float)DC_IDLE_RPM, (float)DC_MAX_RPM);
+}
+
+bool drive_cycle_step(uint32_t elapsed_ms, sim_state_t* state) {
+    if(cycle == NULL) {
+        return false;
+    }
+
+    // Decode up to the current second
+    if(!finished) {
+        elapsed_ms += fraction_ms;
+        while(elapsed_ms >= 1000) {
+            elapsed_ms -= 1000;
+            if(!drive_cycle_advance()) {
+                elapsed_ms = 0;
+                break;
+            }
+        }
+        fraction_ms = elapsed_ms;
+    }
+
+    // Speed interpolated between the samples; acceleration is constant over the second
+    int16_t accel = finished ? 0 : speed_next - speed_at;     // 0.1 km/h per s
+    float kmh = (speed_at + accel * (int32_t)fraction_ms / 1000.0f) / 10.0f;
+    float mps = kmh / 3.6f;
+    float accel_ms2 = accel / 36.0f;
+
+    // Road load
+    float force = DC_MASS_KG * accel_ms2 + DC_DRAG_N_PER_MS2 * mps * mps;
+    if(kmh >= 1.0f) {
+        force += DC_ROLLING_N;
+    }
+
+    // Gear for the speed, kicked down while the load is too high for it
+    drive_cycle_shift(kmh);
+    while(gear > 1 && force * mps > DC_KICKDOWN_LOAD * drive_cycle_rpm(kmh, gear) * DC_POWER_W_PER_RPM &&
+          drive_cycle_rpm(kmh, gear - 1) <= DC_KICKDOWN_RPM) {
+        gear--;
+    }
+    float rpm = drive_cycle_rpm(kmh, gear);
+
+    // Against the engine's available power
+    float load, throttle;
+    if(kmh < 1.0f && accel <= 0) {
+        load = 0.24f;             // Idle with accessories
+        throttle = 0.118f;
+    } else if(force <= 0.0f) {
+        load = 0.12f;             // Overrun, throttle closed
+        throttle = 0.0f;
+    } else {
+        load = constrain(force * mps / (rpm * DC_POWER_W_PER_RPM), 0.15f, 1.0f);
+        throttle = 0.118f + 0.7f * load;
+    }
+    float maf = rpm / 120.0f * DC_DISPLACEMENT_L * DC_AIR_G_PER_L * load;  // g/s
+
+    state->vehicle_speed = (uint8_t)min(kmh + 0.5f, 255.0f);
+    state->engine_rpm = (uint16_t)(rpm * 4);
+    state->engine_load = (uint8_t)(load * 255);
+    state->throttle_position = (uint8_t)(throttle * 255);
+    state->maf_airflow = (uint16_t)(maf * 100);
+
+    // Driving state for the monitors and IUMPR
+    if(kmh < 1.0f) {
+        state->drive_state = IDLE;
+    } else if(accel >= 11) {      // 0.3 m/s^2
+        state->drive_state = ACCELERATING;
+    } else if(accel <= -11) {
+        state->drive_state = BRAKING;
+    } else {
+        state->drive_state = (kmh >= 70.0f) ? HIGHWAY : CITY;
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+#ifndef DRIVE_CYCLE_H
+#define DRIVE_CYCLE_H
+
+#include <Arduino.h>
+#include "sim_state.h"
+
+/*
+ * Drive Cycles
+ *
+ * Plays a speed-time trace instead of the random driving states, so the
+ * simulated vehicle follows a standard cycle:
+ *
+ *   Cycle   Source                          Length
+ *   FTP-75  EPA dynamometer driver's aid    1874 s (10 min soak left out)
+ *   HWFET   EPA dynamometer driver's aid    765 s
+ *   WLTC    UN GTR No. 15, class 3b         1800 s
+ *
+ * TABLES:
+ * Each cycle is a 1 Hz trace stored in flash as one signed byte per
+ * second: the change of speed in 0.1 km/h since the previous second.
+ * The trace starts from a standstill. The regulatory cycles change speed
+ * by well under 12.7 km/h per second, so every step fits. Integer deltas
+ * rebuild the rounded speeds exactly, with no drift, and no cycle takes
+ * more than 2 KB. The player decodes one sample a second and
+ * interpolates between the two around the current time at the
+ * simulation rate (100 ms).
+ *
+ * The traces must be the official second-by-second schedules, so that
+ * fuel-economy and emissions estimates can be validated against them.
+ * They are not in the tree yet; until a table is filled in
+ * (drive_cycle_tables.cpp) its cycle cannot be selected. Convert each
+ * schedule to deltas of the rounded 0.1 km/h speeds:
+ *
+ *   awk '{ v = int($2 * 16.09344 + 0.5); printf "%d, ", v - p; p = v }' hwycol.txt
+ *
+ * (speeds in mph; use $2 * 10 for km/h), and check the total distance
+ * against the published one (FTP-75 17.77 km, HWFET 16.5 km, WLTC
+ * 23.27 km).
+ *
+ * POWERTRAIN:
+ * From speed and acceleration a simple vehicle model derives the other
+ * values: a six-speed gearbox with shift hysteresis gives the gear and
+ * engine speed; road load (rolling resistance, drag, inertia) against
+ * the engine's available power gives the calculated load and throttle;
+ * airflow follows from engine speed, displacement and load. The driving
+ * state (IDLE ... BRAKING) follows the trace, so the monitors and IUMPR
+ * see the cycle too. Held signals (sim_state.h) still override.
+ *
+ * A cycle is chosen at run time over the host link (SET_DRIVE_CYCLE) and
+ * plays once, ending at a standstill, or loops. The end of the trace, and
+ * every wrap of a looping cycle, is a simulated key-off/key-on
+ * (sim_state_ignition_cycle()), so each pass counts as an ignition and
+ * drive cycle for the monitors and IUMPR. Choosing a driving state
+ * (SET_PROFILE) stops it.
+ */
+
+enum {
+    DRIVE_CYCLE_NONE,             // Random driving states (sim_state.cpp)
+    DRIVE_CYCLE_FTP75,
+    DRIVE_CYCLE_HWFET,
+    DRIVE_CYCLE_WLTC,
+    DRIVE_CYCLE_COUNT
+};
+
+typedef struct {
+    const char* name;
+    const int8_t* deltas;         // Speed change per second (0.1 km/h)
+    uint16_t samples;             // Trace length (s)
+} drive_cycle_def_t;
+
+extern const drive_cycle_def_t drive_cycle_defs[DRIVE_CYCLE_COUNT];  // drive_cycle_tables.cpp
+
+/*
+ * Drive Cycle Interface
+ */
+bool drive_cycle_select(uint8_t cycle, bool loop);   // From the start; false if unknown or no trace
+uint8_t drive_cycle_current(void);        // DRIVE_CYCLE_*, NONE when off
+bool drive_cycle_finished(void);          // Played once to the end, not looping
+uint32_t drive_cycle_position_ms(void);   // Time into the trace
+uint8_t drive_cycle_gear(void);           // 1-6
+
+/*
+ * Advance the cycle by elapsed_ms and write speed, RPM, load, throttle,
+ * MAF and driving state into state. Returns false, leaving state alone,
+ * when no cycle is selected.
+ */
+bool drive_cycle_step(uint32_t elapsed_ms, sim_state_t* state);
+
+#endif // DRIVE_CYCLE_H
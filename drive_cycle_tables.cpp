@@ -0,0 +1,17 @@
+/*
+ * Drive Cycle Traces
+ *
+ * 1 Hz speed traces as deltas of 0.1 km/h (drive_cycle.h), generated from
+ * the official schedules. None is included yet: a cycle without a trace
+ * cannot be selected.
+ */
+
+#include "drive_cycle.h"
+#include "memory_map.h"
+
+const drive_cycle_def_t drive_cycle_defs[DRIVE_CYCLE_COUNT] = {
+    { "None",   NULL, 0 },
+    { "FTP-75", NULL, 0 },    // EPA ftpcol.txt (UDDS + first 505 s, soak left out)
+    { "HWFET",  NULL, 0 },    // EPA hwycol.txt
+    { "WLTC",   NULL, 0 },    // UN GTR No. 15, class 3b
+};
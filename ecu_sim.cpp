@@ -16,32 +16,153 @@
 #include <FlexCAN_T4.h>
 #include "mode_registry.h"
 #include "mode_includes.h"
+#include "monitors.h"
+#include "onboard_test.h"
+#include "uds.h"
+#include "nv_store.h"
+#include "iumpr.h"
+#include "j1939.h"
+#include "bus_load.h"
+#include "host_link.h"
+#include "slcan.h"
+#include "capture.h"
+#include "response_timing.h"
+#include "fault_inject.h"
+#include "scheduler.h"
+#include "memory_map.h"
+#include "wcet.h"
+#include "sim_clock.h"
 
 Bounce pushbuttonSW1 = Bounce(SW1, 10);
 Bounce pushbuttonSW2 = Bounce(SW2, 10);
 
-FlexCAN_T4<CAN1, RX_SIZE_256, TX_SIZE_16> can1;  // can1 port 
-extern uint16_t flash_led_tick;
+
+/*
+ * Bus configuration - which controllers are served, at what bit rate and
+ * by which ECUs. The same ECU may sit on several buses; each bus keeps
+ * its own ISO-TP sessions (can_channels).
+ */
+const can_bus_config_t can_bus_config[CAN_BUS_COUNT] = {
+    { true,  CAN_BAUD_AUTO, SIM_ECUS },     // CAN1 - OBD-II port (pins 6/14), rate from init()
+    { false, 250000, ECU_J1939 },           // CAN2 - e.g. a J1939 heavy-duty bus
+    { false, 500000, (ECU_ECM | ECU_FPCM) & SIM_ECUS },  // CAN3 - FD-capable, see USE_CAN_FD
+};
+
+/*
+ * ECU Addressing
+ * One table links each simulated ECU to its 11-bit request/response IDs
+ * and its 29-bit node address; every ID translation goes through it.
+ */
+typedef struct {
+  uint8_t ecu;                  // ECU_ECM, ECU_TCM, ECU_FPCM
+  uint16_t request_id;          // 11-bit physical request
+  uint16_t response_id;         // 11-bit response
+  uint8_t address;              // 29-bit node address (TA of requests, SA of responses)
+} ecu_address_t;
+
+static const ecu_address_t ecu_addresses[] = {
+  { ECU_ECM,  PID_REQUEST_ENGINE,  PID_REPLY_ENGINE,  ECU_ADDR_ENGINE },
+  { ECU_TCM,  PID_REQUEST_TRANS,   PID_REPLY_TRANS,   ECU_ADDR_TRANS },
+  { ECU_FPCM, PID_REQUEST_CHASSIS, PID_REPLY_CHASSIS, ECU_ADDR_CHASSIS },
+};
+
+#define ECU_ADDRESS_COUNT (sizeof(ecu_addresses) / sizeof(ecu_addresses[0]))
+
+/*
+ * Entry for an 11-bit request or response ID, or a 29-bit physical
+ * request (0x18DA<TA>F1) or response (0x18DAF1<SA>); NULL if none
+ */
+static const ecu_address_t* ecu_address(uint32_t can_id, bool extended) {
+  uint8_t address = 0;
+
+  if(extended) {
+    if((can_id & 0xFFFF0000) != ISO15765_PHYS_EXT) return NULL;
+    uint8_t ta = (can_id >> 8) & 0xFF;
+    uint8_t sa = can_id & 0xFF;
+    if(sa == ISO15765_TESTER) address = ta;        // Request to the ECU
+    else if(ta == ISO15765_TESTER) address = sa;   // Response from the ECU
+    else return NULL;
+  }
+
+  for(uint8_t i = 0; i < ECU_ADDRESS_COUNT; i++) {
+    const ecu_address_t* entry = &ecu_addresses[i];
+    if(extended ? (entry->address == address)
+                : (entry->request_id == can_id || entry->response_id == can_id)) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * ECU owning an 11-bit physical request or response ID, 0 for any other ID
+ */
+static uint8_t ecu_for_id(uint32_t can_id) {
+  const ecu_address_t* entry = ecu_address(can_id, false);
+  return entry ? entry->ecu : 0;
+}
+
+/*
+ * Map a received 29-bit request ID to its 11-bit equivalent;
+ * returns 0 for IDs that are not OBD requests
+ */
+static uint32_t request_id_11bit(uint32_t can_id) {
+  if(can_id == PID_REQUEST_EXT) return PID_REQUEST;
+  if((can_id & 0xFF) != ISO15765_TESTER) return 0;  // Not from the tester
+
+  const ecu_address_t* entry = ecu_address(can_id, true);
+  return entry ? entry->request_id : 0;
+}
+
+/*
+ * CAN ID an ECU sends with: the 11-bit ID, or 0x18DAF1<SA> in 29-bit mode
+ */
+static uint32_t response_id_on_bus(uint16_t can_id, bool extended) {
+  if(!extended) return can_id;
+
+  const ecu_address_t* entry = ecu_address(can_id, false);
+  if(entry == NULL) return can_id;
+  return ISO15765_PHYS_EXT | ((uint32_t)ISO15765_TESTER << 8) | entry->address;
+}
 
 ecu_simClass::ecu_simClass() {
  
 }
 
-uint8_t ecu_simClass::init(uint32_t baud) {
+// Green LED flash on each request
+static int8_t led_flash_task = -1;
+
+static void led_flash_off(void) {
+  digitalWrite(LED_green, LOW);
+}
+
+FLASHMEM uint8_t ecu_simClass::init(uint32_t baud) {
   pinMode(SW1,INPUT_PULLUP);
   pinMode(SW2,INPUT_PULLUP);
-  can1.begin();
-  can1.setBaudRate(500000);
-  can1.setMBFilter(ACCEPT_ALL);
-  can1.distribute();
-  can1.mailboxStatus();
+  for(uint8_t i = 0; i < CAN_BUS_COUNT; i++) {
+    memset(&can_channels[i], 0, sizeof(can_channels[i]));  // DMAMEM starts uninitialised
+    can_channels[i].bus = i;
+    can_channels[i].transport = can_transports[i];
+    if(can_bus_config[i].enabled) {
+      uint32_t rate = (i == CAN_BUS_CAN1) ? baud : can_bus_config[i].baud;
+      can_baud_begin(&can_channels[i].link, can_transports[i], rate);
+    }
+  }
+  channel = &can_channels[CAN_BUS_CAN1];
+  request_fd = false;
+  request_extended = false;
+  request_id = PID_REQUEST;
+  nrc_policy = NRC_POLICY_ISO;
+  led_flash_task = sched_add(led_flash_off, 0);
 
   ecu.dtc = 0;  // No emissions DTCs stored
 
   // Initialize Mode 02 freeze frame storage
   // Required by OBD-II to help diagnose intermittent emissions faults
-  freeze_frame[0].data_stored = false;
-  freeze_frame[1].data_stored = false;
+  freeze_frame_clear();
+
+  // Initialize emissions monitors (Mode 06 results, readiness status)
+  monitors_init();
 
   // Initialize with realistic idle values from real Mercedes-Benz
   // These represent a warmed-up engine meeting emissions standards
@@ -52,10 +173,35 @@ uint8_t ecu_simClass::init(uint32_t baud) {
   ecu.maf_airflow = 0;          // Will be calculated dynamically
   ecu.o2_voltage = 0x3C;        // 0.3V - indicates proper combustion
 
+  // Restore DTCs, freeze frames and counters saved before power-down
+  nv_load_state();
+
+  // Power-up starts a new ignition cycle for the IUMPR counters
+  iumpr_init();
+
+  // Periodic J1939 broadcasts and background traffic, sent from the
+  // 1 ms timer (tx_schedule.h)
+  j1939_init();
+  bus_load_init();
+
+  // Responses go out after each ECU's response time
+  resp_timing_init();
+
+  // Binary control protocol on USB serial, SLCAN on the second port
+  host_link_init();
+  slcan_init();
+
+  // Frame history for the capture trigger
+  capture_init();
+
+  // Execution time probes, when built in (USE_WCET)
+  wcet_init();
+
   return 0;
 }
 void ecu_simClass::update_pots(void) 
 {
+  WCET_PROBE(WCET_UPDATE_POTS);
   uint16_t temp;
   ecu.engine_rpm = 0xffff - map(analogRead(AN1), 0, 1023, 0, 0xffff);
   ecu.vehicle_speed = 0xff - map(analogRead(AN3), 0, 1023, 0, 0xff);
@@ -68,127 +214,387 @@ void ecu_simClass::update_pots(void)
   {
     if (pushbuttonSW1.fallingEdge()) 
     {
-      if(ecu.dtc == 0)
-      {
-          ecu.dtc = 1;
-          digitalWrite(LED_red, HIGH);
-
-          // Capture freeze frame data when DTC is triggered
-          freeze_frame[0].coolant_temp = ecu.coolant_temp;
-          freeze_frame[0].engine_rpm = ecu.engine_rpm;
-          freeze_frame[0].throttle_position = ecu.throttle_position;
-          freeze_frame[0].vehicle_speed = ecu.vehicle_speed;
-          freeze_frame[0].maf_airflow = ecu.maf_airflow;
-          freeze_frame[0].o2_voltage = ecu.o2_voltage;
-          freeze_frame[0].data_stored = true;
-          freeze_frame[0].dtc_code = 0x0100;  // P0100
-
-          freeze_frame[1].coolant_temp = ecu.coolant_temp;
-          freeze_frame[1].engine_rpm = ecu.engine_rpm;
-          freeze_frame[1].throttle_position = ecu.throttle_position;
-          freeze_frame[1].vehicle_speed = ecu.vehicle_speed;
-          freeze_frame[1].maf_airflow = ecu.maf_airflow;
-          freeze_frame[1].o2_voltage = ecu.o2_voltage;
-          freeze_frame[1].data_stored = true;
-          freeze_frame[1].dtc_code = 0x0200;  // P0200
-
-      }else 
-      {
-          ecu.dtc = 0;
-          digitalWrite(LED_red, LOW);
-      }
+      set_dtc(ecu.dtc == 0);
     }
   }
 }
 
+/*
+ * Set or clear the emissions DTCs (SW1, or the host link)
+ */
+void ecu_simClass::set_dtc(bool on)
+{
+  if(on == (ecu.dtc != 0)) {
+      return;
+  }
+
+  if(on)
+  {
+      ecu.dtc = 1;
+      digitalWrite(LED_red, HIGH);
+
+      // Capture freeze frame data when DTC is triggered
+      // One snapshot per DTC, taken from the live simulation state
+      freeze_frame_capture(0x0100);  // P0100
+      freeze_frame_capture(0x0200);  // P0200
+      nv_mark_dirty(true);
+
+  }else 
+  {
+      ecu.dtc = 0;
+      digitalWrite(LED_red, LOW);
+      nv_mark_dirty(true);
+  }
+}
+
 
-uint8_t ecu_simClass::update(void)
+FASTRUN uint8_t ecu_simClass::update(void)
 {
+  can_frame_t frame;
+  uint8_t work = 0;
+
+  // Responses whose deadline has come (also sent from the timer interrupt)
+  resp_timing_run();
+
+  // Host commands apply here, between CAN frames
+  host_link_update();
+  slcan_update();
+  capture_update();
+
+  // Advance the driving simulation, run enabled emissions monitors,
+  // any Mode 08 test in progress and the IUMPR drive cycle tracking
+  sim_state_update();
+  monitors_update();
+  onboard_test_update();
+  iumpr_update();
+
+#if SIM_SERVICES & (SIM_SVC_MODE01 | SIM_SVC_UDS)
+  // Re-encode the Mode 01 PIDs if the state changed (mode_01.cpp)
+  mode01_cache_refresh();
+#endif
+
+#if SIM_SERVICES & SIM_SVC_UDS
+  // UDS session S3 timeout
+  uds_session_update();
+#endif
+
+  // Save diagnostic state once changes have settled, a chunk per pass
+  if(nv_save_due()) {
+      nv_save_state();
+  }
+  nv_update();
+
+  // Background traffic follows bit rate changes; latency report
+  bus_load_update();
+
+  // Serve every enabled bus; each has its own ISO-TP sessions
+  for(uint8_t i = 0; i < CAN_BUS_COUNT; i++) {
+      if(!can_bus_config[i].enabled) continue;
+      channel = &can_channels[i];
+
+      // Not served while its bit rate is being detected
+      if(!can_baud_update(&channel->link, channel->transport)) continue;
+
+      // Process any ongoing ISO-TP transfers
+      isotp_process_transfers();
+
+      // Consecutive frames without separation time go out every pass
+      if(channel->isotp_tx.state == ISOTP_SENDING_CF && channel->isotp_tx.st_min == 0) {
+          work++;
+      }
+
+      // Drain the controller so a loaded bus doesn't overrun its mailboxes
+      for(uint8_t n = 0; n < CAN_RX_BURST && channel->transport->read(frame); n++) {
+          receive(frame);
+          work++;
+      }
+
+      // Frames a PC tool sent through the SLCAN gateway
+      if(i == SLCAN_BUS && slcan_take(frame)) {
+          receive(frame);
+          work++;
+      }
+  }
+  return work;
+}
+
+/*
+ * Handle one frame received on the current channel
+ */
+FASTRUN void ecu_simClass::receive(can_frame_t& frame)
+{
+  WCET_PROBE(WCET_RECEIVE);
   CAN_message_t can_MsgRx,can_MsgTx;
+  isotp_receive_t& isotp_rx = channel->isotp_rx;
+
+     // Handlers work on the classic 8-byte view of the frame, with 29-bit
+     // request IDs mapped to their 11-bit equivalents
+     can_MsgRx.id = frame.id;
+     if(frame.extended) {
+         can_MsgRx.id = request_id_11bit(frame.id);
+         if(can_MsgRx.id == 0) return;  // Not an OBD request
+     }
+     request_extended = frame.extended;
+     can_MsgRx.len = min(frame.len, (uint8_t)CAN_MAX_LEN);
+     memcpy(can_MsgRx.buf, frame.buf, CAN_MAX_LEN);
 
-  // Process any ongoing ISO-TP transfers
-  isotp_process_transfers();
+     // Other nodes' traffic on a shared bus: nothing to answer or log
+     if (can_MsgRx.id != PID_REQUEST && (can_MsgRx.id < 0x7E0 || can_MsgRx.id > 0x7E7)) {
+         return;
+     }
 
-  if(can1.readMB(can_MsgRx))
-  {
-     Serial.print(can_MsgRx.id,HEX);Serial.print(" len:");
-     Serial.print(can_MsgRx.len);Serial.print(" ");
-     Serial.print(can_MsgRx.buf[0]);Serial.print(" ");
-     Serial.print(can_MsgRx.buf[1]);Serial.print(" ");
-     Serial.print(can_MsgRx.buf[2]);Serial.print(" ");
-     Serial.print(can_MsgRx.buf[3]);Serial.print(" ");
-     Serial.print(can_MsgRx.buf[4]);Serial.print(" ");
-     Serial.print(can_MsgRx.buf[5]);Serial.print(" ");
-     Serial.print(can_MsgRx.buf[6]);Serial.print(" ");
-     Serial.print(can_MsgRx.buf[7]);Serial.println(" ");
+     if(!host_link_active()) {  // Text log only while the binary link is unused
+         Serial.print(can_MsgRx.id,HEX);Serial.print(" len:");
+         Serial.print(can_MsgRx.len);Serial.print(" ");
+         Serial.print(can_MsgRx.buf[0]);Serial.print(" ");
+         Serial.print(can_MsgRx.buf[1]);Serial.print(" ");
+         Serial.print(can_MsgRx.buf[2]);Serial.print(" ");
+         Serial.print(can_MsgRx.buf[3]);Serial.print(" ");
+         Serial.print(can_MsgRx.buf[4]);Serial.print(" ");
+         Serial.print(can_MsgRx.buf[5]);Serial.print(" ");
+         Serial.print(can_MsgRx.buf[6]);Serial.print(" ");
+         Serial.print(can_MsgRx.buf[7]);Serial.println(" ");
+     }
      
      // Handle ISO-TP Flow Control frames from tester
      // Tester sends flow control on 0x7E0 (ECM), 0x7E1 (TCM), 0x7E3 (FPCM)
      if ((can_MsgRx.id >= 0x7E0 && can_MsgRx.id <= 0x7E7) &&
          (can_MsgRx.buf[0] & 0xF0) == ISO_TP_FLOW_CONTROL) {
          // Flow control received - pass to ISO-TP handler
-         isotp_handle_flow_control(can_MsgRx.buf);
-         return 0;  // Flow control processed
+         isotp_handle_flow_control(frame.buf);
+         return;  // Flow control processed
      }
 
-     // Handle broadcast (0x7DF) and all ECU-specific requests
+     // Handle broadcast (0x7DF) and requests to the ECUs present on this bus
      // Supports 3 ECUs: ECM (0x7E0), TCM (0x7E1), FPCM (0x7E3)
      if (can_MsgRx.id == PID_REQUEST ||
-         can_MsgRx.id == PID_REQUEST_ENGINE ||
-         can_MsgRx.id == PID_REQUEST_TRANS ||
-         can_MsgRx.id == 0x7E3)  // FPCM request
+         (ecu_for_id(can_MsgRx.id) & can_bus_config[channel->bus].ecu_mask))
      {
        digitalWrite(LED_green, HIGH);
-       flash_led_tick = 0;
+       sched_after(led_flash_task, LED_FLASH_MS);
+
+       // Determine which ECU answers flow control based on request ID
+       uint16_t response_id = PID_REPLY_ENGINE;  // Default to ECM
+       if (can_MsgRx.id == PID_REQUEST_TRANS) {
+           response_id = PID_REPLY_TRANS;  // TCM
+       } else if (can_MsgRx.id == PID_REQUEST_CHASSIS) {
+           response_id = PID_REPLY_CHASSIS;  // FPCM
+       }
 
        // Check if this is an ISO-TP First Frame from tester (for receiving multi-frame requests)
        if ((can_MsgRx.buf[0] & 0xF0) == ISO_TP_FIRST_FRAME) {
-           // Multi-frame request from tester - send flow control
-           // Determine which ECU should respond based on request ID
-           uint16_t response_id = PID_REPLY_ENGINE;  // Default to ECM
-           if (can_MsgRx.id == PID_REQUEST_TRANS) {
-               response_id = PID_REPLY_TRANS;  // TCM
-           } else if (can_MsgRx.id == 0x7E3) {
-               response_id = PID_REPLY_CHASSIS;  // FPCM
-           }
-
-           CAN_message_t flowControl;
-           flowControl.id = response_id;
-           flowControl.len = 8;
-           flowControl.buf[0] = ISO_TP_FLOW_CONTROL | FC_CONTINUE;  // 0x30 - Continue to send
-           flowControl.buf[1] = ISO_TP_BS;        // Block size (0 = send all)
-           flowControl.buf[2] = ISO_TP_STMIN;     // Separation time (10ms)
-           for(int i = 3; i < 8; i++) flowControl.buf[i] = 0x00;  // Padding
-           can1.write(flowControl);
-
-           // For now, we don't process multi-frame requests from tester
-           // This would be needed for Mode 0x2E (DynamicallyDefineDataIdentifier) etc.
-           return 0;
+           // Multi-frame request from tester - start reassembly, send flow control
+           isotp_receive_first_frame(frame, response_id);
+           return;
        }
 
        // Check if this is a Consecutive Frame from tester
        if ((can_MsgRx.buf[0] & 0xF0) == ISO_TP_CONSEC_FRAME) {
-           // We're receiving consecutive frames from tester
-           // For now, just acknowledge and ignore
-           return 0;
+           if (!isotp_receive_consecutive_frame(frame)) {
+               return;  // More frames to come (or not receiving)
+           }
+
+           // Request complete - handlers see the first 7 bytes in buf as
+           // for a single frame; the full payload is in request_data
+           can_MsgRx.buf[0] = min(isotp_rx.total_len, (uint16_t)7);
+           memcpy(&can_MsgRx.buf[1], isotp_rx.data, 7);
+           request_data = isotp_rx.data;
+           request_len = isotp_rx.total_len;
+       } else if (frame.len > CAN_MAX_LEN && frame.buf[0] == ISO_TP_SINGLE_FRAME) {
+           // CAN FD single frame: escape byte, length in the second byte
+           request_data = &frame.buf[2];
+           request_len = min(frame.buf[1], (uint8_t)(frame.len - 2));
+           can_MsgRx.buf[0] = min(request_len, (uint16_t)7);
+           memcpy(&can_MsgRx.buf[1], &frame.buf[2], 7);
+       } else {
+           // Single frame request
+           request_data = &can_MsgRx.buf[1];
+           request_len = can_MsgRx.buf[0] & 0x0F;
        }
+       request_fd = frame.fd;
+       request_us = frame.time_us;
+       request_id = can_MsgRx.id;
 
         // Dispatch to registered mode handlers
+        bus_load_request_received(request_us);
         ModeRegistry::dispatch(can_MsgRx, can_MsgTx, this);
 
        }
-    }
-   return 0;
 }
      
-freeze_frame_t freeze_frame[2];  // Global freeze frame storage
-isotp_transfer_t isotp_tx;        // Global ISO-TP transmit context
-pending_transfer_t pending_transfers[MAX_PENDING_TRANSFERS];  // Queue for multi-ECU responses
-uint8_t pending_transfer_count = 0;
+freeze_frame_t freeze_frame[MAX_FREEZE_FRAMES];  // Global freeze frame ring
+DMAMEM can_channel_t can_channels[CAN_BUS_COUNT];  // Per-bus ISO-TP contexts and buffers
 ecu_simClass ecu_sim;
 
+// Bus Access
+
+// Frames to an ECU that is not on the request's bus are dropped, so a
+// functional request only gets answers from the ECUs present there
+bool ecu_simClass::serves(uint32_t can_id) {
+    uint8_t ecu = ecu_for_id(can_id);
+    return ecu == 0 || (ecu & can_bus_config[channel->bus].ecu_mask);
+}
+
+FASTRUN void ecu_simClass::send(const CAN_message_t& msg) {
+    if(!serves(msg.id)) {
+        return;
+    }
+    can_frame_t frame;
+    frame.id = response_id_on_bus(msg.id, request_extended);
+    frame.extended = request_extended;
+    frame.fd = request_fd && channel->transport->fd_capable();
+    frame.len = msg.len;
+    memcpy(frame.buf, msg.buf, CAN_MAX_LEN);
+
+    send_first_frame(frame, msg.id, FAULT_FRAME_SF, request_data[0], request_us);
+}
+
+/*
+ * Negative response from the addressed ECU (the engine ECU for functional
+ * requests). "Not supported" NRCs follow nrc_policy; see ecu_sim.h.
+ */
+void ecu_simClass::send_negative_response(uint8_t service, uint8_t nrc) {
+    bool functional = (request_id == PID_REQUEST);
+
+    if(nrc == NRC_SERVICE_NOT_SUPPORTED || nrc == NRC_SUBFUNCTION_NOT_SUPPORTED ||
+       nrc == NRC_REQUEST_OUT_OF_RANGE) {
+        if(nrc_policy == NRC_POLICY_SILENT) return;
+        if(nrc_policy == NRC_POLICY_ISO && functional) return;
+    }
+
+    const ecu_address_t* entry = functional ? NULL : ecu_address(request_id, false);
+    CAN_message_t msg;
+    msg.id = entry ? entry->response_id : PID_REPLY_ENGINE;
+    msg.len = 8;
+    msg.buf[0] = 0x03;                     // Length: 3 bytes
+    msg.buf[1] = UDS_NEGATIVE_RESPONSE;    // 0x7F
+    msg.buf[2] = service;                  // Echo requested service
+    msg.buf[3] = nrc;
+    memset(&msg.buf[4], 0, 4);             // Padding
+    capture_event(CAPTURE_TRIG_NRC);
+    send(msg);
+}
+
+/*
+ * Hand the first frame of a response to the response timing queue, unless
+ * a fault rule drops it or puts responsePending frames ahead of it.
+ * Returns the clock_us() time the frame is due on the bus.
+ */
+FASTRUN uint32_t ecu_simClass::send_first_frame(const can_frame_t& frame, uint16_t response_id, uint8_t kind,
+                                        uint8_t service, uint32_t request_us) {
+    uint8_t ecu = ecu_for_id(response_id);
+    const fault_rule_t* fault = fault_match(kind, ecu, service);
+
+    if(fault && fault->action == FAULT_DROP) {
+        return clock_us();
+    }
+    if(fault && fault->action == FAULT_PENDING) {
+        can_frame_t pending = frame;
+        memset(pending.buf, 0, sizeof(pending.buf));
+        pending.len = CAN_MAX_LEN;
+        pending.buf[0] = 0x03;
+        pending.buf[1] = 0x7F;
+        pending.buf[2] = service;
+        pending.buf[3] = 0x78;  // requestCorrectlyReceived-ResponsePending
+
+        for(uint16_t i = 0; i < fault->param; i++) {
+            resp_timing_send_at(channel->transport, pending, ecu, request_us);
+            request_us += (uint32_t)fault->interval_ms * 1000;
+        }
+    }
+    return resp_timing_send(channel->transport, frame, ecu, request_us);
+}
+
+bool ecu_simClass::isotp_busy(void) {
+    return channel->isotp_tx.state != ISOTP_IDLE;
+}
+
+// Non-Volatile State
+
+FLASHMEM void ecu_simClass::nv_load_state(void) {
+    nv_image_t image;
+
+    if(!nv_init(&image)) {
+        return;  // Blank store - keep power-up defaults
+    }
+
+    ecu.dtc = image.dtc;
+    memcpy(freeze_frame, image.freeze_frame, sizeof(freeze_frame));
+    freeze_frame_head = image.freeze_frame_head % MAX_FREEZE_FRAMES;
+    freeze_frame_count = min(image.freeze_frame_count, (uint8_t)MAX_FREEZE_FRAMES);
+    sim_counters = image.counters;
+    memcpy(iumpr_counters, image.iumpr, sizeof(iumpr_counters));
+
+    digitalWrite(LED_red, ecu.dtc ? HIGH : LOW);
+}
+
+/*
+ * Snapshot the persistent state; the journal writes it out in chunks
+ * from later passes of the main loop.
+ */
+void ecu_simClass::nv_save_state(void) {
+    nv_image_t image;
+
+    memset(&image, 0, sizeof(image));
+    image.dtc = ecu.dtc;
+    image.freeze_frame_head = freeze_frame_head;
+    image.freeze_frame_count = freeze_frame_count;
+    memcpy(image.freeze_frame, freeze_frame, sizeof(freeze_frame));
+    image.counters = sim_counters;
+    memcpy(image.iumpr, iumpr_counters, sizeof(iumpr_counters));
+
+    nv_save(&image);
+}
+
+// Freeze Frame Ring Functions
+
+/*
+ * Capture a freeze frame for a DTC
+ * A DTC keeps the frame captured when it was first set; a new DTC takes the
+ * next ring slot, overwriting the oldest frame once the ring is full.
+ * The snapshot is a single struct copy of the live state, so this is cheap
+ * enough to call directly from fault detection.
+ */
+void ecu_simClass::freeze_frame_capture(uint16_t dtc_code) {
+    for(int i = 0; i < MAX_FREEZE_FRAMES; i++) {
+        if(freeze_frame[i].data_stored && freeze_frame[i].dtc_code == dtc_code) {
+            return;  // Already have a freeze frame for this DTC
+        }
+    }
+
+    freeze_frame_t* frame = &freeze_frame[freeze_frame_head];
+    frame->snapshot = sim_state;
+    frame->dtc_code = dtc_code;
+    frame->data_stored = true;
+
+    freeze_frame_head = (freeze_frame_head + 1) % MAX_FREEZE_FRAMES;
+    if(freeze_frame_count < MAX_FREEZE_FRAMES) freeze_frame_count++;
+}
+
+/*
+ * Look up a freeze frame by Mode 02 frame number
+ * Frame 0 is the oldest stored frame. Returns NULL if no such frame.
+ */
+freeze_frame_t* ecu_simClass::freeze_frame_get(uint8_t frame_num) {
+    if(frame_num >= freeze_frame_count) {
+        return NULL;
+    }
+    uint8_t slot = (freeze_frame_head + MAX_FREEZE_FRAMES - freeze_frame_count + frame_num) % MAX_FREEZE_FRAMES;
+    return &freeze_frame[slot];
+}
+
+void ecu_simClass::freeze_frame_clear(void) {
+    for(int i = 0; i < MAX_FREEZE_FRAMES; i++) {
+        freeze_frame[i].data_stored = false;
+    }
+    freeze_frame_head = 0;
+    freeze_frame_count = 0;
+}
+
 // ISO-TP Implementation Functions
-void ecu_simClass::isotp_init_transfer(uint8_t* data, uint16_t len, uint16_t can_id, uint8_t mode, uint8_t pid) {
+void ecu_simClass::isotp_init_transfer(const uint8_t* data, uint16_t len, uint16_t can_id, uint8_t mode, uint8_t pid) {
+    isotp_transfer_t& isotp_tx = channel->isotp_tx;
+
     isotp_tx.state = ISOTP_IDLE;
     isotp_tx.total_len = len;
     isotp_tx.offset = 0;
@@ -199,33 +605,78 @@ void ecu_simClass::isotp_init_transfer(uint8_t* data, uint16_t len, uint16_t can
     isotp_tx.response_id = can_id;
     isotp_tx.mode = mode;
     isotp_tx.pid = pid;
+    isotp_tx.fd = request_fd;  // Answer in the frame format of the request
+    isotp_tx.extended = request_extended;
+    isotp_tx.request_us = request_us;
+    isotp_tx.fault_hold_ms = 0;
     memcpy(isotp_tx.data, data, len);
 }
 
-void ecu_simClass::isotp_send_first_frame(void) {
-    CAN_message_t msg;
-    msg.id = isotp_tx.response_id;
-    msg.len = 8;
-    msg.buf[0] = 0x10 | ((isotp_tx.total_len >> 8) & 0x0F);  // First frame with length high nibble
-    msg.buf[1] = isotp_tx.total_len & 0xFF;                  // Length low byte
+/*
+ * Send the start of a message
+ * Classic CAN: First Frame with 6 data bytes.
+ * CAN FD: messages up to 62 bytes go out whole as an escaped Single Frame;
+ * longer ones start with a 64-byte First Frame carrying 62 data bytes.
+ * Messages are at most 256 bytes, so the 32-bit FF_DL escape is only
+ * needed on the receive side.
+ */
+FASTRUN void ecu_simClass::isotp_send_first_frame(void) {
+    isotp_transfer_t& isotp_tx = channel->isotp_tx;
+
+    if(!serves(isotp_tx.response_id)) {
+        isotp_tx.state = ISOTP_IDLE;  // ECU not on this bus
+        return;
+    }
 
-    // Copy first 6 bytes of data
-    for(int i = 0; i < 6 && i < isotp_tx.total_len; i++) {
-        msg.buf[i+2] = isotp_tx.data[i];
+    can_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.id = response_id_on_bus(isotp_tx.response_id, isotp_tx.extended);
+    frame.extended = isotp_tx.extended;
+    frame.fd = isotp_tx.fd;
+
+    if(isotp_tx.fd && isotp_tx.total_len <= ISO_TP_FD_SF_MAX) {
+        frame.buf[0] = ISO_TP_SINGLE_FRAME;   // Escape: length in next byte
+        frame.buf[1] = isotp_tx.total_len;
+        memcpy(&frame.buf[2], isotp_tx.data, isotp_tx.total_len);
+        frame.len = can_fd_frame_len(isotp_tx.total_len + 2);
+
+        isotp_tx.offset = isotp_tx.total_len;
+        isotp_tx.state = ISOTP_IDLE;  // No flow control for a single frame
+        send_first_frame(frame, isotp_tx.response_id, FAULT_FRAME_SF, isotp_tx.mode, isotp_tx.request_us);
+        return;
     }
 
-    isotp_tx.offset = 6;  // We've sent 6 bytes
+    uint8_t frame_len = isotp_tx.fd ? CAN_FD_MAX_LEN : CAN_MAX_LEN;
+    uint8_t first_len = min((uint16_t)(frame_len - 2), isotp_tx.total_len);
+
+    frame.len = frame_len;
+    frame.buf[0] = 0x10 | ((isotp_tx.total_len >> 8) & 0x0F);  // First frame with length high nibble
+    frame.buf[1] = isotp_tx.total_len & 0xFF;                  // Length low byte
+    memcpy(&frame.buf[2], isotp_tx.data, first_len);
+
+    isotp_tx.offset = first_len;
     isotp_tx.state = ISOTP_WAIT_FC;  // Wait for flow control
-    isotp_tx.fc_wait_start = millis();
 
-    can1.write(msg);
+    // N_Bs runs from the First Frame on the bus, which the response delay
+    // or a responsePending storm ahead of it can put seconds away
+    uint32_t due = send_first_frame(frame, isotp_tx.response_id, FAULT_FRAME_FF, isotp_tx.mode, isotp_tx.request_us);
+    int32_t wait_us = (int32_t)(due - clock_us());
+    isotp_tx.fc_wait_start = clock_ms() + (wait_us > 0 ? wait_us / 1000 : 0);
 }
 
-void ecu_simClass::isotp_handle_flow_control(uint8_t* data) {
+FASTRUN void ecu_simClass::isotp_handle_flow_control(uint8_t* data) {
+    WCET_PROBE(WCET_ISOTP_RX);
+    isotp_transfer_t& isotp_tx = channel->isotp_tx;
+
     if(isotp_tx.state != ISOTP_WAIT_FC && isotp_tx.state != ISOTP_WAIT_NEXT_FC) {
         return;  // Not waiting for flow control
     }
 
+    const fault_rule_t* fault = fault_match(FAULT_FRAME_FC_RX, ecu_for_id(isotp_tx.response_id), isotp_tx.mode);
+    if(fault && fault->action == FAULT_IGNORE_FC) {
+        return;  // Left to time out
+    }
+
     uint8_t fs = data[0] & 0x0F;  // Flow Status
 
     if(fs == 0) {  // Continue to send
@@ -233,21 +684,26 @@ void ecu_simClass::isotp_handle_flow_control(uint8_t* data) {
         isotp_tx.st_min = data[2];      // Minimum separation time
         isotp_tx.blocks_sent = 0;
         isotp_tx.state = ISOTP_SENDING_CF;
-        isotp_tx.last_frame_time = millis();
+        isotp_tx.last_frame_time = clock_ms();
     } else if(fs == 1) {  // Wait
         isotp_tx.state = ISOTP_WAIT_FC;  // Keep waiting
     } else if(fs == 2) {  // Overflow/Abort
-        isotp_tx.state = ISOTP_ERROR;
+        capture_event(CAPTURE_TRIG_ISOTP_ABORT);
+        // Drop the transfer so the next response (or a queued one) can go;
+        // isotp_busy() would otherwise stay true for good
+        isotp_tx.state = ISOTP_IDLE;
     }
 }
 
-void ecu_simClass::isotp_send_consecutive_frame(void) {
+FASTRUN void ecu_simClass::isotp_send_consecutive_frame(void) {
+    isotp_transfer_t& isotp_tx = channel->isotp_tx;
+
     if(isotp_tx.state != ISOTP_SENDING_CF || isotp_tx.offset >= isotp_tx.total_len) {
         return;
     }
 
     // Check timing requirement
-    uint32_t now = millis();
+    uint32_t now = clock_ms();
     uint32_t elapsed = now - isotp_tx.last_frame_time;
 
     // STmin handling: 0x00-0x7F = 0-127ms, 0xF1-0xF9 = 100-900us (we'll treat as 1-9ms)
@@ -255,32 +711,51 @@ void ecu_simClass::isotp_send_consecutive_frame(void) {
     if(isotp_tx.st_min >= 0xF1 && isotp_tx.st_min <= 0xF9) {
         required_delay = (isotp_tx.st_min - 0xF0);  // 1-9ms for simplicity
     }
+    if(isotp_tx.fault_hold_ms > 0) {
+        required_delay = isotp_tx.fault_hold_ms;  // Held by a DELAY_CF fault
+    }
 
     if(elapsed < required_delay) {
         return;  // Not time yet
     }
 
-    CAN_message_t msg;
-    msg.id = isotp_tx.response_id;
-    msg.len = 8;
-    msg.buf[0] = 0x20 | (isotp_tx.seq_num & 0x0F);  // Consecutive frame
-
-    // Copy up to 7 bytes of data
-    int bytes_to_copy = min(7, isotp_tx.total_len - isotp_tx.offset);
-    for(int i = 0; i < 7; i++) {
-        if(i < bytes_to_copy) {
-            msg.buf[i+1] = isotp_tx.data[isotp_tx.offset + i];
-        } else {
-            msg.buf[i+1] = 0x00;  // Padding
+    // One fault check per frame; a held frame goes out once its hold ends
+    const fault_rule_t* fault = NULL;
+    if(isotp_tx.fault_hold_ms > 0) {
+        isotp_tx.fault_hold_ms = 0;
+    } else {
+        fault = fault_match(FAULT_FRAME_CF, ecu_for_id(isotp_tx.response_id), isotp_tx.mode);
+        if(fault && fault->action == FAULT_DELAY_CF) {
+            isotp_tx.fault_hold_ms = fault->param ? fault->param : FAULT_CF_HOLD_MS;
+            isotp_tx.last_frame_time = now;
+            return;
         }
     }
 
+    can_frame_t frame;
+    memset(&frame, 0, sizeof(frame));  // Zero padding
+    frame.id = response_id_on_bus(isotp_tx.response_id, isotp_tx.extended);
+    frame.extended = isotp_tx.extended;
+    frame.fd = isotp_tx.fd;
+    frame.buf[0] = 0x20 | (isotp_tx.seq_num & 0x0F);  // Consecutive frame
+    if(fault && fault->action == FAULT_BAD_SEQ) {
+        frame.buf[0] = 0x20 | ((isotp_tx.seq_num + 1) & 0x0F);
+    }
+
+    // Copy up to 7 bytes of data (63 on CAN FD)
+    int frame_data = (isotp_tx.fd ? CAN_FD_MAX_LEN : CAN_MAX_LEN) - 1;
+    int bytes_to_copy = min(frame_data, isotp_tx.total_len - isotp_tx.offset);
+    memcpy(&frame.buf[1], &isotp_tx.data[isotp_tx.offset], bytes_to_copy);
+    frame.len = isotp_tx.fd ? can_fd_frame_len(bytes_to_copy + 1) : CAN_MAX_LEN;
+
     isotp_tx.offset += bytes_to_copy;
     isotp_tx.seq_num = (isotp_tx.seq_num + 1) & 0x0F;
     isotp_tx.blocks_sent++;
     isotp_tx.last_frame_time = now;
 
-    can1.write(msg);
+    if(!(fault && fault->action == FAULT_DROP)) {
+        channel->transport->write(frame);
+    }
 
     // Check if we've sent all data
     if(isotp_tx.offset >= isotp_tx.total_len) {
@@ -293,8 +768,99 @@ void ecu_simClass::isotp_send_consecutive_frame(void) {
     }
 }
 
+void ecu_simClass::isotp_send_flow_control(uint16_t can_id, uint8_t flow_status) {
+    isotp_receive_t& isotp_rx = channel->isotp_rx;
+
+    can_frame_t flowControl;
+    memset(&flowControl, 0, sizeof(flowControl));  // Zero padding
+    flowControl.id = response_id_on_bus(can_id, isotp_rx.extended);
+    flowControl.extended = isotp_rx.extended;
+    flowControl.fd = isotp_rx.fd;
+    flowControl.len = 8;
+    flowControl.buf[0] = ISO_TP_FLOW_CONTROL | flow_status;  // 0x30 - Continue to send
+    flowControl.buf[1] = ISO_TP_BS;        // Block size (0 = send all)
+    flowControl.buf[2] = ISO_TP_STMIN;     // Separation time (10ms)
+
+    uint8_t service = isotp_rx.active ? isotp_rx.data[0] : FAULT_ANY_SERVICE;
+    const fault_rule_t* fault = fault_match(FAULT_FRAME_FC, ecu_for_id(can_id), service);
+    if(fault && fault->action == FAULT_DROP) {
+        return;  // The tester's N_Bs runs out
+    }
+    channel->transport->write(flowControl);
+}
+
+// Start reassembly of a multi-frame request from the tester
+void ecu_simClass::isotp_receive_first_frame(can_frame_t& frame, uint16_t response_id) {
+    WCET_PROBE(WCET_ISOTP_RX);
+    isotp_receive_t& isotp_rx = channel->isotp_rx;
+
+    uint32_t len = ((frame.buf[0] & 0x0F) << 8) | frame.buf[1];
+    uint8_t header_len = 2;
+
+    if(len == 0) {
+        // CAN FD escape: 32-bit length for messages over 4095 bytes
+        len = ((uint32_t)frame.buf[2] << 24) | ((uint32_t)frame.buf[3] << 16) |
+              ((uint32_t)frame.buf[4] << 8) | frame.buf[5];
+        header_len = 6;
+    }
+
+    isotp_rx.fd = frame.fd;
+    isotp_rx.extended = frame.extended;
+    if(len > sizeof(isotp_rx.data) || frame.len <= header_len) {
+        isotp_rx.active = false;
+        isotp_send_flow_control(response_id, FC_OVERFLOW);  // Request too long
+        return;
+    }
+
+    uint8_t first_len = min((uint32_t)(frame.len - header_len), len);
+    isotp_rx.active = true;
+    isotp_rx.total_len = len;
+    isotp_rx.offset = first_len;
+    isotp_rx.seq_num = 1;
+    isotp_rx.request_id = frame.id;
+    isotp_rx.last_frame_time = clock_ms();
+    memcpy(isotp_rx.data, &frame.buf[header_len], first_len);
+
+    isotp_send_flow_control(response_id, FC_CONTINUE);
+}
+
+// Append a consecutive frame; returns true once the request is complete
+FASTRUN bool ecu_simClass::isotp_receive_consecutive_frame(can_frame_t& frame) {
+    WCET_PROBE(WCET_ISOTP_RX);
+    isotp_receive_t& isotp_rx = channel->isotp_rx;
+
+    if(!isotp_rx.active || frame.id != isotp_rx.request_id) {
+        return false;  // Not receiving from this tester
+    }
+
+    if((frame.buf[0] & 0x0F) != isotp_rx.seq_num) {
+        isotp_rx.active = false;  // Wrong sequence number - abort reception
+        return false;
+    }
+
+    // 7 data bytes per classic frame, up to 63 on CAN FD
+    uint16_t bytes_to_copy = min((uint16_t)(frame.len - 1), (uint16_t)(isotp_rx.total_len - isotp_rx.offset));
+    memcpy(&isotp_rx.data[isotp_rx.offset], &frame.buf[1], bytes_to_copy);
+    isotp_rx.offset += bytes_to_copy;
+    isotp_rx.seq_num = (isotp_rx.seq_num + 1) & 0x0F;
+    isotp_rx.last_frame_time = clock_ms();
+
+    if(isotp_rx.offset >= isotp_rx.total_len) {
+        isotp_rx.active = false;  // Reception complete
+        return true;
+    }
+    return false;
+}
+
 // Queue a transfer to be sent later (for multi-ECU responses)
-bool ecu_simClass::isotp_queue_transfer(uint8_t* data, uint16_t len, uint16_t can_id, uint8_t mode, uint8_t pid) {
+bool ecu_simClass::isotp_queue_transfer(const uint8_t* data, uint16_t len, uint16_t can_id, uint8_t mode, uint8_t pid) {
+    pending_transfer_t* pending_transfers = channel->pending_transfers;
+    uint8_t& pending_transfer_count = channel->pending_transfer_count;
+
+    if(!serves(can_id)) {
+        return true;  // ECU not on this bus - nothing to send
+    }
+
     // Find an empty slot in the queue
     for(int i = 0; i < MAX_PENDING_TRANSFERS; i++) {
         if(!pending_transfers[i].pending) {
@@ -304,6 +870,9 @@ bool ecu_simClass::isotp_queue_transfer(uint8_t* data, uint16_t len, uint16_t ca
             pending_transfers[i].can_id = can_id;
             pending_transfers[i].mode = mode;
             pending_transfers[i].pid = pid;
+            pending_transfers[i].fd = request_fd;
+            pending_transfers[i].extended = request_extended;
+            pending_transfers[i].request_us = request_us;
             pending_transfers[i].pending = true;
             pending_transfer_count++;
             return true;
@@ -312,11 +881,24 @@ bool ecu_simClass::isotp_queue_transfer(uint8_t* data, uint16_t len, uint16_t ca
     return false;  // Queue full
 }
 
-void ecu_simClass::isotp_process_transfers(void) {
+FASTRUN void ecu_simClass::isotp_process_transfers(void) {
+    WCET_PROBE(WCET_ISOTP_TX);
+    isotp_transfer_t& isotp_tx = channel->isotp_tx;
+    isotp_receive_t& isotp_rx = channel->isotp_rx;
+    pending_transfer_t* pending_transfers = channel->pending_transfers;
+    uint8_t& pending_transfer_count = channel->pending_transfer_count;
+
     // Timeout check for flow control
     if((isotp_tx.state == ISOTP_WAIT_FC || isotp_tx.state == ISOTP_WAIT_NEXT_FC) &&
-       (millis() - isotp_tx.fc_wait_start) > 1000) {  // 1 second timeout
+       (int32_t)(clock_ms() - isotp_tx.fc_wait_start) > 1000) {  // 1 second timeout, start may be ahead
         isotp_tx.state = ISOTP_IDLE;  // Abort transfer
+        capture_event(CAPTURE_TRIG_FC_TIMEOUT);
+    }
+
+    // Timeout check for consecutive frames of a request from the tester (N_Cr)
+    if(isotp_rx.active && (clock_ms() - isotp_rx.last_frame_time) > 1000) {
+        isotp_rx.active = false;  // Abort reception
+        capture_event(CAPTURE_TRIG_ISOTP_ABORT);
     }
 
     // Continue sending consecutive frames if in progress
@@ -335,6 +917,9 @@ void ecu_simClass::isotp_process_transfers(void) {
                                   pending_transfers[i].can_id,
                                   pending_transfers[i].mode,
                                   pending_transfers[i].pid);
+                isotp_tx.fd = pending_transfers[i].fd;
+                isotp_tx.extended = pending_transfers[i].extended;
+                isotp_tx.request_us = pending_transfers[i].request_us;
                 isotp_send_first_frame();
 
                 // Mark this transfer as started
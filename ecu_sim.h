@@ -2,6 +2,10 @@
 #define ecu_sim__h
 
 #include <Arduino.h>
+#include "sim_state.h"
+#include "can_transport.h"
+#include "can_baud.h"
+#include "vehicle_config.h"
 
 /*
  * OBD-II ECU Simulator - Emissions Program Implementation
@@ -27,7 +31,7 @@
  * Mode 02 (0x02) - Request Freeze Frame Data
  *   STATUS: IMPLEMENTED
  *   PURPOSE: Access emissions data stored when related DTC was set.
- *   NOTE: Captures snapshot of conditions when fault occurred.
+ *   NOTE: Captures full Mode 01 snapshot when fault occurred (ring of 4).
  *
  * Mode 03 (0x03) - Request Emissions-Related DTCs
  *   STATUS: IMPLEMENTED
@@ -45,9 +49,9 @@
  *   NOTE: Not available on CAN-based vehicles (2008+).
  *
  * Mode 06 (0x06) - On-Board Monitoring Test Results
- *   STATUS: NOT IMPLEMENTED
+ *   STATUS: IMPLEMENTED
  *   PURPOSE: Test results for continuously/non-continuously monitored systems.
- *   NOTE: Data format is manufacturer-specific.
+ *   NOTE: Results from simulated monitors (monitors.cpp), which also drive readiness.
  *
  * Mode 07 (0x07) - Pending DTCs (Current Drive Cycle)
  *   STATUS: NOT IMPLEMENTED
@@ -55,9 +59,9 @@
  *   NOTE: Shows "pending" codes before they mature.
  *
  * Mode 08 (0x08) - Bidirectional Control
- *   STATUS: NOT IMPLEMENTED
+ *   STATUS: IMPLEMENTED (EVAP leak test)
  *   PURPOSE: Control on-board systems for testing (mainly EVAP).
- *   NOTE: Limited implementation in real vehicles.
+ *   NOTE: Test runs in the background (onboard_test.cpp); testers poll status.
  *
  * Mode 09 (0x09) - Request Vehicle Information
  *   STATUS: FULLY IMPLEMENTED
@@ -74,6 +78,8 @@
 #define MODE2               0x02        // Freeze frame (emissions data when DTC set)
 #define MODE3               0x03        // Emissions-related DTCs ("P" codes)
 #define MODE4               0x04        // Clear emissions diagnostic information
+#define MODE6               0x06        // On-board monitoring test results
+#define MODE8               0x08        // Control of on-board system/test
 #define MODE9               0x09        // Vehicle information (VIN, calibrations)
 
 /*
@@ -82,6 +88,7 @@
  */
 #define PID_SUPPORTED       0x00        // Bit-encoded PIDs supported [01-20]
 #define MONITOR_STATUS      0x01        // Emissions monitor status since DTCs cleared
+#define FREEZE_FRAME_DTC    0x02        // Mode 02 only: DTC that caused freeze frame
 #define FUEL_SYSTEM_STATUS  0x03        // Fuel system status (open/closed loop)
 #define CALCULATED_LOAD     0x04        // Engine load value for emissions calculations
 #define ENGINE_COOLANT_TEMP 0x05        // Coolant temp affects emissions control
@@ -131,6 +138,8 @@
 #define ACCEL_POS_D        0x49
 #define ACCEL_POS_E        0x4A
 #define COMMANDED_THROTTLE 0x4C
+#define TIME_WITH_MIL      0x4D
+#define TIME_SINCE_CLR     0x4E
 #define FUEL_TYPE          0x51
 #define SHORT_O2_TRIM_B1   0x56
 #define SHORT_O2_TRIM_B2   0x58
@@ -139,6 +148,8 @@
 #define MODE2_RESPONSE      0x42
 #define MODE3_RESPONSE      0x43
 #define MODE4_RESPONSE      0x44
+#define MODE6_RESPONSE      0x46
+#define MODE8_RESPONSE      0x48
 #define MODE9_RESPONSE      0x49
 
 /*
@@ -163,18 +174,54 @@
 #define PID_REQUEST         0x7DF       // Functional broadcast request
 #define PID_REQUEST_ENGINE  0x7E0       // Physical request to Engine ECU
 #define PID_REQUEST_TRANS   0x7E1       // Physical request to Transmission ECU
+#define PID_REQUEST_CHASSIS 0x7E3       // Physical request to Fuel Pump Control Module
 #define PID_REPLY_ENGINE    0x7E8       // Engine/Powertrain ECU response
 #define PID_REPLY_TRANS     0x7E9       // Transmission ECU response
 #define PID_REPLY_HYBRID    0x7EA       // Hybrid/Electric ECU response
 #define PID_REPLY_CHASSIS   0x7EB       // Chassis/Body ECU response
 #define PID_REPLY           PID_REPLY_ENGINE  // Default reply ID (engine)
 
+/*
+ * 29-bit CAN IDs (ISO 15765-4 normal fixed addressing)
+ * - 0x18DB33F1: Functional request (TA 0x33 = all OBD ECUs, SA 0xF1 = tester)
+ * - 0x18DA<TA>F1: Physical request to the ECU with address TA
+ * - 0x18DAF1<SA>: Response from the ECU with address SA
+ * Received 29-bit requests are mapped to their 11-bit equivalents before
+ * dispatch, and replies are mapped back when sent, so mode handlers and
+ * the ISO-TP engine only deal with the 11-bit IDs above.
+ */
+#define PID_REQUEST_EXT     0x18DB33F1  // Functional broadcast request
+#define ISO15765_PHYS_EXT   0x18DA0000  // Physical addressing, TA in bits 8-15, SA in 0-7
+#define ISO15765_TESTER     0xF1        // External test equipment address
+#define ECU_ADDR_ENGINE     0x10        // Engine ECU node address
+#define ECU_ADDR_TRANS      0x18        // Transmission ECU node address
+#define ECU_ADDR_CHASSIS    0x1A        // Fuel pump control module node address
+
+/*
+ * Negative Response Policy
+ *
+ * How an ECU answers a request for a service or PID it does not support
+ * (NRC 0x11 serviceNotSupported, 0x12 subFunctionNotSupported, 0x31
+ * requestOutOfRange). ISO 15765-4 has ECUs answer physical requests with
+ * the NRC and stay silent on functional ones, where every ECU would
+ * otherwise answer. Other NRCs (0x78 responsePending, 0x22 ...) are
+ * always sent.
+ */
+#define NRC_POLICY_ISO      0           // NRC on physical requests, silent on functional
+#define NRC_POLICY_SILENT   1           // Never answer: the tester waits out P2
+#define NRC_POLICY_ALWAYS   2           // NRC on functional requests too (non-compliant ECU)
+
 // ISO-TP (ISO 15765-2) Protocol Control Information
 #define ISO_TP_SINGLE_FRAME    0x00     // Single frame (0-7 data bytes)
 #define ISO_TP_FIRST_FRAME     0x10     // First frame of multi-frame
 #define ISO_TP_CONSEC_FRAME    0x20     // Consecutive frame
 #define ISO_TP_FLOW_CONTROL    0x30     // Flow control frame
 
+// CAN FD (ISO 15765-2:2016) escape formats
+// Single frame: 00 [SF_DL] data... (frames longer than 8 bytes)
+// First frame:  10 00 [FF_DL 32-bit] data... (messages over 4095 bytes)
+#define ISO_TP_FD_SF_MAX       62       // Data bytes in a 64-byte single frame
+
 // Flow Control parameters
 #define FC_CONTINUE         0x00        // Continue to send
 #define FC_WAIT             0x01        // Wait for next flow control
@@ -185,6 +232,7 @@
 
 static const int LED_red = 9;
 static const int LED_green = 8;
+#define LED_FLASH_MS        50          // Green LED on time per request
 
 
 static const int SW1 = 6;
@@ -223,12 +271,33 @@ typedef struct {
     uint8_t blocks_sent;          // Frames sent in current block
     uint8_t st_min;               // Minimum separation time (ms)
     uint32_t last_frame_time;     // Timestamp of last frame sent
-    uint32_t fc_wait_start;       // When we started waiting for FC
-    uint16_t response_id;         // CAN ID to use for responses
+    uint32_t fc_wait_start;       // N_Bs start: First Frame due time, or last block sent
+    uint16_t response_id;         // CAN ID to use for responses (11-bit form)
     uint8_t mode;                 // OBD mode being serviced
     uint8_t pid;                  // PID being serviced
+    bool fd;                      // CAN FD framing (request arrived as FD)
+    bool extended;                // 29-bit IDs (request arrived with a 29-bit ID)
+    uint32_t request_us;          // Receive time of the request, for the response delay
+    uint16_t fault_hold_ms;       // Consecutive frame held by fault injection
 } isotp_transfer_t;
 
+/*
+ * ISO-TP Receive Context
+ * Reassembles multi-frame requests from the tester (e.g. UDS ReadDataByIdentifier
+ * with many DIDs)
+ */
+typedef struct {
+    bool active;                  // Reception in progress
+    uint8_t data[128];            // Reassembled request (service byte first)
+    uint16_t total_len;           // Length announced in First Frame
+    uint16_t offset;              // Bytes received so far
+    uint8_t seq_num;              // Expected consecutive frame sequence number
+    uint32_t last_frame_time;     // For N_Cr timeout
+    uint32_t request_id;          // CAN ID the request arrives on (as on the bus)
+    bool fd;                      // Request is sent in CAN FD frames
+    bool extended;                // Request uses 29-bit IDs
+} isotp_receive_t;
+
 /*
  * ECU Data Structure
  * Holds current emissions-related sensor values
@@ -247,21 +316,21 @@ typedef struct{
  * Freeze Frame Structure (Mode 02)
  * Captures emissions data snapshot when DTC is triggered
  * Required by OBD-II to help diagnose intermittent faults
+ *
+ * The snapshot is a complete copy of the simulation state, so Mode 02
+ * can report every PID Mode 01 supports for the moment the DTC was set.
  */
 typedef struct{
-        unsigned char coolant_temp;      // Engine temp when fault occurred
-        unsigned int engine_rpm;          // RPM at time of fault
-        unsigned char throttle_position;  // Throttle position during fault
-        unsigned char vehicle_speed;      // Speed when emissions fault detected
-        unsigned int maf_airflow;         // Airflow reading at fault time
-        unsigned int o2_voltage;          // O2 voltage when DTC set
+        sim_state_t snapshot;             // Full Mode 01 state at time of fault
+        uint16_t dtc_code;                // Emissions DTC that triggered capture
         bool data_stored;                 // Flag: freeze frame contains valid data
-        unsigned int dtc_code;            // Emissions DTC that triggered capture
 }freeze_frame_t;
 
+// Freeze frame ring, one entry per DTC; oldest entry is overwritten when full
+#define MAX_FREEZE_FRAMES 4
+
 extern ecu_t ecu;
-extern freeze_frame_t freeze_frame[2];  // Support 2 freeze frames
-extern isotp_transfer_t isotp_tx;        // ISO-TP transmit context
+extern freeze_frame_t freeze_frame[MAX_FREEZE_FRAMES];
 
 // Queue for pending multi-ECU responses
 #define MAX_PENDING_TRANSFERS 3
@@ -271,11 +340,48 @@ typedef struct {
     uint16_t can_id;
     uint8_t mode;
     uint8_t pid;
+    bool fd;
+    bool extended;
+    uint32_t request_us;
     bool pending;
 } pending_transfer_t;
 
-extern pending_transfer_t pending_transfers[MAX_PENDING_TRANSFERS];
-extern uint8_t pending_transfer_count;
+/*
+ * CAN Bus Channels
+ * Every controller is served from the same main loop at its own bit rate,
+ * with its own set of simulated ECUs and its own ISO-TP sessions, so
+ * testers on different buses can run multi-frame transfers at once.
+ */
+#define ECU_ECM             0x01        // Engine (0x7E0 / 0x7E8)
+#define ECU_TCM             0x02        // Transmission (0x7E1 / 0x7E9)
+#define ECU_FPCM            0x04        // Fuel pump control (0x7E3 / 0x7EB)
+#define ECU_ALL             (ECU_ECM | ECU_TCM | ECU_FPCM)
+#define ECU_J1939           0x08        // J1939 engine broadcasts (j1939.h), not in ECU_ALL
+#define ECU_TRAFFIC         0x10        // Background vehicle traffic (bus_load.h), not in ECU_ALL
+
+#define CAN_RX_BURST        8           // Frames read per bus per main loop pass
+
+typedef struct {
+    bool enabled;                 // Served from the main loop
+    uint32_t baud;                // Bit rate (arbitration rate for CAN FD), CAN_BAUD_AUTO
+                                  // to detect; CAN1 uses the init() argument instead
+    uint8_t ecu_mask;             // ECUs present on this bus
+} can_bus_config_t;
+
+typedef struct {
+    uint8_t bus;                  // Index into can_bus_config / can_transports
+    CanTransport* transport;      // Controller
+    can_baud_t link;              // Bit rate, detection and runtime switching
+    isotp_transfer_t isotp_tx;    // ISO-TP transmit context
+    isotp_receive_t isotp_rx;     // ISO-TP receive context
+    pending_transfer_t pending_transfers[MAX_PENDING_TRANSFERS];  // Queue for multi-ECU responses
+    uint8_t pending_transfer_count;
+} can_channel_t;
+
+extern const can_bus_config_t can_bus_config[CAN_BUS_COUNT];
+extern can_channel_t can_channels[CAN_BUS_COUNT];
+
+struct CAN_message_t;  // FlexCAN_T4 frame type
 
 class ecu_simClass
 {
@@ -284,17 +390,47 @@ class ecu_simClass
 
   ecu_simClass();
   uint8_t init(uint32_t baud);
-  uint8_t update(void);
+  uint8_t update(void);            // One main loop pass; nonzero while work can't wait a tick
   void update_pots(void);
-  void isotp_init_transfer(uint8_t* data, uint16_t len, uint16_t can_id, uint8_t mode, uint8_t pid);
+  void set_dtc(bool on);          // Set (with freeze frames) or clear the emissions DTCs
+  void freeze_frame_capture(uint16_t dtc_code);
+  freeze_frame_t* freeze_frame_get(uint8_t frame_num);
+  void freeze_frame_clear(void);
+  void isotp_init_transfer(const uint8_t* data, uint16_t len, uint16_t can_id, uint8_t mode, uint8_t pid);
   void isotp_send_first_frame(void);
   void isotp_handle_flow_control(uint8_t* data);
   void isotp_send_consecutive_frame(void);
   void isotp_process_transfers(void);
-  bool isotp_queue_transfer(uint8_t* data, uint16_t len, uint16_t can_id, uint8_t mode, uint8_t pid);
+  bool isotp_queue_transfer(const uint8_t* data, uint16_t len, uint16_t can_id, uint8_t mode, uint8_t pid);
+  void isotp_send_flow_control(uint16_t can_id, uint8_t flow_status);
+  void isotp_receive_first_frame(can_frame_t& frame, uint16_t response_id);
+  bool isotp_receive_consecutive_frame(can_frame_t& frame);
+
+  // Payload of the request being dispatched (service byte first).
+  // Points into the CAN frame for single frames (including CAN FD single
+  // frames longer than 7 bytes), or into isotp_rx for multi-frame requests.
+  const uint8_t* request_data;
+  uint16_t request_len;
+  bool request_fd;                // Request arrived as CAN FD; responses follow it
+  bool request_extended;          // Request arrived with a 29-bit ID; so do responses
+  uint32_t request_us;            // Receive timestamp of the request (response_timing.h)
+  uint16_t request_id;            // 11-bit request ID: PID_REQUEST or an ECU's physical ID
+  can_channel_t* channel;         // Bus the request arrived on; responses go there
+  uint8_t nrc_policy;             // NRC_POLICY_*
+
+  void send(const CAN_message_t& msg);  // Send a frame on the request's bus
+  void send_negative_response(uint8_t service, uint8_t nrc);  // 7F [service] [nrc], per nrc_policy
+  bool isotp_busy(void);          // ISO-TP transfer in progress on the request's bus
 
 private:
-  
+  void receive(can_frame_t& frame);  // Handle a frame from the current channel
+  bool serves(uint32_t can_id);   // Reply ID belongs to an ECU on the current channel
+  uint32_t send_first_frame(const can_frame_t& frame, uint16_t response_id, uint8_t kind,
+                            uint8_t service, uint32_t request_us);  // Through fault injection and response timing; clock_us() due
+  uint8_t freeze_frame_head;      // Next ring slot to write
+  uint8_t freeze_frame_count;     // Number of valid frames stored
+  void nv_load_state(void);       // Restore persistent state at power-up
+  void nv_save_state(void);       // Start a background save of it
 };
 
 extern ecu_simClass ecu_sim;
@@ -0,0 +1,125 @@
+/*
+ * Protocol Fault Injection
+ *
+ * Rule storage and the precompiled matcher. The ISO-TP engine in
+ * ecu_sim.cpp applies the faults. See fault_inject.h.
+ */
+
+#include "fault_inject.h"
+
+static fault_rule_t rules[FAULT_RULES];
+static uint16_t hits[FAULT_RULES];
+
+// Compiled rule set: bit n set = rule n applies
+uint8_t fault_kinds = 0;
+static uint8_t by_kind[8];        // Indexed by frame kind bit number
+static uint8_t by_ecu[256];       // Indexed by the ECU_* value of the frame
+static uint8_t by_service[256];   // Indexed by request SID
+
+static uint32_t random_state = 0x1B873593;
+
+static uint32_t next_random(void) {
+    random_state ^= random_state << 13;   // xorshift32
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+// Frame kinds each action can act on
+static uint8_t action_kinds(uint8_t action) {
+    switch(action) {
+        case FAULT_DROP:      return FAULT_FRAME_SF | FAULT_FRAME_FF | FAULT_FRAME_CF | FAULT_FRAME_FC;
+        case FAULT_BAD_SEQ:   return FAULT_FRAME_CF;
+        case FAULT_DELAY_CF:  return FAULT_FRAME_CF;
+        case FAULT_PENDING:   return FAULT_FRAME_SF | FAULT_FRAME_FF;
+        case FAULT_IGNORE_FC: return FAULT_FRAME_FC_RX;
+        default:              return 0;
+    }
+}
+
+/*
+ * Rebuild the lookup tables from the rule set
+ */
+static void fault_compile(void) {
+    uint8_t kinds = 0;
+
+    memset(by_kind, 0, sizeof(by_kind));
+    memset(by_ecu, 0, sizeof(by_ecu));
+    memset(by_service, 0, sizeof(by_service));
+
+    for(uint8_t i = 0; i < FAULT_RULES; i++) {
+        const fault_rule_t* rule = &rules[i];
+        uint8_t bit = 1 << i;
+        uint8_t rule_kinds = action_kinds(rule->action) & (rule->frames ? rule->frames : 0xFF);
+
+        if(rule_kinds == 0) continue;
+        kinds |= rule_kinds;
+
+        for(uint8_t k = 0; k < 8; k++) {
+            if(rule_kinds & (1 << k)) by_kind[k] |= bit;
+        }
+        for(uint16_t e = 0; e < 256; e++) {
+            if(rule->ecus == 0 || (e & rule->ecus)) by_ecu[e] |= bit;
+        }
+        for(uint16_t s = 0; s < 256; s++) {
+            if(rule->service == FAULT_ANY_SERVICE || rule->service == s) by_service[s] |= bit;
+        }
+    }
+    fault_kinds = kinds;
+}
+
+bool fault_set_rule(uint8_t index, const fault_rule_t* rule) {
+    if(index >= FAULT_RULES || rule->action > FAULT_IGNORE_FC) {
+        return false;
+    }
+    if(rule->action != FAULT_NONE && (rule->percent == 0 || rule->percent > 100)) {
+        return false;
+    }
+    if(rule->action != FAULT_NONE && !(action_kinds(rule->action) & (rule->frames ? rule->frames : 0xFF))) {
+        return false;  // Frames mask excludes everything the action acts on
+    }
+    if(rule->action == FAULT_PENDING && (rule->param == 0 || rule->param > FAULT_PENDING_MAX)) {
+        return false;  // A longer storm would overflow the response queue and go out at once
+    }
+
+    rules[index] = *rule;
+    hits[index] = 0;
+    fault_compile();
+    return true;
+}
+
+void fault_clear_all(void) {
+    memset(rules, 0, sizeof(rules));
+    memset(hits, 0, sizeof(hits));
+    fault_compile();
+}
+
+uint16_t fault_hits(uint8_t index) {
+    return (index < FAULT_RULES) ? hits[index] : 0;
+}
+
+const fault_rule_t* fault_match_rules(uint8_t kind, uint8_t ecu, uint8_t service) {
+    uint8_t kind_bit = 0;
+    while(!(kind & (1 << kind_bit))) kind_bit++;
+
+    uint8_t candidates = by_kind[kind_bit] & by_ecu[ecu] & by_service[service];
+
+    // Lowest rule index wins; each candidate rolls its own probability
+    for(uint8_t i = 0; candidates != 0; i++, candidates >>= 1) {
+        if(!(candidates & 1)) continue;
+        fault_rule_t* rule = &rules[i];
+
+        if(rule->percent < 100 && next_random() % 100 >= rule->percent) continue;
+
+        if(hits[i] < 0xFFFF) hits[i]++;
+        if(rule->count != 0 && hits[i] >= rule->count) {
+            static fault_rule_t fired;
+            fired = *rule;            // Caller still needs the parameters
+            rule->action = FAULT_NONE;
+            fault_compile();
+            return &fired;
+        }
+        return rule;
+    }
+    return NULL;
+}
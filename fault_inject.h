@@ -0,0 +1,97 @@
+#ifndef FAULT_INJECT_H
+#define FAULT_INJECT_H
+
+#include <Arduino.h>
+#include "response_timing.h"
+
+/*
+ * Protocol Fault Injection
+ *
+ * Testers must recover from ECUs that misbehave on the wire. Fault rules
+ * make the simulated ECUs misbehave on purpose, at the transmit path and
+ * inside the ISO-TP engine (ecu_sim.cpp):
+ *
+ *   Action         Frames it applies to     Effect
+ *   DROP           SF, FF, CF, FC           Frame not sent (a dropped CF still
+ *                                           uses its sequence number)
+ *   BAD_SEQ        CF                       Sequence number off by one
+ *   DELAY_CF       CF                       CF held for param ms (default
+ *                                           1100, past the tester's N_Cr)
+ *   PENDING        SF, FF                   param 7F xx 78 responsePending
+ *                                           frames every interval_ms first,
+ *                                           then the real response (param
+ *                                           1 to FAULT_PENDING_MAX)
+ *   IGNORE_FC      FC from the tester       The tester's flow control is
+ *                                           ignored: no CFs, transfer times out
+ *
+ * SF, FF and CF are the first or consecutive frames of a response, FC the
+ * simulator's own flow control for a multi-frame request. A rule fires
+ * for frames of the kinds in its frames mask (0 = every kind the action
+ * applies to), from the ECUs in its ecus mask (0 = all), answering the
+ * service (request SID) it names (FAULT_ANY_SERVICE = all), with the
+ * given probability. A rule with a count retires after that many hits.
+ *
+ * PRECOMPILED MATCHER:
+ * Setting a rule compiles the whole rule set into lookup tables - a rule
+ * bitmask per frame kind, per ECU and per service. Matching a frame is
+ * then three table reads ANDed together, and fault_match() returns at the
+ * first test when no rule applies to the frame kind at all, so the frames
+ * a rule leaves alone see no timing change.
+ */
+
+#define FAULT_RULES             8
+#define FAULT_ANY_SERVICE       0xFF
+#define FAULT_CF_HOLD_MS        1100      // DELAY_CF default: past N_Cr (1 s)
+#define FAULT_PENDING_MAX       (RESP_QUEUE_DEPTH - 1)  // Storm and response fit the timing queue
+
+/*
+ * Actions
+ */
+enum {
+    FAULT_NONE,               // Rule slot unused
+    FAULT_DROP,
+    FAULT_BAD_SEQ,
+    FAULT_DELAY_CF,
+    FAULT_PENDING,
+    FAULT_IGNORE_FC
+};
+
+/*
+ * Frame kinds (bitmask)
+ */
+#define FAULT_FRAME_SF          0x01      // Single Frame response
+#define FAULT_FRAME_FF          0x02      // First Frame of a response
+#define FAULT_FRAME_CF          0x04      // Consecutive Frame
+#define FAULT_FRAME_FC          0x08      // Flow control sent by the ECU
+#define FAULT_FRAME_FC_RX       0x10      // Flow control from the tester
+
+typedef struct {
+    uint8_t action;           // FAULT_*
+    uint8_t frames;           // FAULT_FRAME_* mask, 0 = all the action applies to
+    uint8_t ecus;             // ECU_* mask, 0 = all
+    uint8_t service;          // Request SID, FAULT_ANY_SERVICE = all
+    uint8_t percent;          // Probability per matching frame, 1-100
+    uint16_t param;           // DELAY_CF: hold ms; PENDING: frames
+    uint16_t interval_ms;     // PENDING: spacing
+    uint16_t count;           // Hits before the rule retires, 0 = never
+} fault_rule_t;
+
+extern uint8_t fault_kinds;   // Frame kinds any rule applies to
+
+/*
+ * Fault Injection Interface
+ */
+bool fault_set_rule(uint8_t index, const fault_rule_t* rule);  // FAULT_NONE clears; false if invalid
+void fault_clear_all(void);
+uint16_t fault_hits(uint8_t index);
+const fault_rule_t* fault_match_rules(uint8_t kind, uint8_t ecu, uint8_t service);
+
+// Rule to apply to this frame (kind FAULT_FRAME_*, ecu ECU_*), or NULL
+static inline const fault_rule_t* fault_match(uint8_t kind, uint8_t ecu, uint8_t service) {
+    if(!(fault_kinds & kind)) {
+        return NULL;          // Fast path: no rule for this kind of frame
+    }
+    return fault_match_rules(kind, ecu, service);
+}
+
+#endif // FAULT_INJECT_H
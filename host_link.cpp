@@ -0,0 +1,651 @@
+/*
+ * Host Control Link - Binary Protocol over USB Serial
+ *
+ * Incremental frame parser, command handlers and the CAN trace queue.
+ * See host_link.h for the frame format and command set.
+ */
+
+#include "host_link.h"
+#include "ecu_sim.h"
+#include "sim_state.h"
+#include "tx_schedule.h"
+#include "bus_load.h"
+#include "capture.h"
+#include "response_timing.h"
+#include "fault_inject.h"
+#include "memory_map.h"
+#include "mode_registry.h"
+#include "wcet.h"
+#include "drive_cycle.h"
+#include "sim_clock.h"
+
+/*
+ * Parser - one state per frame field, fed a byte at a time
+ */
+typedef enum {
+    HOST_RX_SYNC,
+    HOST_RX_LEN,
+    HOST_RX_CMD,
+    HOST_RX_SEQ,
+    HOST_RX_PAYLOAD,
+    HOST_RX_CRC
+} host_rx_state_t;
+
+static struct {
+    host_rx_state_t state;
+    uint8_t len;
+    uint8_t cmd;
+    uint8_t seq;
+    uint8_t payload[HOST_LINK_MAX_PAYLOAD];
+    uint8_t received;             // Payload bytes so far
+    uint8_t crc;                  // Running CRC from LEN on
+    uint32_t frame_start;         // clock_ms() of the sync byte
+} rx;
+
+static uint32_t frames_ok = 0;
+static uint16_t frame_errors = 0;       // Bad CRC, length or timeout
+static bool link_active = false;
+
+/*
+ * Trace queue - filled by the frame tap, drained by host_link_update()
+ */
+typedef struct {
+    uint32_t time_us;
+    uint8_t bus;
+    uint8_t flags;                // HOST_TRACE_*
+    can_frame_t frame;
+} host_trace_t;
+
+#define HOST_TRACE_TX           0x01
+#define HOST_TRACE_EXTENDED     0x02
+#define HOST_TRACE_FD           0x04
+
+DMAMEM static host_trace_t trace_queue[HOST_TRACE_DEPTH];
+static volatile uint8_t trace_head = 0;
+static volatile uint8_t trace_count = 0;
+static uint16_t trace_dropped = 0;
+static uint8_t trace_seq = 0;
+
+/*
+ * Capture export - text lines streamed as CAPTURE events
+ */
+static bool export_active = false;
+static char export_line[CAPTURE_LINE_MAX];
+static uint16_t export_len = 0;           // Bytes of export_line still to send
+static uint16_t export_sent = 0;
+static uint8_t export_seq = 0;
+
+static uint8_t crc8_step(uint8_t crc, uint8_t byte) {
+    crc ^= byte;
+    for(uint8_t bit = 0; bit < 8; bit++) {
+        crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+uint8_t host_link_crc8(const uint8_t* data, uint16_t len) {
+    uint8_t crc = 0x00;
+
+    for(uint16_t i = 0; i < len; i++) {
+        crc = crc8_step(crc, data[i]);
+    }
+    return crc;
+}
+
+static void put_u16(uint8_t* p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+    put_u16(p, v & 0xFFFF);
+    put_u16(p + 2, v >> 16);
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * Frame a payload and hand it to USB serial in one write
+ */
+static void host_link_send(uint8_t cmd, uint8_t seq, const uint8_t* payload, uint8_t len) {
+    uint8_t out[HOST_LINK_MAX_PAYLOAD + 5];
+
+    out[0] = HOST_LINK_SYNC;
+    out[1] = len;
+    out[2] = cmd;
+    out[3] = seq;
+    if(len > 0) memcpy(&out[4], payload, len);
+    out[4 + len] = host_link_crc8(&out[1], len + 3);
+    Serial.write(out, len + 5);
+}
+
+static void host_link_reply(uint8_t status, const uint8_t* data, uint8_t len) {
+    uint8_t payload[HOST_LINK_MAX_PAYLOAD];
+
+    payload[0] = status;
+    if(len > 0) memcpy(&payload[1], data, len);
+    host_link_send(rx.cmd | HOST_REPLY, rx.seq, payload, len + 1);
+}
+
+/*
+ * Trace
+ */
+static void host_trace_tap(CanTransport* transport, const can_frame_t& frame, bool tx) {
+    uint8_t bus = 0;
+    while(bus < CAN_BUS_COUNT - 1 && can_transports[bus] != transport) bus++;
+
+    noInterrupts();               // Main loop and timer interrupt both send
+    if(trace_count == HOST_TRACE_DEPTH) {
+        trace_dropped++;
+    } else {
+        host_trace_t* entry = &trace_queue[(trace_head + trace_count) % HOST_TRACE_DEPTH];
+        entry->time_us = tx ? clock_us() : frame.time_us;
+        entry->bus = bus;
+        entry->flags = (tx ? HOST_TRACE_TX : 0) |
+                       (frame.extended ? HOST_TRACE_EXTENDED : 0) |
+                       (frame.fd ? HOST_TRACE_FD : 0);
+        entry->frame = frame;
+        trace_count++;
+    }
+    interrupts();
+}
+
+// Write queued frames while the USB buffer has room; never blocks
+static void host_trace_drain(void) {
+    uint8_t payload[11 + CAN_FD_MAX_LEN];
+
+    while(trace_count > 0) {
+        const host_trace_t* entry = &trace_queue[trace_head];
+        uint8_t len = entry->frame.len;
+
+        if(Serial.availableForWrite() < len + 16) {
+            return;
+        }
+        put_u32(&payload[0], entry->time_us);
+        payload[4] = entry->bus;
+        payload[5] = entry->flags;
+        put_u32(&payload[6], entry->frame.id);
+        payload[10] = len;
+        memcpy(&payload[11], entry->frame.buf, len);
+        host_link_send(HOST_EVT_TRACE, trace_seq++, payload, 11 + len);
+
+        noInterrupts();
+        trace_head = (trace_head + 1) % HOST_TRACE_DEPTH;
+        trace_count--;
+        interrupts();
+    }
+}
+
+// Send export text while the USB buffer has room; a zero-length event ends it
+static void host_export_drain(void) {
+    while(export_active) {
+        if(Serial.availableForWrite() < HOST_LINK_MAX_PAYLOAD + 5) {
+            return;
+        }
+        if(export_sent == export_len) {
+            if(!capture_export_line(export_line)) {
+                host_link_send(HOST_EVT_CAPTURE, export_seq++, NULL, 0);
+                export_active = false;
+                return;
+            }
+            export_len = strlen(export_line);
+            export_sent = 0;
+        }
+        uint8_t chunk = min(export_len - export_sent, HOST_LINK_MAX_PAYLOAD);
+        host_link_send(HOST_EVT_CAPTURE, export_seq++, (const uint8_t*)&export_line[export_sent], chunk);
+        export_sent += chunk;
+    }
+}
+
+/*
+ * Command handlers - rx holds the complete, CRC-checked frame
+ */
+static void host_cmd_set_signals(void) {
+    if(rx.len == 0 || rx.len % 3 != 0) {
+        host_link_reply(HOST_ERR_LENGTH, NULL, 0);
+        return;
+    }
+    for(uint8_t i = 0; i < rx.len; i += 3) {
+        if(rx.payload[i] >= SIG_COUNT) {
+            host_link_reply(HOST_ERR_VALUE, NULL, 0);
+            return;
+        }
+    }
+    for(uint8_t i = 0; i < rx.len; i += 3) {
+        sim_state_hold_signal(rx.payload[i], rx.payload[i + 1] | (rx.payload[i + 2] << 8));
+    }
+    host_link_reply(HOST_OK, NULL, 0);
+}
+
+/*
+ * READ_STATS reply data:
+ *   uptime ms (4), host frames received (4), host frame errors (2),
+ *   trace frames dropped (2), scheduled jobs (2), worst job lateness ms (2),
+ *   bus load target % (1), then per bus: flags (bit 0 enabled, bit 1
+ *   detecting) (1), bit rate (4), receive error counter (1), load % (1)
+ */
+static void host_cmd_read_stats(void) {
+    uint8_t data[18 + CAN_BUS_COUNT * 7];
+    uint8_t len = 0;
+
+    put_u32(&data[len], clock_ms());                       len += 4;
+    put_u32(&data[len], frames_ok);                      len += 4;
+    put_u16(&data[len], frame_errors);                   len += 2;
+    put_u16(&data[len], trace_dropped);                  len += 2;
+    put_u16(&data[len], tx_schedule_count());            len += 2;
+    put_u16(&data[len], min(tx_schedule_max_lateness(), (uint32_t)0xFFFF)); len += 2;
+    data[len++] = bus_load_target();
+
+    for(uint8_t i = 0; i < CAN_BUS_COUNT; i++) {
+        const can_channel_t* ch = &can_channels[i];
+        bool enabled = can_bus_config[i].enabled;
+
+        data[len++] = (enabled ? 0x01 : 0) | (ch->link.detecting ? 0x02 : 0);
+        put_u32(&data[len], enabled ? ch->link.baud : 0); len += 4;
+        data[len++] = enabled ? ch->transport->rx_errors() : 0;
+        data[len++] = bus_load_actual(i);
+    }
+    host_link_reply(HOST_OK, data, len);
+}
+
+/*
+ * CAPTURE_ARM payload:
+ *   sources (1), pre ms (2), post ms (2)
+ *   [ id (4), id mask (4), data (8), data mask (8) ] for CAPTURE_TRIG_FRAME
+ */
+static void host_cmd_capture_arm(void) {
+    capture_trigger_t trigger;
+
+    if(rx.len != 5 && rx.len != 29) {
+        host_link_reply(HOST_ERR_LENGTH, NULL, 0);
+        return;
+    }
+    memset(&trigger, 0, sizeof(trigger));
+    trigger.sources = rx.payload[0];
+    trigger.pre_ms = rx.payload[1] | (rx.payload[2] << 8);
+    trigger.post_ms = rx.payload[3] | (rx.payload[4] << 8);
+    if(rx.len == 29) {
+        const uint8_t* p = &rx.payload[5];
+        trigger.id = get_u32(&p[0]);
+        trigger.id_mask = get_u32(&p[4]);
+        memcpy(trigger.data, &p[8], CAN_MAX_LEN);
+        memcpy(trigger.data_mask, &p[16], CAN_MAX_LEN);
+    } else if(trigger.sources & CAPTURE_TRIG_FRAME) {
+        host_link_reply(HOST_ERR_LENGTH, NULL, 0);  // Frame trigger without a pattern
+        return;
+    }
+    export_active = false;
+    capture_arm(&trigger);
+    host_link_reply(HOST_OK, NULL, 0);
+}
+
+/*
+ * CAPTURE_STATUS reply data:
+ *   state (capture_state_t) (1), frames recorded (4), bytes used (4),
+ *   trigger time us (4, 0 = not triggered),
+ *   truncated (1, 1 = post window cut short to keep the pre window)
+ */
+static void host_cmd_capture_status(void) {
+    uint8_t data[14];
+
+    data[0] = capture_state();
+    put_u32(&data[1], capture_frames());
+    put_u32(&data[5], capture_bytes_used());
+    put_u32(&data[9], capture_trigger_time());
+    data[13] = capture_truncated() ? 1 : 0;
+    host_link_reply(HOST_OK, data, sizeof(data));
+}
+
+/*
+ * SET_RESPONSE_TIMING payload:
+ *   ECU (0 ECM, 1 TCM, 2 FPCM) (1), type (resp_timing_type_t) (1),
+ *   min us (4), max us (4), bin us (4), then HISTOGRAM bin weights (1 each)
+ * ERR_VALUE when the profile is invalid or its longest delay exceeds
+ * RESP_TIMING_MAX_US (10 s).
+ */
+static void host_cmd_set_response_timing(void) {
+    resp_timing_profile_t profile;
+
+    if(rx.len < 14 || rx.len > 14 + RESP_TIMING_BINS) {
+        host_link_reply(HOST_ERR_LENGTH, NULL, 0);
+        return;
+    }
+    memset(&profile, 0, sizeof(profile));
+    profile.type = rx.payload[1];
+    profile.min_us = get_u32(&rx.payload[2]);
+    profile.max_us = get_u32(&rx.payload[6]);
+    profile.bin_us = get_u32(&rx.payload[10]);
+    profile.bins = rx.len - 14;
+    memcpy(profile.weights, &rx.payload[14], profile.bins);
+
+    host_link_reply(resp_timing_set(rx.payload[0], &profile) ? HOST_OK : HOST_ERR_VALUE, NULL, 0);
+}
+
+/*
+ * SET_FAULT payload:
+ *   rule index (FF = clear every rule) (1), action (1), frames (1),
+ *   ECUs (1), service (1), percent (1), param (2), interval ms (2),
+ *   count (2) - see fault_rule_t
+ */
+static void host_cmd_set_fault(void) {
+    fault_rule_t rule;
+
+    if(rx.payload[0] == 0xFF) {
+        fault_clear_all();
+        host_link_reply(HOST_OK, NULL, 0);
+        return;
+    }
+    rule.action = rx.payload[1];
+    rule.frames = rx.payload[2];
+    rule.ecus = rx.payload[3];
+    rule.service = rx.payload[4];
+    rule.percent = rx.payload[5];
+    rule.param = rx.payload[6] | (rx.payload[7] << 8);
+    rule.interval_ms = rx.payload[8] | (rx.payload[9] << 8);
+    rule.count = rx.payload[10] | (rx.payload[11] << 8);
+    host_link_reply(fault_set_rule(rx.payload[0], &rule) ? HOST_OK : HOST_ERR_VALUE, NULL, 0);
+}
+
+// READ_FAULTS reply data: hits per rule (2 each, FAULT_RULES rules)
+static void host_cmd_read_faults(void) {
+    uint8_t data[FAULT_RULES * 2];
+
+    for(uint8_t i = 0; i < FAULT_RULES; i++) {
+        put_u16(&data[i * 2], fault_hits(i));
+    }
+    host_link_reply(HOST_OK, data, sizeof(data));
+}
+
+/*
+ * READ_MEMORY reply data, per region (ITCM, DTCM, OCRAM, flash):
+ *   bytes used (4), region size (4) - see memory_map.h
+ */
+static void host_cmd_read_memory(void) {
+    mem_region_t regions[MEM_REGIONS];
+    uint8_t data[MEM_REGIONS * 8];
+
+    mem_report_get(regions);
+    for(uint8_t i = 0; i < MEM_REGIONS; i++) {
+        put_u32(&data[i * 8], regions[i].used);
+        put_u32(&data[i * 8 + 4], regions[i].size);
+    }
+    host_link_reply(HOST_OK, data, sizeof(data));
+}
+
+/*
+ * READ_DRIVE_CYCLE reply data: cycle (1), finished (1), time into the
+ * trace in ms (4), gear (1) - see drive_cycle.h
+ */
+static void host_cmd_read_drive_cycle(void) {
+    uint8_t data[7];
+
+    data[0] = drive_cycle_current();
+    data[1] = drive_cycle_finished() ? 1 : 0;
+    put_u32(&data[2], drive_cycle_position_ms());
+    data[6] = drive_cycle_gear();
+    host_link_reply(HOST_OK, data, sizeof(data));
+}
+
+#if USE_WCET
+/*
+ * READ_WCET payload: first probe (wcet.h), or FF to clear every probe
+ * Reply data: probe count (1), then from the first probe on, as many as
+ * fit (WCET_REPLY_PROBES):
+ *   service (1; handler probes only, else 0), runs (4), mean ns (4),
+ *   max ns (4)
+ */
+#define WCET_REPLY_PROBES       7
+#define WCET_CLEAR              0xFF
+
+static void host_cmd_read_wcet(uint8_t first) {
+    uint8_t data[1 + WCET_REPLY_PROBES * 13];
+    uint8_t len = 1;
+
+    if(first == WCET_CLEAR) {
+        wcet_reset();
+        host_link_reply(HOST_OK, NULL, 0);
+        return;
+    }
+    if(first >= WCET_PROBES) {
+        host_link_reply(HOST_ERR_VALUE, NULL, 0);
+        return;
+    }
+
+    data[0] = WCET_PROBES;
+    for(uint8_t probe = first; probe < WCET_PROBES && probe < first + WCET_REPLY_PROBES; probe++) {
+        wcet_stats_t stats;
+        wcet_get(probe, &stats);
+        data[len] = (probe >= WCET_HANDLER) ? ModeRegistry::get_mode_id(probe - WCET_HANDLER) : 0;
+        put_u32(&data[len + 1], stats.count);
+        put_u32(&data[len + 5], stats.mean_ns);
+        put_u32(&data[len + 9], stats.max_ns);
+        len += 13;
+    }
+    host_link_reply(HOST_OK, data, len);
+}
+#endif
+
+// Commands with a fixed payload length; replies with the error otherwise
+static bool host_link_expect(uint8_t len) {
+    if(rx.len != len) {
+        host_link_reply(HOST_ERR_LENGTH, NULL, 0);
+        return false;
+    }
+    return true;
+}
+
+static void host_link_execute(void) {
+    uint8_t version = HOST_LINK_VERSION;
+    uint8_t arg = rx.payload[0];
+
+    switch(rx.cmd) {
+        case HOST_CMD_PING:
+            if(!host_link_expect(0)) break;
+            host_link_reply(HOST_OK, &version, 1);
+            break;
+
+        case HOST_CMD_SET_SIGNALS:
+            host_cmd_set_signals();
+            break;
+
+        case HOST_CMD_RELEASE_SIGNAL:
+            if(!host_link_expect(1)) break;
+            sim_state_release_signal(arg);
+            host_link_reply(HOST_OK, NULL, 0);
+            break;
+
+        case HOST_CMD_SET_DTC:
+            if(!host_link_expect(1)) break;
+            ecu_sim.set_dtc(arg != 0);
+            host_link_reply(HOST_OK, NULL, 0);
+            break;
+
+        case HOST_CMD_SET_PROFILE:
+            if(!host_link_expect(1)) break;
+            host_link_reply(sim_state_set_drive_state(arg) ? HOST_OK : HOST_ERR_VALUE, NULL, 0);
+            break;
+
+        case HOST_CMD_READ_STATS:
+            if(!host_link_expect(0)) break;
+            host_cmd_read_stats();
+            break;
+
+        case HOST_CMD_TRACE:
+            if(!host_link_expect(1)) break;
+            if(arg) {
+                host_link_reply(can_tap_add(host_trace_tap) ? HOST_OK : HOST_ERR_VALUE, NULL, 0);
+            } else {
+                can_tap_remove(host_trace_tap);
+                host_link_reply(HOST_OK, NULL, 0);
+            }
+            break;
+
+        case HOST_CMD_SET_BUS_LOAD:
+            if(!host_link_expect(1)) break;
+            if(arg > 100) {
+                host_link_reply(HOST_ERR_VALUE, NULL, 0);
+                break;
+            }
+            bus_load_set_target(arg);
+            host_link_reply(HOST_OK, NULL, 0);
+            break;
+
+        case HOST_CMD_CAPTURE_ARM:
+            host_cmd_capture_arm();
+            break;
+
+        case HOST_CMD_CAPTURE_STATUS:
+            if(!host_link_expect(0)) break;
+            host_cmd_capture_status();
+            break;
+
+        case HOST_CMD_CAPTURE_EXPORT:
+            if(!host_link_expect(1)) break;
+            if(export_active || !capture_export_start(arg)) {
+                host_link_reply(HOST_ERR_VALUE, NULL, 0);
+                break;
+            }
+            export_active = true;
+            export_len = export_sent = 0;
+            host_link_reply(HOST_OK, NULL, 0);
+            break;
+
+        case HOST_CMD_SET_RESPONSE_TIMING:
+            host_cmd_set_response_timing();
+            break;
+
+        case HOST_CMD_SET_FAULT:
+            if(!host_link_expect(12)) break;
+            host_cmd_set_fault();
+            break;
+
+        case HOST_CMD_READ_FAULTS:
+            if(!host_link_expect(0)) break;
+            host_cmd_read_faults();
+            break;
+
+        case HOST_CMD_SET_NRC_POLICY:
+            if(!host_link_expect(1)) break;
+            if(arg > NRC_POLICY_ALWAYS) {
+                host_link_reply(HOST_ERR_VALUE, NULL, 0);
+                break;
+            }
+            ecu_sim.nrc_policy = arg;
+            host_link_reply(HOST_OK, NULL, 0);
+            break;
+
+        case HOST_CMD_READ_MEMORY:
+            if(!host_link_expect(0)) break;
+            host_cmd_read_memory();
+            break;
+
+        case HOST_CMD_SET_DRIVE_CYCLE:
+            if(!host_link_expect(2)) break;
+            host_link_reply(drive_cycle_select(arg, rx.payload[1] != 0) ? HOST_OK : HOST_ERR_VALUE, NULL, 0);
+            break;
+
+        case HOST_CMD_READ_DRIVE_CYCLE:
+            if(!host_link_expect(0)) break;
+            host_cmd_read_drive_cycle();
+            break;
+
+        case HOST_CMD_IGNITION_CYCLE:
+            if(!host_link_expect(0)) break;
+            sim_state_ignition_cycle();
+            host_link_reply(HOST_OK, NULL, 0);
+            break;
+
+#if USE_WCET
+        case HOST_CMD_READ_WCET:
+            if(!host_link_expect(1)) break;
+            host_cmd_read_wcet(arg);
+            break;
+#endif
+
+        default:
+            host_link_reply(HOST_ERR_COMMAND, NULL, 0);
+            break;
+    }
+}
+
+/*
+ * Feed one received byte to the parser
+ */
+static void host_link_parse(uint8_t byte) {
+    switch(rx.state) {
+        case HOST_RX_SYNC:
+            if(byte == HOST_LINK_SYNC) {
+                rx.frame_start = clock_ms();
+                rx.state = HOST_RX_LEN;
+            }
+            break;
+
+        case HOST_RX_LEN:
+            if(byte > HOST_LINK_MAX_PAYLOAD) {
+                frame_errors++;
+                rx.state = (byte == HOST_LINK_SYNC) ? HOST_RX_LEN : HOST_RX_SYNC;
+                break;
+            }
+            rx.len = byte;
+            rx.crc = crc8_step(0x00, byte);
+            rx.state = HOST_RX_CMD;
+            break;
+
+        case HOST_RX_CMD:
+            rx.cmd = byte;
+            rx.crc = crc8_step(rx.crc, byte);
+            rx.state = HOST_RX_SEQ;
+            break;
+
+        case HOST_RX_SEQ:
+            rx.seq = byte;
+            rx.crc = crc8_step(rx.crc, byte);
+            rx.received = 0;
+            rx.state = (rx.len > 0) ? HOST_RX_PAYLOAD : HOST_RX_CRC;
+            break;
+
+        case HOST_RX_PAYLOAD:
+            rx.payload[rx.received++] = byte;
+            rx.crc = crc8_step(rx.crc, byte);
+            if(rx.received == rx.len) rx.state = HOST_RX_CRC;
+            break;
+
+        case HOST_RX_CRC:
+            rx.state = HOST_RX_SYNC;
+            if(byte != rx.crc) {
+                frame_errors++;
+                break;
+            }
+            frames_ok++;
+            link_active = true;
+            host_link_execute();
+            break;
+    }
+}
+
+FLASHMEM void host_link_init(void) {
+    rx.state = HOST_RX_SYNC;
+}
+
+void host_link_update(void) {
+    // A stalled partial frame would swallow the next command's sync byte
+    if(rx.state != HOST_RX_SYNC && clock_ms() - rx.frame_start > HOST_LINK_TIMEOUT_MS) {
+        rx.state = HOST_RX_SYNC;
+        frame_errors++;
+    }
+
+    // Only the bytes already here; a command never waits for the next one
+    int available = Serial.available();
+    while(available-- > 0) {
+        host_link_parse(Serial.read());
+    }
+
+    host_trace_drain();
+    host_export_drain();
+}
+
+bool host_link_active(void) {
+    return link_active;
+}
@@ -0,0 +1,132 @@
+#ifndef HOST_LINK_H
+#define HOST_LINK_H
+
+#include <Arduino.h>
+
+/*
+ * Host Control Link - Binary Protocol over USB Serial
+ *
+ * Test automation drives the simulator through framed binary commands
+ * instead of the push buttons and potentiometers. Every frame, in both
+ * directions, is:
+ *
+ *   A5 LEN CMD SEQ PAYLOAD[LEN] CRC
+ *
+ *   A5       Sync byte
+ *   LEN      Payload length, 0 to HOST_LINK_MAX_PAYLOAD
+ *   CMD      Command; replies use CMD | 0x80, events 0xE0 and up
+ *   SEQ      Chosen by the host, echoed in the reply
+ *   CRC      CRC-8 (polynomial 0x07, initial 0x00) over LEN, CMD, SEQ
+ *            and the payload
+ *
+ * Each reply payload starts with a status byte (HOST_OK, HOST_ERR_*).
+ * Multi-byte values are little-endian. A frame with a bad CRC or length
+ * is dropped and the parser hunts for the next sync byte, so a host can
+ * also resynchronise past any text the firmware prints.
+ *
+ *   CMD  Name             Payload                     Reply data
+ *   01   PING             -                           protocol version
+ *   02   SET_SIGNALS      { signal, value16 } x n     -
+ *   03   RELEASE_SIGNAL   signal (SIG_ALL = every)    -
+ *   04   SET_DTC          0 = clear, 1 = set          -
+ *   05   SET_PROFILE      drive state, FF = auto      -
+ *   06   READ_STATS       -                           see host_link.cpp
+ *   07   TRACE            0 = stop, 1 = start         -
+ *   08   SET_BUS_LOAD     target percent              -
+ *   09   CAPTURE_ARM      see host_link.cpp           -
+ *   0A   CAPTURE_STATUS   -                           see host_link.cpp
+ *   0B   CAPTURE_EXPORT   0 = candump, 1 = ASC        -
+ *   0C   SET_RESPONSE_TIMING  see host_link.cpp       -
+ *   0D   SET_FAULT        see host_link.cpp           -
+ *   0E   READ_FAULTS      -                           hits per rule
+ *   0F   SET_NRC_POLICY   NRC_POLICY_* (ecu_sim.h)    -
+ *   10   READ_MEMORY      -                           see host_link.cpp
+ *   11   READ_WCET        first probe, FF = clear     see host_link.cpp
+ *   12   SET_DRIVE_CYCLE  cycle, 1 = loop             -
+ *   13   READ_DRIVE_CYCLE -                           see host_link.cpp
+ *   14   IGNITION_CYCLE   -                           -
+ *
+ * Drive cycles are the DRIVE_CYCLE_* values of drive_cycle.h (0 = none,
+ * back to the random driving states). IGNITION_CYCLE simulates a
+ * key-off/key-on (sim_state_ignition_cycle() in sim_state.h).
+ *
+ * Signals (SimSignal in sim_state.h) are held at the given raw PID value
+ * until released. SET_SIGNALS takes up to 32 signals, so a whole set of
+ * values changes in one frame.
+ *
+ * TIMING:
+ * host_link_update() runs at the start of every main loop pass and
+ * parses whatever bytes have arrived without waiting for more, so a
+ * command takes effect between two CAN frames - never halfway through
+ * answering a request - within one pass of the loop. A frame left
+ * incomplete for HOST_LINK_TIMEOUT_MS is discarded.
+ *
+ * TRACE:
+ * While tracing, every CAN frame received or sent on any bus is reported
+ * as a TRACE event (CMD E0): time (us; the controller's receive timestamp
+ * for received frames), bus, flags (bit 0 sent, bit 1 29-bit ID, bit 2
+ * CAN FD), ID, length and data. Frames are queued from a frame tap
+ * (can_tap_add) and written only when the USB buffer has room; frames
+ * lost to a full queue are counted in READ_STATS.
+ *
+ * CAPTURE EXPORT:
+ * After the OK reply the capture buffer (capture.h) follows as CAPTURE
+ * events (CMD E1) carrying the log text, up to HOST_LINK_MAX_PAYLOAD
+ * bytes each; the host appends the payloads in order. A zero-length
+ * event ends the export.
+ *
+ * Once the first valid frame arrives, the per-request text log on Serial
+ * is switched off.
+ */
+
+#define HOST_LINK_SYNC          0xA5
+#define HOST_LINK_VERSION       1
+#define HOST_LINK_MAX_PAYLOAD   96
+#define HOST_LINK_TIMEOUT_MS    50        // Partial frame discarded after this
+#define HOST_TRACE_DEPTH        64        // Queued trace frames
+
+/*
+ * Commands
+ */
+#define HOST_CMD_PING           0x01
+#define HOST_CMD_SET_SIGNALS    0x02
+#define HOST_CMD_RELEASE_SIGNAL 0x03
+#define HOST_CMD_SET_DTC        0x04
+#define HOST_CMD_SET_PROFILE    0x05
+#define HOST_CMD_READ_STATS     0x06
+#define HOST_CMD_TRACE          0x07
+#define HOST_CMD_SET_BUS_LOAD   0x08
+#define HOST_CMD_CAPTURE_ARM    0x09
+#define HOST_CMD_CAPTURE_STATUS 0x0A
+#define HOST_CMD_CAPTURE_EXPORT 0x0B
+#define HOST_CMD_SET_RESPONSE_TIMING 0x0C
+#define HOST_CMD_SET_FAULT      0x0D
+#define HOST_CMD_READ_FAULTS    0x0E
+#define HOST_CMD_SET_NRC_POLICY 0x0F
+#define HOST_CMD_READ_MEMORY    0x10
+#define HOST_CMD_READ_WCET      0x11      // USE_WCET builds only
+#define HOST_CMD_SET_DRIVE_CYCLE 0x12
+#define HOST_CMD_READ_DRIVE_CYCLE 0x13
+#define HOST_CMD_IGNITION_CYCLE 0x14
+
+#define HOST_REPLY              0x80      // Reply: CMD | HOST_REPLY
+#define HOST_EVT_TRACE          0xE0      // Traced CAN frame
+#define HOST_EVT_CAPTURE        0xE1      // Capture export text
+
+/*
+ * Reply status
+ */
+#define HOST_OK                 0x00
+#define HOST_ERR_COMMAND        0x01      // Unknown command
+#define HOST_ERR_LENGTH         0x02      // Wrong payload length for the command
+#define HOST_ERR_VALUE          0x03      // Value out of range
+
+/*
+ * Host Link Interface
+ */
+void host_link_init(void);
+void host_link_update(void);              // Main loop: parse commands, drain the trace
+bool host_link_active(void);              // A valid frame has been received
+uint8_t host_link_crc8(const uint8_t* data, uint16_t len);
+
+#endif // HOST_LINK_H
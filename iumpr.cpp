@@ -0,0 +1,158 @@
+/*
+ * In-Use Monitor Performance Ratio - Counters
+ *
+ * Tracks drive cycle conditions off the driving simulation and keeps the
+ * IUMPR numerators and denominators. See iumpr.h for the counting rules.
+ */
+
+#include "iumpr.h"
+#include "ecu_sim.h"
+#include "monitors.h"
+#include "nv_store.h"
+#include "memory_map.h"
+#include "sim_clock.h"
+
+// Counters, seeded from a Mercedes-Benz GLE-Class; restored from NV storage
+uint16_t iumpr_counters[IUMPR_COUNTER_COUNT] = {
+    5136,  45614,       // OBDCOND, IGNCNTR
+    65535, 5136,        // Catalyst bank 1 completions, conditions
+    65535, 26384,       // Catalyst bank 2
+    65535, 5136,        // O2 sensor bank 1
+    0,     0,           // O2 sensor bank 2
+    45601, 3088,        // EGR/VVT
+    45568, 0,           // Secondary air (not monitored)
+    1,     46851,       // EVAP
+    6670,  5136,        // Secondary O2 bank 1 (not monitored)
+    0,     0            // Secondary O2 bank 2 (not monitored)
+};
+
+/*
+ * Monitor to counter mapping; only these groups have denominators
+ */
+typedef struct {
+    uint8_t mid;              // OBDMID of the monitor
+    uint8_t comp;             // Numerator index, denominator follows it
+} iumpr_group_t;
+
+static const iumpr_group_t iumpr_groups[] PROGMEM = {
+    { OBDMID_CAT_B1,   IUMPR_CATCOMP1 },
+    { OBDMID_CAT_B2,   IUMPR_CATCOMP2 },
+    { OBDMID_O2_B1S1,  IUMPR_O2SCOMP1 },
+    { OBDMID_O2_B2S1,  IUMPR_O2SCOMP2 },
+    { OBDMID_EGR,      IUMPR_EGRCOMP },
+    { OBDMID_EVAP_020, IUMPR_EVAPCOMP },
+};
+
+#define IUMPR_GROUP_COUNT (sizeof(iumpr_groups) / sizeof(iumpr_groups[0]))
+
+static uint8_t iumpr_cache[IUMPR_RESPONSE_LEN];     // Mode 09 PID 08 response
+static bool numerator_counted[IUMPR_GROUP_COUNT];   // This drive cycle
+static bool denominator_counted;                    // This drive cycle
+
+// Drive cycle conditions, 100ms ticks
+static uint16_t run_ticks;
+static uint16_t speed_ticks;
+static uint16_t idle_ticks;
+static bool idle_seen;
+
+/*
+ * Serialize the counters into the cached response
+ */
+static void iumpr_build_response(void) {
+    iumpr_cache[0] = MODE9_RESPONSE;
+    iumpr_cache[1] = PERF_TRACK_REQUEST;
+    for(uint8_t i = 0; i < IUMPR_COUNTER_COUNT; i++) {
+        iumpr_cache[2 + i * 2] = (iumpr_counters[i] >> 8) & 0xFF;
+        iumpr_cache[3 + i * 2] = iumpr_counters[i] & 0xFF;
+    }
+    iumpr_cache[IUMPR_RESPONSE_LEN - 1] = 0x01;  // Data item count
+}
+
+/*
+ * Add one to a numerator or denominator, halving the pair at the limit
+ */
+static void iumpr_increment(uint8_t comp, uint8_t index) {
+    if(iumpr_counters[index] == 0xFFFF) {
+        iumpr_counters[comp] /= 2;
+        iumpr_counters[comp + 1] /= 2;
+    }
+    iumpr_counters[index]++;
+}
+
+static void iumpr_changed(void) {
+    iumpr_build_response();
+    nv_mark_dirty(true);
+}
+
+FLASHMEM void iumpr_init(void) {
+    // Power-up is a new ignition cycle
+    iumpr_ignition_cycle();
+}
+
+void iumpr_ignition_cycle(void) {
+    memset(numerator_counted, 0, sizeof(numerator_counted));
+    denominator_counted = false;
+    run_ticks = 0;
+    speed_ticks = 0;
+    idle_ticks = 0;
+    idle_seen = false;
+
+    // The counter rolls over to 0
+    iumpr_counters[IUMPR_IGNCNTR]++;
+    iumpr_changed();
+}
+
+void iumpr_update(void) {
+    static uint32_t lastUpdate = 0;
+
+    // Conditions are sampled at the simulation rate (100ms)
+    if(clock_ms() - lastUpdate < 100) {
+        return;
+    }
+    lastUpdate = clock_ms();
+
+    if(denominator_counted) {
+        return;  // Denominators count once per drive cycle
+    }
+
+    if(run_ticks < IUMPR_RUN_TICKS) run_ticks++;
+    if(sim_state.vehicle_speed >= IUMPR_SPEED_KMH && speed_ticks < IUMPR_SPEED_TICKS) speed_ticks++;
+
+    // Idle: stationary with the throttle released, must be continuous
+    if(sim_state.vehicle_speed == 0 && sim_state.drive_state == IDLE) {
+        if(++idle_ticks >= IUMPR_IDLE_TICKS) idle_seen = true;
+    } else {
+        idle_ticks = 0;
+    }
+
+    if(run_ticks < IUMPR_RUN_TICKS || speed_ticks < IUMPR_SPEED_TICKS || !idle_seen) {
+        return;
+    }
+
+    // General denominator met: it and every monitored group's denominator
+    // count this drive cycle (the general counter rolls over to 0)
+    denominator_counted = true;
+    iumpr_counters[IUMPR_OBDCOND]++;
+    for(uint8_t g = 0; g < IUMPR_GROUP_COUNT; g++) {
+        iumpr_increment(iumpr_groups[g].comp, iumpr_groups[g].comp + 1);
+    }
+    iumpr_changed();
+}
+
+void iumpr_monitor_complete(uint8_t mid) {
+    for(uint8_t g = 0; g < IUMPR_GROUP_COUNT; g++) {
+        if(iumpr_groups[g].mid != mid) continue;
+
+        if(!numerator_counted[g]) {
+            numerator_counted[g] = true;
+            iumpr_increment(iumpr_groups[g].comp, iumpr_groups[g].comp);
+            iumpr_changed();
+        }
+        return;
+    }
+}
+
+const uint8_t* iumpr_response(uint16_t* len) {
+    *len = IUMPR_RESPONSE_LEN;
+    return iumpr_cache;
+}
@@ -0,0 +1,68 @@
+#ifndef IUMPR_H
+#define IUMPR_H
+
+#include <Arduino.h>
+
+/*
+ * In-Use Monitor Performance Ratio (Mode 09 PID 0x08)
+ *
+ * For each monitor group the ECU counts how often the monitor completed
+ * (numerator) against how often the vehicle was driven in a way that
+ * would let it run (denominator). The counters are maintained by the
+ * simulation as it drives:
+ *
+ * - IGNCNTR counts ignition cycles: one per power-up and one per
+ *   simulated key-off/key-on (sim_state_ignition_cycle()), which also
+ *   starts a new drive cycle.
+ * - OBDCOND (general denominator) counts drive cycles that reached 600 s
+ *   of run time, 300 s at or above 40 km/h and 30 s of continuous idle.
+ * - A group's denominator increments with OBDCOND when the group has a
+ *   monitor; its numerator increments the first time that monitor
+ *   completes in a drive cycle.
+ * - When a numerator or denominator would pass 65535, both are halved,
+ *   keeping the ratio (SAE J1979).
+ *
+ * The Mode 09 response is serialized into a cache whenever a counter
+ * changes, so a PID 0x08 request only copies the cached bytes.
+ */
+
+/*
+ * Counter index, in SAE J1979 response order
+ */
+enum {
+    IUMPR_OBDCOND = 0,        // General denominator
+    IUMPR_IGNCNTR,            // Ignition cycle counter
+    IUMPR_CATCOMP1,  IUMPR_CATCOND1,      // Catalyst bank 1
+    IUMPR_CATCOMP2,  IUMPR_CATCOND2,      // Catalyst bank 2
+    IUMPR_O2SCOMP1,  IUMPR_O2SCOND1,      // O2 sensor bank 1
+    IUMPR_O2SCOMP2,  IUMPR_O2SCOND2,      // O2 sensor bank 2
+    IUMPR_EGRCOMP,   IUMPR_EGRCOND,       // EGR/VVT
+    IUMPR_AIRCOMP,   IUMPR_AIRCOND,       // Secondary air
+    IUMPR_EVAPCOMP,  IUMPR_EVAPCOND,      // EVAP
+    IUMPR_SO2SCOMP1, IUMPR_SO2SCOND1,     // Secondary O2 bank 1
+    IUMPR_SO2SCOMP2, IUMPR_SO2SCOND2,     // Secondary O2 bank 2
+    IUMPR_COUNTER_COUNT
+};
+
+#define IUMPR_RESPONSE_LEN    (2 + IUMPR_COUNTER_COUNT * 2 + 1)  // 49 08, counters, item count
+
+/*
+ * General denominator conditions (100ms ticks)
+ */
+#define IUMPR_RUN_TICKS       6000      // 600 s cumulative run time
+#define IUMPR_SPEED_TICKS     3000      // 300 s cumulative at >= 40 km/h
+#define IUMPR_IDLE_TICKS      300       // 30 s continuous idle
+#define IUMPR_SPEED_KMH       40
+
+extern uint16_t iumpr_counters[IUMPR_COUNTER_COUNT];  // Persisted (nv_store.h)
+
+/*
+ * IUMPR Interface
+ */
+void iumpr_init(void);                  // Start an ignition cycle (after NV restore)
+void iumpr_ignition_cycle(void);        // Next ignition cycle: IGNCNTR, new drive cycle
+void iumpr_update(void);                // Track drive cycle conditions (main loop)
+void iumpr_monitor_complete(uint8_t mid);  // Monitor finished (monitors.cpp)
+const uint8_t* iumpr_response(uint16_t* len);  // Cached Mode 09 PID 08 response
+
+#endif // IUMPR_H
@@ -0,0 +1,235 @@
+/*
+ * SAE J1939 Periodic Broadcasts
+ *
+ * PGN encoders, the broadcast jobs and the BAM transport session.
+ * See j1939.h for the broadcast set and rates.
+ */
+
+#include "j1939.h"
+#include "ecu_sim.h"
+#include "tx_schedule.h"
+#include "memory_map.h"
+#include "sim_clock.h"
+
+extern ecu_t ecu;
+
+typedef struct {
+    uint32_t pgn;
+    uint8_t priority;
+    j1939_encoder_t encode;
+} j1939_pgn_t;
+
+static j1939_pgn_t pgns[J1939_MAX_PGNS];
+static uint16_t pgn_count = 0;
+
+/*
+ * BAM session - one multi-packet broadcast at a time
+ */
+static struct {
+    bool active;
+    uint8_t data[J1939_MAX_DATA];
+    uint8_t len;
+    uint8_t packets;              // TP.DT packets in the message
+    uint8_t next_seq;             // Next TP.DT sequence number (1-based)
+    uint32_t last_packet;         // clock_ms() of the last TP frame
+} bam;
+
+uint32_t j1939_id(uint8_t priority, uint32_t pgn, uint8_t sa) {
+    return ((uint32_t)(priority & 0x07) << 26) | ((pgn & 0x3FFFF) << 8) | sa;
+}
+
+/*
+ * Send one 8-byte frame on every bus carrying J1939
+ */
+static void j1939_send(uint32_t id, const uint8_t* data, uint8_t len) {
+    can_frame_t frame;
+
+    frame.id = id;
+    frame.extended = true;
+    frame.fd = false;
+    frame.len = CAN_MAX_LEN;
+    memset(frame.buf, 0xFF, CAN_MAX_LEN);  // Unused bytes: not available
+    memcpy(frame.buf, data, len);
+
+    for(uint8_t i = 0; i < CAN_BUS_COUNT; i++) {
+        if(!can_bus_config[i].enabled || !(can_bus_config[i].ecu_mask & ECU_J1939)) continue;
+        if(can_channels[i].link.detecting) continue;  // Listen-only
+        can_channels[i].transport->write(frame);
+    }
+}
+
+/*
+ * Standard PGN encoders
+ */
+static uint8_t percent_offset(uint8_t raw) {
+    return (raw * 100 / 255) + 125;  // 1 %/bit, -125 % offset
+}
+
+// EEC1: torque 1 %/bit offset -125 %, engine speed 0.125 rpm/bit
+static uint8_t encode_eec1(uint8_t* data) {
+    uint16_t speed = sim_state.engine_rpm * 2;  // PID 0x0C is rpm x 4
+
+    data[0] = 0xF0 | (sim_state.engine_rpm ? 0x01 : 0x00);  // Torque mode: operator selection
+    data[1] = percent_offset(sim_state.throttle_position);  // Driver's demand torque
+    data[2] = percent_offset(sim_state.engine_load);        // Actual engine torque
+    data[3] = speed & 0xFF;
+    data[4] = speed >> 8;
+    data[5] = J1939_SA_ENGINE;                              // Controlling device
+    data[6] = 0xFF;                                         // Starter mode: n/a
+    data[7] = percent_offset(sim_state.engine_load);        // Engine demand torque
+    return 8;
+}
+
+// CCVS: wheel-based vehicle speed 1/256 km/h per bit
+static uint8_t encode_ccvs(uint8_t* data) {
+    uint16_t speed = sim_state.vehicle_speed << 8;
+
+    memset(data, 0xFF, 8);
+    data[1] = speed & 0xFF;
+    data[2] = speed >> 8;
+    return 8;
+}
+
+// ET1: coolant temperature 1 degC/bit, -40 degC offset (same as PID 0x05)
+static uint8_t encode_et1(uint8_t* data) {
+    memset(data, 0xFF, 8);
+    data[0] = sim_state.coolant_temp;
+    return 8;
+}
+
+/*
+ * DM1: lamp status, then 4 bytes per DTC:
+ * SPN bits 0-15, SPN bits 16-18 + FMI, conversion method + occurrence count.
+ * The DTCs are the J1939 equivalents of the codes Mode 03 reports.
+ */
+typedef struct {
+    uint32_t spn;
+    uint8_t fmi;
+} j1939_dtc_t;
+
+static const j1939_dtc_t dm1_dtcs[] = {
+    { 132, 2 },   // P0100: engine inlet air mass flow, data erratic
+    { 651, 5 },   // P0200: injector cylinder 1, current below normal
+};
+
+static uint8_t encode_dm1(uint8_t* data) {
+    uint8_t len = 0;
+
+    data[len++] = sim_state.mil_on ? 0x40 : 0x00;  // MIL on (01), other lamps off
+    data[len++] = 0xFF;                            // Lamp flash: n/a
+
+    if(!ecu.dtc) {
+        memset(&data[len], 0x00, 4);               // No active DTC
+        data[len + 4] = 0xFF;
+        data[len + 5] = 0xFF;
+        return 8;
+    }
+
+    for(uint8_t i = 0; i < sizeof(dm1_dtcs) / sizeof(dm1_dtcs[0]); i++) {
+        data[len++] = dm1_dtcs[i].spn & 0xFF;
+        data[len++] = (dm1_dtcs[i].spn >> 8) & 0xFF;
+        data[len++] = ((dm1_dtcs[i].spn >> 11) & 0xE0) | (dm1_dtcs[i].fmi & 0x1F);
+        data[len++] = 0x01;                        // CM 0, occurrence count 1
+    }
+    return len;
+}
+
+/*
+ * BAM transport: TP.CM now, TP.DT packets from the BAM job
+ */
+static void j1939_start_bam(uint32_t pgn, const uint8_t* data, uint8_t len) {
+    uint8_t cm[8];
+
+    memcpy(bam.data, data, len);
+    bam.len = len;
+    bam.packets = (len + 6) / 7;
+    bam.next_seq = 1;
+    bam.last_packet = clock_ms();
+    bam.active = true;
+
+    cm[0] = J1939_TP_BAM;
+    cm[1] = len & 0xFF;                 // Message size, bytes
+    cm[2] = 0;
+    cm[3] = bam.packets;
+    cm[4] = 0xFF;
+    cm[5] = pgn & 0xFF;                 // PGN of the packeted message
+    cm[6] = (pgn >> 8) & 0xFF;
+    cm[7] = (pgn >> 16) & 0xFF;
+    j1939_send(j1939_id(J1939_PRIORITY_TP, PGN_TP_CM | J1939_GLOBAL, J1939_SA_ENGINE), cm, 8);
+}
+
+static void j1939_bam_job(uint16_t arg) {
+    if(!bam.active || clock_ms() - bam.last_packet < J1939_BAM_PACKET_MS) {
+        return;
+    }
+
+    uint8_t dt[8];
+    uint8_t offset = (bam.next_seq - 1) * 7;
+    uint8_t count = min((uint8_t)7, (uint8_t)(bam.len - offset));
+
+    memset(dt, 0xFF, sizeof(dt));       // Last packet padded with FF
+    dt[0] = bam.next_seq;
+    memcpy(&dt[1], &bam.data[offset], count);
+    j1939_send(j1939_id(J1939_PRIORITY_TP, PGN_TP_DT | J1939_GLOBAL, J1939_SA_ENGINE), dt, 8);
+
+    bam.last_packet = clock_ms();
+    if(++bam.next_seq > bam.packets) {
+        bam.active = false;
+    }
+}
+
+/*
+ * Broadcast job: encode the PGN and send it, via BAM when longer than 8 bytes
+ */
+static void j1939_pgn_job(uint16_t index) {
+    const j1939_pgn_t* entry = &pgns[index];
+    uint8_t data[J1939_MAX_DATA];
+    uint8_t len = entry->encode(data);
+
+    if(len == 0) {
+        return;
+    }
+    if(len <= CAN_MAX_LEN) {
+        j1939_send(j1939_id(entry->priority, entry->pgn, J1939_SA_ENGINE), data, len);
+    } else if(!bam.active) {
+        j1939_start_bam(entry->pgn, data, len);
+    }
+}
+
+bool j1939_add_pgn(uint32_t pgn, uint8_t priority, uint16_t period_ms, j1939_encoder_t encode) {
+    if(pgn_count >= J1939_MAX_PGNS) {
+        return false;
+    }
+
+    pgns[pgn_count].pgn = pgn;
+    pgns[pgn_count].priority = priority;
+    pgns[pgn_count].encode = encode;
+
+    // Stagger start times so PGNs sharing a period don't go out in one burst
+    if(!tx_schedule_add(period_ms, pgn_count % period_ms, j1939_pgn_job, pgn_count)) {
+        return false;
+    }
+    pgn_count++;
+    return true;
+}
+
+FLASHMEM void j1939_init(void) {
+    bool j1939_bus = false;
+
+    for(uint8_t i = 0; i < CAN_BUS_COUNT; i++) {
+        if(can_bus_config[i].enabled && (can_bus_config[i].ecu_mask & ECU_J1939)) j1939_bus = true;
+    }
+    if(!j1939_bus) {
+        return;  // Passenger car profile - nothing to broadcast
+    }
+
+    bam.active = false;
+
+    // Checks for a pending TP.DT packet at the EEC1 rate
+    tx_schedule_add(10, 0, j1939_bam_job, 0);
+
+    j1939_add_pgn(PGN_EEC1, J1939_PRIORITY_CONTROL, 10, encode_eec1);
+    j1939_add_pgn(PGN_CCVS, J1939_PRIORITY_DEFAULT, 100, encode_ccvs);
+    j1939_add_pgn(PGN_ET1, J1939_PRIORITY_DEFAULT, 1000, encode_et1);
+    j1939_add_pgn(PGN_DM1, J1939_PRIORITY_DEFAULT, 1000, encode_dm1);
+}
@@ -0,0 +1,66 @@
+#ifndef J1939_H
+#define J1939_H
+
+#include <Arduino.h>
+
+/*
+ * SAE J1939 Periodic Broadcasts (Heavy-Duty Profile)
+ *
+ * Trucks and buses do not wait for a scan tool to ask: the engine ECU
+ * broadcasts its parameters as J1939 PGNs at fixed rates. On any bus
+ * whose ecu_mask includes ECU_J1939 (can_bus_config in ecu_sim.cpp) the
+ * simulator broadcasts, from the same sim_state that Mode 01 reports:
+ *
+ *   PGN    Name  Rate     Content
+ *   61444  EEC1  10 ms    Engine speed, driver demand / actual torque
+ *   65265  CCVS  100 ms   Wheel-based vehicle speed
+ *   65262  ET1   1 s      Engine coolant temperature
+ *   65226  DM1   1 s      Lamp status and active DTCs (SPN/FMI)
+ *
+ * Each PGN is a job in the periodic transmit scheduler (tx_schedule.h),
+ * so broadcasts keep their rate regardless of diagnostic traffic. More
+ * PGNs are added with j1939_add_pgn(); up to J1939_MAX_PGNS are supported.
+ *
+ * MULTI-PACKET MESSAGES:
+ * A PGN longer than 8 bytes - DM1 with two or more DTCs - is sent with the
+ * J1939-21 Broadcast Announce Message (BAM): a TP.CM frame announcing
+ * size and packet count, then TP.DT packets J1939_BAM_PACKET_MS apart.
+ * One BAM runs at a time; a long PGN falling due during a BAM waits for
+ * its next period.
+ */
+
+#define J1939_MAX_PGNS        200
+#define J1939_MAX_DATA        64        // Longest PGN payload (9 BAM packets)
+#define J1939_SA_ENGINE       0x00      // Source address: engine #1
+#define J1939_GLOBAL          0xFF      // Destination: all nodes
+
+/*
+ * Parameter Group Numbers
+ */
+#define PGN_EEC1              61444     // 0xF004 Electronic Engine Controller 1
+#define PGN_CCVS              65265     // 0xFEF1 Cruise Control/Vehicle Speed
+#define PGN_ET1               65262     // 0xFEEE Engine Temperature 1
+#define PGN_DM1               65226     // 0xFECA Active Diagnostic Trouble Codes
+#define PGN_TP_CM             60416     // 0xEC00 Transport Protocol - Connection Management
+#define PGN_TP_DT             60160     // 0xEB00 Transport Protocol - Data Transfer
+
+#define J1939_PRIORITY_CONTROL  3       // EEC1
+#define J1939_PRIORITY_DEFAULT  6       // Information PGNs
+#define J1939_PRIORITY_TP       7       // Transport protocol frames
+
+#define J1939_TP_BAM          0x20      // TP.CM control byte: BAM
+#define J1939_BAM_PACKET_MS   50        // Gap between TP.DT packets (50-200 ms)
+
+/*
+ * Payload encoder: writes the PGN data, returns its length (0 = skip)
+ */
+typedef uint8_t (*j1939_encoder_t)(uint8_t* data);
+
+/*
+ * J1939 Interface
+ */
+void j1939_init(void);                  // Schedule the standard PGNs
+bool j1939_add_pgn(uint32_t pgn, uint8_t priority, uint16_t period_ms, j1939_encoder_t encode);
+uint32_t j1939_id(uint8_t priority, uint32_t pgn, uint8_t sa);  // 29-bit CAN ID
+
+#endif // J1939_H
@@ -0,0 +1,56 @@
+/*
+ * Memory Placement (i.MX RT1062)
+ *
+ * Region use measured from the Teensy 4 linker script symbols. See
+ * memory_map.h.
+ */
+
+#include "memory_map.h"
+
+#define MEM_TCM_BLOCK           32768     // ITCM/DTCM split granularity
+#define MEM_TCM_BLOCKS          16        // 512 KB RAM1
+#define MEM_OCRAM_BASE          0x20200000
+#define MEM_OCRAM_SIZE          (512 * 1024)
+#define MEM_FLASH_SIZE          (1984 * 1024)  // Teensy 4.0, less the EEPROM emulation
+
+#ifdef ARDUINO
+// Defined by imxrt1062.ld; only their addresses carry information
+extern unsigned long _stext, _etext;
+extern unsigned long _sdata, _ebss;
+extern unsigned long _heap_start;
+extern unsigned long _flashimagelen;
+extern unsigned long _itcm_block_count;
+#endif
+
+FLASHMEM void mem_report_get(mem_region_t* regions) {
+    memset(regions, 0, MEM_REGIONS * sizeof(mem_region_t));
+#ifdef ARDUINO
+    uint32_t itcm_blocks = (uint32_t)&_itcm_block_count;
+
+    regions[MEM_ITCM].used = (uint32_t)&_etext - (uint32_t)&_stext;
+    regions[MEM_ITCM].size = itcm_blocks * MEM_TCM_BLOCK;
+    regions[MEM_DTCM].used = (uint32_t)&_ebss - (uint32_t)&_sdata;
+    regions[MEM_DTCM].size = (MEM_TCM_BLOCKS - itcm_blocks) * MEM_TCM_BLOCK;
+    regions[MEM_OCRAM].used = (uint32_t)&_heap_start - MEM_OCRAM_BASE;
+    regions[MEM_OCRAM].size = MEM_OCRAM_SIZE;
+    regions[MEM_FLASH].used = (uint32_t)&_flashimagelen;
+    regions[MEM_FLASH].size = MEM_FLASH_SIZE;
+#endif
+}
+
+FLASHMEM void mem_report_print(void) {
+    static const char* const names[MEM_REGIONS] = { "ITCM", "DTCM", "OCRAM", "Flash" };
+    mem_region_t regions[MEM_REGIONS];
+
+    mem_report_get(regions);
+    for(uint8_t i = 0; i < MEM_REGIONS; i++) {
+        Serial.print(names[i]);
+        Serial.print(": ");
+        Serial.print(regions[i].used);
+        Serial.print(" of ");
+        Serial.print(regions[i].size);
+        Serial.print(" bytes, ");
+        Serial.print(regions[i].size - regions[i].used);
+        Serial.println(i == MEM_DTCM ? " free for stack" : " free");
+    }
+}
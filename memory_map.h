@@ -0,0 +1,77 @@
+#ifndef MEMORY_MAP_H
+#define MEMORY_MAP_H
+
+#include <Arduino.h>
+
+/*
+ * Memory Placement (i.MX RT1062)
+ *
+ * The Teensy 4.0 has four places for code and data:
+ *
+ *   Region   Size            Contents by default          Used here for
+ *   ITCM     RAM1, 32 KB     all code, copied from flash  the per-frame path
+ *            blocks
+ *   DTCM     rest of RAM1    variables, const data,       per-frame state
+ *                            stack
+ *   OCRAM    RAM2, 512 KB    malloc heap, DMAMEM          large buffers
+ *   Flash    1984 KB         the image                    init code, tables
+ *
+ * ITCM and DTCM share RAM1, so every 32 KB of code in ITCM is 32 KB less
+ * for variables and stack. Placement follows from that:
+ *
+ * - FASTRUN: receive/dispatch/ISO-TP and the PID encoders. This is where
+ *   the Teensy puts code anyway; the mark keeps it there.
+ * - FLASHMEM: code run once at power-up. It executes from flash through
+ *   the cache and leaves ITCM to the hot path.
+ * - DMAMEM: buffers of a kilobyte or more that are not touched per byte
+ *   on every frame (capture ring, trace and SLCAN queues, ISO-TP
+ *   buffers). OCRAM is cached, and DMAMEM is NOT zeroed at power-up, so
+ *   such buffers are cleared by their init code or are only read after
+ *   being written.
+ * - PROGMEM: constant tables and strings read off the per-frame path
+ *   (Mode 09 identification strings, the DID and monitor tables). On
+ *   Teensy 4 flash is memory-mapped, so they are read directly. Small
+ *   tables read on every frame (ECU addresses, bus config) stay in DTCM.
+ *
+ * MEMORY REPORT:
+ * The Teensy build prints each region's use after linking (teensy_size).
+ * The firmware measures the same regions from the linker's symbols,
+ * prints them at power-up and reports them over the host link
+ * (READ_MEMORY), so the headroom for bigger DTC and trace stores is known
+ * on the running unit.
+ */
+
+// Builds without ARDUINO have no memory regions
+#ifndef FASTRUN
+#define FASTRUN
+#endif
+#ifndef FLASHMEM
+#define FLASHMEM
+#endif
+#ifndef DMAMEM
+#define DMAMEM
+#endif
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+
+enum {
+    MEM_ITCM,
+    MEM_DTCM,
+    MEM_OCRAM,
+    MEM_FLASH,
+    MEM_REGIONS
+};
+
+typedef struct {
+    uint32_t used;                // Bytes placed by the linker
+    uint32_t size;                // Bytes in the region (ITCM/DTCM: as split)
+} mem_region_t;
+
+/*
+ * Memory Report Interface
+ */
+void mem_report_get(mem_region_t* regions);   // MEM_REGIONS entries; zeros on the host
+void mem_report_print(void);                  // One line per region on Serial
+
+#endif // MEMORY_MAP_H
@@ -9,15 +9,38 @@
  * 1. Create modes/mode_XX.cpp
  * 2. Add #include for the .cpp file below
  * 3. The mode will automatically register itself
+ * 4. Give it a SIM_SVC_* bit in vehicle_config.h and guard the include
  *
  * Note: We include .cpp files directly because Arduino IDE
  * requires explicit includes for compilation.
  */
 
+#include "vehicle_config.h"
+
+// Mode 02 and the UDS F4xx DIDs encode through Mode 01's PID encoder
+#if SIM_SERVICES & (SIM_SVC_MODE01 | SIM_SVC_MODE02 | SIM_SVC_UDS)
 #include "modes/mode_01.cpp"  // Current Powertrain Data
+#endif
+#if SIM_SERVICES & SIM_SVC_MODE02
 #include "modes/mode_02.cpp"  // Freeze Frame Data
+#endif
+#if SIM_SERVICES & SIM_SVC_MODE03
 #include "modes/mode_03.cpp"  // Request Emissions DTCs
+#endif
+#if SIM_SERVICES & SIM_SVC_MODE04
 #include "modes/mode_04.cpp"  // Clear Emissions Diagnostic Info
+#endif
+#if SIM_SERVICES & SIM_SVC_MODE06
+#include "modes/mode_06.cpp"  // On-Board Monitoring Test Results
+#endif
+#if SIM_SERVICES & SIM_SVC_MODE08
+#include "modes/mode_08.cpp"  // On-Board System Control
+#endif
+#if SIM_SERVICES & SIM_SVC_MODE09
 #include "modes/mode_09.cpp"  // Vehicle Information
+#endif
+#if SIM_SERVICES & SIM_SVC_UDS
+#include "modes/uds_services.cpp"  // UDS 0x10, 0x22, 0x3E, 0x87
+#endif
 
 #endif // MODE_INCLUDES_H
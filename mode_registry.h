@@ -4,6 +4,8 @@
 #include <Arduino.h>
 #include <FlexCAN_T4.h>
 #include "ecu_sim.h"
+#include "uds.h"
+#include "wcet.h"
 
 /*
  * OBD-II Mode Handler Registry System
@@ -16,12 +18,19 @@
  * 3. Add to mode_includes.h
  *
  * The mode will automatically be available in the ECU simulator.
+ *
+ * NEGATIVE RESPONSE FAST PATH:
+ * A mode may register a supported-PID function next to its handler. The
+ * registry answers a request for a PID the function rejects, and a request
+ * for a service no mode registered, itself: a 7F negative response sent at
+ * once (or nothing, per the NRC policy and the request's addressing - see
+ * ecu_simClass::send_negative_response), without running a handler. Scan
+ * tools probing for support no longer wait out P2 on every miss.
  */
 
 // Forward declarations
 extern ecu_t ecu;
-extern freeze_frame_t freeze_frame[2];
-extern isotp_transfer_t isotp_tx;
+extern freeze_frame_t freeze_frame[MAX_FREEZE_FRAMES];
 
 /*
  * Mode Handler Function Signature
@@ -37,6 +46,30 @@ extern isotp_transfer_t isotp_tx;
  */
 typedef bool (*ModeHandler)(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simClass* ecu_sim);
 
+/*
+ * Supported-PID Function Signature
+ *
+ * Returns true if the mode answers requests for this PID (or TID, MID,
+ * InfoType), false to have the registry send subFunctionNotSupported.
+ */
+typedef bool (*ModeSupports)(uint8_t pid);
+
+/*
+ * PID in a run of 4-byte supported-PID bitmaps (the answers to PIDs 0x00,
+ * 0x20, ...; bit 7 of the first byte is PID 0x01). PID 0x00 is always
+ * supported; PIDs past the last bitmap are not.
+ */
+static inline bool pid_bitmap_supports(const uint8_t* bitmaps, uint8_t ranges, uint8_t pid) {
+    if (pid == 0) {
+        return true;
+    }
+    uint8_t index = (pid - 1) / 8;
+    if (index >= ranges * 4) {
+        return false;
+    }
+    return (bitmaps[index] & (0x80 >> ((pid - 1) % 8))) != 0;
+}
+
 /*
  * Mode Registration Structure
  * Holds information about a registered OBD mode
@@ -45,6 +78,7 @@ struct ModeRegistration {
     uint8_t mode_id;           // OBD mode number (e.g., 0x01, 0x09)
     ModeHandler handler;        // Function to call for this mode
     const char* name;          // Human-readable mode name
+    ModeSupports supports;     // Supported-PID check, NULL = handler decides
 };
 
 /*
@@ -53,7 +87,8 @@ struct ModeRegistration {
  */
 class ModeRegistry {
 private:
-    static const uint8_t MAX_MODES = 16;  // Support up to 16 modes
+    // Sized for the handlers the vehicle configuration builds in
+    static const uint8_t MAX_MODES = SIM_HANDLER_COUNT ? SIM_HANDLER_COUNT : 1;
     static ModeRegistration modes[MAX_MODES];
     static uint8_t mode_count;
 
@@ -62,7 +97,8 @@ public:
      * Register a new mode handler
      * Called automatically by mode implementation files
      */
-    static bool register_mode(uint8_t mode_id, ModeHandler handler, const char* name) {
+    static bool register_mode(uint8_t mode_id, ModeHandler handler, const char* name,
+                              ModeSupports supports = NULL) {
         if (mode_count >= MAX_MODES) {
             return false;  // Registry full
         }
@@ -70,6 +106,7 @@ public:
         modes[mode_count].mode_id = mode_id;
         modes[mode_count].handler = handler;
         modes[mode_count].name = name;
+        modes[mode_count].supports = supports;
         mode_count++;
 
         return true;
@@ -77,17 +114,27 @@ public:
 
     /*
      * Dispatch incoming OBD request to appropriate mode handler
-     * Returns true if a mode handled the request
+     * Returns true if a mode handled the request. Unsupported PIDs and
+     * unknown services get their negative response here.
      */
     static bool dispatch(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simClass* ecu_sim) {
         uint8_t requested_mode = can_MsgRx.buf[1];
 
         for (uint8_t i = 0; i < mode_count; i++) {
             if (modes[i].mode_id == requested_mode) {
+                if (modes[i].supports != NULL && can_MsgRx.buf[0] >= 2 &&
+                    !modes[i].supports(can_MsgRx.buf[2])) {
+                    ecu_sim->send_negative_response(requested_mode, NRC_SUBFUNCTION_NOT_SUPPORTED);
+                    return true;
+                }
+                WCET_PROBE(WCET_HANDLER + i);
                 return modes[i].handler(can_MsgRx, can_MsgTx, ecu_sim);
             }
         }
 
+        if ((can_MsgRx.buf[0] & 0x0F) != 0) {  // Not an empty frame
+            ecu_sim->send_negative_response(requested_mode, NRC_SERVICE_NOT_SUPPORTED);
+        }
         return false;  // No handler found for this mode
     }
 
@@ -98,6 +145,13 @@ public:
         return mode_count;
     }
 
+    /*
+     * Service of registered handler n (0 if none)
+     */
+    static uint8_t get_mode_id(uint8_t n) {
+        return n < mode_count ? modes[n].mode_id : 0;
+    }
+
     /*
      * Print registered modes (for debugging)
      */
@@ -117,11 +171,12 @@ public:
  * Helper class for automatic mode registration
  * Usage in mode files:
  *   static ModeRegistrar registrar(0x01, handle_mode_01, "Current Data");
+ *   static ModeRegistrar registrar(0x01, handle_mode_01, "Current Data", mode_01_supports);
  */
 class ModeRegistrar {
 public:
-    ModeRegistrar(uint8_t mode_id, ModeHandler handler, const char* name) {
-        ModeRegistry::register_mode(mode_id, handler, name);
+    ModeRegistrar(uint8_t mode_id, ModeHandler handler, const char* name, ModeSupports supports = NULL) {
+        ModeRegistry::register_mode(mode_id, handler, name, supports);
     }
 };
 
@@ -10,7 +10,8 @@
  * FREEZE FRAME OVERVIEW:
  * When an emissions-related fault occurs (e.g., misfire, sensor malfunction),
  * the ECU captures a snapshot of all relevant sensor data at that exact moment.
- * This includes:
+ * This simulator snapshots the complete Mode 01 state, so every Mode 01 PID
+ * (except monitor status PIDs 0x01 and 0x41) is available, including:
  * - Engine RPM and vehicle speed
  * - Engine coolant temperature
  * - Throttle position
@@ -28,14 +29,12 @@
  */
 
 #include "../mode_registry.h"
+#include "../sim_state.h"
 #include <FlexCAN_T4.h>
 
-// External CAN bus instance
-extern FlexCAN_T4<CAN1, RX_SIZE_256, TX_SIZE_16> can1;
-
 // External ECU data structures
 extern ecu_t ecu;
-extern freeze_frame_t freeze_frame[2];
+extern freeze_frame_t freeze_frame[MAX_FREEZE_FRAMES];
 
 /*
  * Mode 02 Handler - Freeze Frame Data
@@ -57,11 +56,18 @@ extern freeze_frame_t freeze_frame[2];
  *   buf[3+] = Data bytes (from freeze frame storage)
  *
  * Frame Numbers:
- *   0x00 = Freeze frame for first DTC
- *   0x01 = Freeze frame for second DTC
+ *   0x00 = Oldest stored freeze frame
+ *   0x01 = Next freeze frame
  *   etc.
  *
- * This implementation supports 2 freeze frames corresponding to 2 DTCs.
+ * This implementation stores up to MAX_FREEZE_FRAMES frames, one per DTC.
+ * PID 0x02 returns the DTC that caused the frame; all other PIDs are
+ * encoded from the snapshot by the Mode 01 encoder.
+ *
+ * Without a stored frame, PID 0x02 reports DTC 0000 (no freeze frame) and
+ * other PIDs get requestOutOfRange. A PID the snapshot cannot encode gets
+ * subFunctionNotSupported. Both stay silent on functional requests per
+ * nrc_policy, like the registry's own unsupported-PID check.
  */
 bool handle_mode_02(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simClass* ecu_sim) {
     // Check if this is a Mode 02 request
@@ -77,101 +83,84 @@ bool handle_mode_02(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
     // Extract frame number from request
     // Standard OBD-II: buf[2]=PID, buf[3]=Frame (optional, defaults to 0x00)
     // Check buf[0] for actual data length, or use buf[3] if provided
+    uint8_t pid = can_MsgRx.buf[2];
     uint8_t frame_num = (can_MsgRx.buf[0] >= 3) ? can_MsgRx.buf[3] : 0x00;
 
     // Validate frame number and check if freeze frame data exists
-    // Support frame 0 and 1 (we have 2 DTCs with freeze frames)
-    if (frame_num <= 1 && freeze_frame[frame_num].data_stored) {
-        // Freeze frame data is available for this frame
-        // Use stored freeze frame data, NOT current sensor values
-        // This is critical - freeze frames are historical snapshots
-
-        switch(can_MsgRx.buf[2])  // PID is in buf[2]
-        {
-            case PID_SUPPORTED:  // 0x00 - Supported PIDs in freeze frames
-                // Return same supported PIDs as Mode 1
-                can_MsgTx.buf[0] = 0x06;
-                can_MsgTx.buf[2] = PID_SUPPORTED;
-                can_MsgTx.buf[3] = 0xE8;  // Same PIDs as Mode 1
-                can_MsgTx.buf[4] = 0x19;
-                can_MsgTx.buf[5] = 0x30;
-                can_MsgTx.buf[6] = 0x12;
-                can1.write(can_MsgTx);
-                break;
-
-            case ENGINE_RPM:  // 0x0C - Engine RPM at time of DTC
-                // Format: 2 bytes, formula = (A*256 + B) / 4
-                can_MsgTx.buf[0] = 0x04;
-                can_MsgTx.buf[2] = ENGINE_RPM;
-                can_MsgTx.buf[3] = (freeze_frame[frame_num].engine_rpm & 0xff00) >> 8;
-                can_MsgTx.buf[4] = freeze_frame[frame_num].engine_rpm & 0x00ff;
-                can1.write(can_MsgTx);
-                break;
+    freeze_frame_t* frame = ecu_sim->freeze_frame_get(frame_num);
+    if (frame == NULL) {
+        // No freeze frame data stored for this frame number
+        // Either frame number is out of range or no DTC has been set
+        if (pid != FREEZE_FRAME_DTC) {
+            ecu_sim->send_negative_response(MODE2, NRC_REQUEST_OUT_OF_RANGE);
+            return true;
+        }
+        can_MsgTx.buf[0] = 0x04;  // DTC 0000: no freeze frame stored
+        can_MsgTx.buf[2] = pid;
+        memset(&can_MsgTx.buf[3], 0, 5);
+        ecu_sim->send(can_MsgTx);
+        return true;
+    }
 
-            case ENGINE_COOLANT_TEMP:  // 0x05 - Coolant temperature at time of DTC
-                // Format: 1 byte, formula = A - 40 (degrees Celsius)
-                can_MsgTx.buf[0] = 0x03;
-                can_MsgTx.buf[2] = ENGINE_COOLANT_TEMP;
-                can_MsgTx.buf[3] = freeze_frame[frame_num].coolant_temp;
-                can1.write(can_MsgTx);
-                break;
+    // Use stored freeze frame data, NOT current sensor values
+    // This is critical - freeze frames are historical snapshots
+    can_MsgTx.buf[2] = pid;
+    uint8_t data_len = 0;
 
-            case VEHICLE_SPEED:  // 0x0D - Vehicle speed at time of DTC
-                // Format: 1 byte, formula = A (km/h)
-                can_MsgTx.buf[0] = 0x03;
-                can_MsgTx.buf[2] = VEHICLE_SPEED;
-                can_MsgTx.buf[3] = freeze_frame[frame_num].vehicle_speed;
-                can1.write(can_MsgTx);
-                break;
+    switch(pid)
+    {
+        case FREEZE_FRAME_DTC:  // 0x02 - DTC that caused the freeze frame
+            // Format: 2 bytes, same encoding as Mode 03
+            can_MsgTx.buf[3] = (frame->dtc_code >> 8) & 0xFF;
+            can_MsgTx.buf[4] = frame->dtc_code & 0xFF;
+            data_len = 2;
+            break;
+
+        case MONITOR_STATUS:      // 0x01 - Not valid in freeze frames
+        case MONITOR_STATUS_CYC:  // 0x41 - Not valid in freeze frames
+            break;
+
+        default:
+            // Every other PID is encoded exactly as Mode 01 would have
+            // reported it at the moment the DTC was set
+            data_len = mode01_encode_pid(&frame->snapshot, pid, &can_MsgTx.buf[3]);
+            if (pid == PID_SUPPORTED && data_len > 0) {
+                can_MsgTx.buf[3] = (can_MsgTx.buf[3] & ~0x80) | 0x40;  // PID 01 -> PID 02
+            } else if (pid == PID_40_SUPPORTED && data_len > 0) {
+                can_MsgTx.buf[3] &= ~0x80;  // No PID 41
+            }
+            break;
+    }
 
-            case MAF_SENSOR:  // 0x10 - Mass airflow at time of DTC
-                // Format: 2 bytes, formula = (A*256 + B) / 100 (grams/sec)
-                can_MsgTx.buf[0] = 0x04;
-                can_MsgTx.buf[2] = MAF_SENSOR;
-                can_MsgTx.buf[3] = (freeze_frame[frame_num].maf_airflow & 0xff00) >> 8;
-                can_MsgTx.buf[4] = freeze_frame[frame_num].maf_airflow & 0x00ff;
-                can1.write(can_MsgTx);
-                break;
+    if (data_len == 0) {
+        // PID not supported in freeze frames; normally answered by the
+        // registry (mode_02_supports), this covers what the bitmaps miss
+        ecu_sim->send_negative_response(MODE2, NRC_SUBFUNCTION_NOT_SUPPORTED);
+        return true;
+    }
 
-            case O2_VOLTAGE:  // 0x14 - O2 sensor voltage at time of DTC
-                // Format: 2 bytes
-                // A = voltage (0-255), formula = A * 0.005 volts
-                // B = short term fuel trim (not used here, 0xFF = N/A)
-                can_MsgTx.buf[0] = 0x04;
-                can_MsgTx.buf[2] = O2_VOLTAGE;
-                can_MsgTx.buf[3] = freeze_frame[frame_num].o2_voltage & 0x00ff;
-                can_MsgTx.buf[4] = (freeze_frame[frame_num].o2_voltage & 0xff00) >> 8;
-                can1.write(can_MsgTx);
-                break;
+    can_MsgTx.buf[0] = 2 + data_len;
+    ecu_sim->send(can_MsgTx);
 
-            case THROTTLE:  // 0x11 - Throttle position at time of DTC
-                // Format: 1 byte, formula = A * 100 / 255 (percent)
-                can_MsgTx.buf[0] = 0x03;
-                can_MsgTx.buf[2] = THROTTLE;
-                can_MsgTx.buf[3] = freeze_frame[frame_num].throttle_position;
-                can1.write(can_MsgTx);
-                break;
+    return true;  // Mode 02 handled the request
+}
 
-            default:
-                // PID not supported in freeze frames
-                // Return empty response
-                can_MsgTx.buf[0] = 0x00;
-                can1.write(can_MsgTx);
-                break;
-        }
+/*
+ * Mode 02 Supported PIDs
+ *
+ * The Mode 01 set, with PID 02 (the DTC that caused the frame) in place
+ * of the monitor status PIDs 01 and 41.
+ */
+static bool mode_02_supports(uint8_t pid) {
+    if (pid == FREEZE_FRAME_DTC) {
+        return true;
     }
-    else
-    {
-        // No freeze frame data stored for this frame number
-        // Either frame number is out of range or no DTC has been set
-        // Return empty response per OBD-II standard
-        can_MsgTx.buf[0] = 0x00;  // No data available
-        can1.write(can_MsgTx);
+    if (pid == MONITOR_STATUS || pid == MONITOR_STATUS_CYC) {
+        return false;
     }
-
-    return true;  // Mode 02 handled the request
+    return mode_01_supports(pid);
 }
 
 // Register Mode 02 handler at compile time
 // This automatic registration makes the mode available to the ECU simulator
-static ModeRegistrar mode_02_registrar(MODE2, handle_mode_02, "Freeze Frame Data");
+static ModeRegistrar mode_02_registrar(MODE2, handle_mode_02, "Freeze Frame Data", mode_02_supports);
@@ -29,12 +29,9 @@
 #include "../mode_registry.h"
 #include <FlexCAN_T4.h>
 
-// External CAN bus instance
-extern FlexCAN_T4<CAN1, RX_SIZE_256, TX_SIZE_16> can1;
-
 // External ECU data structures
 extern ecu_t ecu;
-extern freeze_frame_t freeze_frame[2];
+extern freeze_frame_t freeze_frame[MAX_FREEZE_FRAMES];
 
 /*
  * Mode 03 Handler - Request Emissions-Related Trouble Codes
@@ -79,7 +76,7 @@ bool handle_mode_03(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
     // Send response on standard OBD-II reply channel
     can_MsgTx.id = PID_REPLY;  // 0x7E8 - Engine ECU response
     can_MsgTx.len = 8;
-    can1.write(can_MsgTx);
+    ecu_sim->send(can_MsgTx);
 
     return true;  // Mode 03 request handled successfully
 }
@@ -16,14 +16,13 @@
  */
 
 #include "../mode_registry.h"
+#include "../monitors.h"
+#include "../nv_store.h"
 #include <FlexCAN_T4.h>
 
-// External CAN bus instance
-extern FlexCAN_T4<CAN1, RX_SIZE_256, TX_SIZE_16> can1;
-
 // External ECU data structures
 extern ecu_t ecu;
-extern freeze_frame_t freeze_frame[2];
+extern freeze_frame_t freeze_frame[MAX_FREEZE_FRAMES];
 
 /*
  * Mode 04 Handler - Clear Diagnostic Information
@@ -52,8 +51,16 @@ bool handle_mode_04(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
 
     // Clear freeze frame data for all stored frames
     // Freeze frames capture the vehicle's operating conditions when a DTC was set
-    freeze_frame[0].data_stored = false;
-    freeze_frame[1].data_stored = false;
+    ecu_sim->freeze_frame_clear();
+
+    // Clear monitor test results (Mode 06) and reset readiness to "not complete"
+    monitors_clear();
+
+    // Reset distance, time and warm-ups since clear (PIDs 0x21, 0x30, 0x31, 0x4D, 0x4E)
+    sim_counters_clear();
+
+    // Persist the cleared state; written from the main loop, not here
+    nv_mark_dirty(true);
 
     // Prepare positive response to Mode 04 request
     // Per SAE J1979, the response has no additional data beyond the mode echo
@@ -69,7 +76,7 @@ bool handle_mode_04(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
     can_MsgTx.len = 8;
 
     // Send the response
-    can1.write(can_MsgTx);
+    ecu_sim->send(can_MsgTx);
 
     return true;  // Mode 04 handled the request
 }
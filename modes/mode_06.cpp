@@ -0,0 +1,134 @@
+/*
+ * OBD-II Mode 06 - On-Board Monitoring Test Results
+ *
+ * EMISSIONS MONITORING PURPOSE:
+ * Mode 06 exposes the actual test values and limits of the non-continuous
+ * emissions monitors (catalyst, O2 sensors, EGR, EVAP). Where readiness
+ * (PID 0x01) only says whether a monitor has run, Mode 06 shows how close
+ * each result came to its failure threshold. Inspection stations and
+ * technicians use it to spot components that are about to fail.
+ *
+ * DATA ORGANIZATION (ISO 15765-4 / CAN format):
+ * - OBDMID: On-Board Diagnostic Monitor ID (which monitor, e.g. 0x21 = Catalyst B1)
+ * - TID:    Test ID within the monitor
+ * - UASID:  Unit and Scaling ID, tells the tester how to scale the values
+ * - Value, minimum limit, maximum limit: 2 bytes each
+ *
+ * Results are produced by the monitor engine (monitors.cpp), which
+ * serializes them into response tables when a test completes. This
+ * handler only copies precomputed bytes.
+ */
+
+#include "../mode_registry.h"
+#include "../monitors.h"
+#include <FlexCAN_T4.h>
+
+/*
+ * Mode 06 Handler - On-Board Monitoring Test Results
+ *
+ * Request Format:
+ *   buf[0]  = Number of data bytes
+ *   buf[1]  = MODE6 (0x06)
+ *   buf[2+] = OBDMID(s)
+ *
+ * Supported-MID request (MID 0x00, 0x20, ... 0xE0), up to 6 per request:
+ *   Response: 46 [MID] [A] [B] [C] [D] ...
+ *
+ * Test result request (single MID):
+ *   Response: 46 [MID TID UASID VAL_H VAL_L MIN_H MIN_L MAX_H MAX_L] x TIDs
+ *
+ * Responses longer than 7 bytes are sent with ISO-TP multi-frame.
+ *
+ * Every requested MID is checked. A bad MID count gets incorrectLength,
+ * an unsupported MID (or a test MID mixed into a range request) gets
+ * subFunctionNotSupported, which nrc_policy keeps silent on functional
+ * requests like the registry's own check of the first MID.
+ */
+bool handle_mode_06(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simClass* ecu_sim) {
+    // Check if this is a Mode 06 request
+    if (can_MsgRx.buf[1] != MODE6) {
+        return false;  // Not our mode, let other handlers try
+    }
+
+    uint8_t mid_count = can_MsgRx.buf[0] - 1;
+    if (mid_count < 1 || mid_count > 6) {
+        ecu_sim->send_negative_response(MODE6, NRC_INCORRECT_LENGTH);
+        return true;
+    }
+
+    uint8_t response[64];
+    uint8_t len = 0;
+    response[len++] = MODE6_RESPONSE;
+
+    if ((can_MsgRx.buf[2] & 0x1F) == 0) {
+        // Supported-MID bitmap request, every MID must be a range MID
+        for (uint8_t i = 0; i < mid_count; i++) {
+            uint8_t mid = can_MsgRx.buf[2 + i];
+            if (!monitors_supported(mid, &response[len + 1])) {
+                // Mixed request - not allowed
+                ecu_sim->send_negative_response(MODE6, NRC_SUBFUNCTION_NOT_SUPPORTED);
+                return true;
+            }
+            response[len] = mid;
+            len += 5;
+        }
+    } else {
+        // Test results for a single monitor
+        uint8_t records_len = 0;
+        for (uint8_t i = 1; i < mid_count; i++) {
+            if (monitors_response(can_MsgRx.buf[2 + i], &records_len) == NULL) {
+                ecu_sim->send_negative_response(MODE6, NRC_SUBFUNCTION_NOT_SUPPORTED);
+                return true;
+            }
+        }
+        if (mid_count != 1) {
+            // Only one test MID per request
+            ecu_sim->send_negative_response(MODE6, NRC_INCORRECT_LENGTH);
+            return true;
+        }
+        const uint8_t* records = monitors_response(can_MsgRx.buf[2], &records_len);
+        if (records == NULL) {
+            // Unsupported MIDs are normally answered by the registry
+            // (mode_06_supports); this covers a stale table
+            ecu_sim->send_negative_response(MODE6, NRC_SUBFUNCTION_NOT_SUPPORTED);
+            return true;
+        }
+        memcpy(&response[len], records, records_len);
+        len += records_len;
+    }
+
+    if (len <= 7) {
+        // Fits in a single frame
+        can_MsgTx.id = PID_REPLY_ENGINE;
+        can_MsgTx.len = 8;
+        can_MsgTx.buf[0] = len;
+        for (uint8_t i = 0; i < 7; i++) {
+            can_MsgTx.buf[i + 1] = (i < len) ? response[i] : 0x00;
+        }
+        ecu_sim->send(can_MsgTx);
+    } else if (!ecu_sim->isotp_busy()) {
+        // Multi-frame response via ISO-TP
+        ecu_sim->isotp_init_transfer(response, len, PID_REPLY_ENGINE, MODE6, can_MsgRx.buf[2]);
+        ecu_sim->isotp_send_first_frame();
+    } else {
+        // Transfer in progress - send when it completes
+        ecu_sim->isotp_queue_transfer(response, len, PID_REPLY_ENGINE, MODE6, can_MsgRx.buf[2]);
+    }
+
+    return true;  // Mode 06 handled the request
+}
+
+/*
+ * Mode 06 Supported MIDs
+ *
+ * Range MIDs (0x00, 0x20, ...) and every MID the monitor engine runs.
+ * The registry checks only the first MID of a request; the handler checks
+ * the rest against the same tables.
+ */
+static bool mode_06_supports(uint8_t mid) {
+    uint8_t len;
+    return (mid & 0x1F) == 0 || monitors_response(mid, &len) != NULL;
+}
+
+// Register Mode 06 handler at compile time
+static ModeRegistrar mode_06_registrar(MODE6, handle_mode_06, "On-Board Monitoring Test Results", mode_06_supports);
@@ -0,0 +1,102 @@
+/*
+ * OBD-II Mode 08 - Request Control of On-Board System, Test or Component
+ *
+ * EMISSIONS MONITORING PURPOSE:
+ * Mode 08 lets a tester command an on-board test, most commonly the EVAP
+ * system leak test. Inspection equipment uses it to verify the evaporative
+ * system without waiting for the vehicle to run the monitor on its own.
+ *
+ * ASYNCHRONOUS EXECUTION:
+ * A leak test takes many seconds. The handler only starts the test and
+ * reports its status; the test runs as a background state machine
+ * (onboard_test.cpp) advanced from the main loop, so Mode 01 and other
+ * requests keep being answered at full rate while it runs.
+ *
+ * When the test completes, its result is recorded by the monitor engine:
+ * Mode 06 MID 0x3C shows the measured pressure decay and the EVAP
+ * readiness bits in PID 0x01/0x41 report the monitor complete.
+ */
+
+#include "../mode_registry.h"
+#include "../onboard_test.h"
+#include <FlexCAN_T4.h>
+
+/*
+ * Mode 08 Handler - On-Board System Control
+ *
+ * Request Format:
+ *   buf[0]  = Number of data bytes (0x07)
+ *   buf[1]  = MODE8 (0x08)
+ *   buf[2]  = TID
+ *   buf[3-7] = Test data (0x00 for TID 0x01)
+ *
+ * Supported TIDs:
+ *   0x00 - Supported TIDs
+ *   0x01 - Start EVAP leak test (reports status if already running)
+ *   0x81 - EVAP leak test status (poll only, never starts a test)
+ *
+ * Response Format:
+ *   48 [TID] [STATUS] [PROGRESS %] 00 00 00
+ *   STATUS: 00=not run, 01=running, 02=passed, 03=failed, 04=aborted
+ */
+bool handle_mode_08(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simClass* ecu_sim) {
+    // Check if this is a Mode 08 request
+    if (can_MsgRx.buf[1] != MODE8) {
+        return false;  // Not our mode, let other handlers try
+    }
+
+    uint8_t tid = can_MsgRx.buf[2];
+    uint8_t progress = 0;
+
+    can_MsgTx.id = PID_REPLY_ENGINE;
+    can_MsgTx.len = 8;
+    can_MsgTx.buf[0] = 0x07;              // Length: 7 bytes
+    can_MsgTx.buf[1] = MODE8_RESPONSE;    // Mode 08 response (0x48)
+    can_MsgTx.buf[2] = tid;
+    can_MsgTx.buf[3] = 0x00;
+    can_MsgTx.buf[4] = 0x00;
+    can_MsgTx.buf[5] = 0x00;
+    can_MsgTx.buf[6] = 0x00;
+    can_MsgTx.buf[7] = 0x00;
+
+    switch (tid)
+    {
+        case TID_SUPPORTED:  // 0x00 - Supported TIDs [01-20]
+            can_MsgTx.buf[0] = 0x06;
+            can_MsgTx.buf[3] = 0x80;  // TID 01 (EVAP leak test)
+            break;
+
+        case TID_EVAP_LEAK_TEST:  // 0x01 - Start EVAP leak test
+            if (!onboard_test_start_evap()) {
+                // Safety interlock: vehicle must be stationary
+                ecu_sim->send_negative_response(MODE8, NRC_CONDITIONS_NOT_CORRECT);
+                return true;
+            }
+            can_MsgTx.buf[3] = onboard_test_evap_status(&progress);
+            can_MsgTx.buf[4] = progress;
+            break;
+
+        case TID_EVAP_TEST_STATUS:  // 0x81 - Poll EVAP leak test status
+            can_MsgTx.buf[3] = onboard_test_evap_status(&progress);
+            can_MsgTx.buf[4] = progress;
+            break;
+
+        default:
+            // Unsupported TIDs are answered by the registry (mode_08_supports)
+            return true;
+    }
+
+    ecu_sim->send(can_MsgTx);
+
+    return true;  // Mode 08 handled the request
+}
+
+/*
+ * Mode 08 Supported TIDs
+ */
+static bool mode_08_supports(uint8_t tid) {
+    return tid == TID_SUPPORTED || tid == TID_EVAP_LEAK_TEST || tid == TID_EVAP_TEST_STATUS;
+}
+
+// Register Mode 08 handler at compile time
+static ModeRegistrar mode_08_registrar(MODE8, handle_mode_08, "On-Board System Control", mode_08_supports);
@@ -74,15 +74,25 @@
  */
 
 #include "../mode_registry.h"
+#include "../iumpr.h"
+#include "../memory_map.h"
 #include <FlexCAN_T4.h>
 
-// External CAN bus instance
-extern FlexCAN_T4<CAN1, RX_SIZE_256, TX_SIZE_16> can1;
-
 // External ECU data structures (required for Mode 09)
 extern ecu_t ecu;
-extern freeze_frame_t freeze_frame[2];
-extern isotp_transfer_t isotp_tx;
+extern freeze_frame_t freeze_frame[MAX_FREEZE_FRAMES];
+
+// Identification strings, kept in flash
+static const char mode_09_vin[] PROGMEM = "4JGDA5HB7JB158144";
+static const char mode_09_cal_id_ecm[] PROGMEM = "2769011200190170";
+static const char mode_09_cal_id_tcm[] PROGMEM = "00090237271900001";
+static const char mode_09_cal_id_fpcm[] PROGMEM = "00090121001900560";
+static const char mode_09_ecu_name_ecm[] PROGMEM = "EngineControl";
+static const char mode_09_ecu_name_tcm[] PROGMEM = "TransmisCtrl";
+static const char mode_09_ecu_name_fpcm[] PROGMEM = "FuelPumpCtrl";
+
+// ECM supported InfoTypes: 0x02, 0x04, 0x06, 0x08, 0x0A, 0x14
+static const uint8_t mode_09_supported_ecm[4] = { 0x55, 0x40, 0x10, 0x00 };
 
 /*
  * Mode 09 Handler - Vehicle Information
@@ -135,15 +145,12 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
             can_MsgTx.id = PID_REPLY_ENGINE;
             can_MsgTx.buf[0] = 0x06;  // Single frame, 6 bytes
             can_MsgTx.buf[2] = VEH_INFO_SUPPORTED;
-            can_MsgTx.buf[3] = 0x55;  // Supports: 0x02, 0x04, 0x06, 0x08, 0x0A, 0x14
-            can_MsgTx.buf[4] = 0x40;  // Bit 6 set
-            can_MsgTx.buf[5] = 0x10;  // Bit 4 set
-            can_MsgTx.buf[6] = 0x00;
+            memcpy(&can_MsgTx.buf[3], mode_09_supported_ecm, 4);
             can_MsgTx.buf[7] = 0x00;  // Padding
-            can1.write(can_MsgTx);
+            ecu_sim->send(can_MsgTx);
 
-            // Small delay between ECU responses (realistic timing)
-            delay(5);
+            // Each ECU answers after its own response time
+            // (response_timing.h), so the frames need no spacing here
 
             // TCM - Transmission Control Module response (0x7E9)
             can_MsgTx.id = PID_REPLY_TRANS;
@@ -154,9 +161,7 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
             can_MsgTx.buf[5] = 0x00;
             can_MsgTx.buf[6] = 0x00;
             can_MsgTx.buf[7] = 0x00;  // Padding
-            can1.write(can_MsgTx);
-
-            delay(5);
+            ecu_sim->send(can_MsgTx);
 
             // FPCM - Fuel Pump Control Module response (0x7EB)
             can_MsgTx.id = PID_REPLY_CHASSIS;
@@ -167,7 +172,7 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
             can_MsgTx.buf[5] = 0x00;
             can_MsgTx.buf[6] = 0x00;
             can_MsgTx.buf[7] = 0x00;  // Padding
-            can1.write(can_MsgTx);
+            ecu_sim->send(can_MsgTx);
             break;
 
         case VIN_REQUEST:  // 0x02 - Vehicle Identification Number
@@ -201,13 +206,13 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
                     vin_data[0] = MODE9_RESPONSE;
                     vin_data[1] = VIN_REQUEST;
                     vin_data[2] = 0x01;  // 1 data item
-                    const char* vin = "4JGDA5HB7JB158144";
+                    const char* vin = mode_09_vin;
                     for(int i = 0; i < 17; i++) {
                         vin_data[i+3] = vin[i];
                     }
 
                     // Only send first ECU if no transfer in progress
-                    if(isotp_tx.state == ISOTP_IDLE) {
+                    if(!ecu_sim->isotp_busy()) {
                         // ECM response
                         ecu_sim->isotp_init_transfer(vin_data, 20, PID_REPLY_ENGINE, MODE9, VIN_REQUEST);
                         ecu_sim->isotp_send_first_frame();
@@ -216,13 +221,13 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
                 }
 
                 // Single ECU targeted request
-                if(isotp_tx.state != ISOTP_IDLE) break;
+                if(ecu_sim->isotp_busy()) break;
 
                 uint8_t vin_data[20];  // 3 header + 17 VIN
                 vin_data[0] = MODE9_RESPONSE;
                 vin_data[1] = VIN_REQUEST;
                 vin_data[2] = 0x01;  // 1 data item
-                const char* vin = "4JGDA5HB7JB158144";
+                const char* vin = mode_09_vin;
                 for(int i = 0; i < 17; i++) {
                     vin_data[i+3] = vin[i];
                 }
@@ -254,30 +259,30 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
             {
                 // Check which ECU should respond based on request ID
                 uint16_t response_id = PID_REPLY_ENGINE;  // Default
-                const char* cal_id = "2769011200190170";  // ECM default
+                const char* cal_id = mode_09_cal_id_ecm;  // ECM default
                 uint8_t cal_len = 16;
 
                 // Determine target ECU from request
                 if (can_MsgRx.id == PID_REQUEST_TRANS) {
                     response_id = PID_REPLY_TRANS;
-                    cal_id = "00090237271900001";  // TCM calibration ID
+                    cal_id = mode_09_cal_id_tcm;  // TCM calibration ID
                     cal_len = 17;
                 } else if (can_MsgRx.id == 0x7E3) {  // Request to FPCM
                     response_id = PID_REPLY_CHASSIS;
-                    cal_id = "00090121001900560";  // FPCM calibration ID
+                    cal_id = mode_09_cal_id_fpcm;  // FPCM calibration ID
                     cal_len = 17;
                 } else if (can_MsgRx.id == PID_REQUEST) {
                     // Broadcast request - ALL 3 ECUs respond with their calibration IDs
                     // Start ECM immediately, queue TCM and FPCM
 
-                    if(isotp_tx.state != ISOTP_IDLE) break;  // Transfer in progress
+                    if(ecu_sim->isotp_busy()) break;  // Transfer in progress
 
                     // ECM calibration ID
                     uint8_t ecm_cal_data[19];
                     ecm_cal_data[0] = MODE9_RESPONSE;
                     ecm_cal_data[1] = CAL_ID_REQUEST;
                     ecm_cal_data[2] = 0x01;
-                    const char* ecm_cal = "2769011200190170";
+                    const char* ecm_cal = mode_09_cal_id_ecm;
                     for(int i = 0; i < 16; i++) ecm_cal_data[i+3] = ecm_cal[i];
 
                     // TCM calibration ID
@@ -285,7 +290,7 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
                     tcm_cal_data[0] = MODE9_RESPONSE;
                     tcm_cal_data[1] = CAL_ID_REQUEST;
                     tcm_cal_data[2] = 0x01;
-                    const char* tcm_cal = "00090237271900001";
+                    const char* tcm_cal = mode_09_cal_id_tcm;
                     for(int i = 0; i < 17; i++) tcm_cal_data[i+3] = tcm_cal[i];
 
                     // FPCM calibration ID
@@ -293,7 +298,7 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
                     fpcm_cal_data[0] = MODE9_RESPONSE;
                     fpcm_cal_data[1] = CAL_ID_REQUEST;
                     fpcm_cal_data[2] = 0x01;
-                    const char* fpcm_cal = "00090121001900560";
+                    const char* fpcm_cal = mode_09_cal_id_fpcm;
                     for(int i = 0; i < 17; i++) fpcm_cal_data[i+3] = fpcm_cal[i];
 
                     // Start ECM transfer immediately
@@ -308,7 +313,7 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
                 }
 
                 // Single ECU targeted request
-                if(isotp_tx.state != ISOTP_IDLE) break;
+                if(ecu_sim->isotp_busy()) break;
 
                 uint8_t cal_data[20];  // 3 header + max 17 cal ID
                 cal_data[0] = MODE9_RESPONSE;
@@ -356,9 +361,7 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
             can_MsgTx.buf[5] = 0x85;
             can_MsgTx.buf[6] = 0x49;
             can_MsgTx.buf[7] = 0x39;
-            can1.write(can_MsgTx);
-
-            delay(5);  // Realistic delay between ECU responses
+            ecu_sim->send(can_MsgTx);
 
             // TCM - Transmission Control Module CVN
             can_MsgTx.id = PID_REPLY_TRANS;
@@ -369,9 +372,7 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
             can_MsgTx.buf[5] = 0xEF;
             can_MsgTx.buf[6] = 0x71;
             can_MsgTx.buf[7] = 0xAD;
-            can1.write(can_MsgTx);
-
-            delay(5);  // Realistic delay between ECU responses
+            ecu_sim->send(can_MsgTx);
 
             // FPCM - Fuel Pump Control Module CVN
             can_MsgTx.id = PID_REPLY_CHASSIS;
@@ -382,7 +383,7 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
             can_MsgTx.buf[5] = 0xD7;
             can_MsgTx.buf[6] = 0xFF;
             can_MsgTx.buf[7] = 0x6C;
-            can1.write(can_MsgTx);
+            ecu_sim->send(can_MsgTx);
             break;
 
         case ECU_NAME_REQUEST:  // 0x0A - ECU Name
@@ -408,25 +409,25 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
                 // Check which ECU should respond based on request ID
                 uint16_t response_id = PID_REPLY_ENGINE;  // Default
                 const char* ecu_prefix = "ECM";
-                const char* ecu_name = "EngineControl";
+                const char* ecu_name = mode_09_ecu_name_ecm;
                 uint8_t total_len = 23;
 
                 // Determine target ECU from request
                 if (can_MsgRx.id == PID_REQUEST_TRANS) {
                     response_id = PID_REPLY_TRANS;
                     ecu_prefix = "TCM";
-                    ecu_name = "TransmisCtrl";
+                    ecu_name = mode_09_ecu_name_tcm;
                     total_len = 22;  // Slightly different length
                 } else if (can_MsgRx.id == 0x7E3) {  // Request to FPCM
                     response_id = PID_REPLY_CHASSIS;
                     ecu_prefix = "FPCM";
-                    ecu_name = "FuelPumpCtrl";
+                    ecu_name = mode_09_ecu_name_fpcm;
                     total_len = 23;
                 } else if (can_MsgRx.id == PID_REQUEST) {
                     // Broadcast request - ALL 3 ECUs respond with their names
                     // Start ECM immediately, queue TCM and FPCM
 
-                    if(isotp_tx.state != ISOTP_IDLE) break;  // Transfer in progress
+                    if(ecu_sim->isotp_busy()) break;  // Transfer in progress
 
                     // ECM Name: ECM-EngineControl
                     uint8_t ecm_name_data[23];
@@ -435,7 +436,7 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
                     ecm_name_data[2] = 0x01;
                     ecm_name_data[3] = 'E'; ecm_name_data[4] = 'C'; ecm_name_data[5] = 'M';
                     ecm_name_data[6] = 0x00; ecm_name_data[7] = '-';
-                    const char* ecm_nm = "EngineControl";
+                    const char* ecm_nm = mode_09_ecu_name_ecm;
                     for(int i = 0; i < 13; i++) ecm_name_data[i+8] = ecm_nm[i];
                     ecm_name_data[21] = 0x00; ecm_name_data[22] = 0x00;
 
@@ -446,7 +447,7 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
                     tcm_name_data[2] = 0x01;
                     tcm_name_data[3] = 'T'; tcm_name_data[4] = 'C'; tcm_name_data[5] = 'M';
                     tcm_name_data[6] = 0x00; tcm_name_data[7] = '-';
-                    const char* tcm_nm = "TransmisCtrl";
+                    const char* tcm_nm = mode_09_ecu_name_tcm;
                     for(int i = 0; i < 13; i++) tcm_name_data[i+8] = tcm_nm[i];
                     tcm_name_data[21] = 0x00;
 
@@ -457,7 +458,7 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
                     fpcm_name_data[2] = 0x01;
                     fpcm_name_data[3] = 'F'; fpcm_name_data[4] = 'P'; fpcm_name_data[5] = 'C'; fpcm_name_data[6] = 'M';
                     fpcm_name_data[7] = 0x00; fpcm_name_data[8] = '-';
-                    const char* fpcm_nm = "FuelPumpCtrl";
+                    const char* fpcm_nm = mode_09_ecu_name_fpcm;
                     for(int i = 0; i < 12; i++) fpcm_name_data[i+9] = fpcm_nm[i];
                     fpcm_name_data[21] = 0x00; fpcm_name_data[22] = 0x00; fpcm_name_data[23] = 0x00;
 
@@ -473,7 +474,7 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
                 }
 
                 // Single ECU targeted request
-                if(isotp_tx.state != ISOTP_IDLE) break;
+                if(ecu_sim->isotp_busy()) break;
 
                 // Build ECU Name message
                 uint8_t name_data[25];  // Max size for any ECU name
@@ -527,98 +528,22 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
              */
             {
                 // Only start transfer if not already in progress
-                if(isotp_tx.state != ISOTP_IDLE) break;
+                if(ecu_sim->isotp_busy()) break;
 
                 // Performance tracking data (IUMPR - In-Use Monitor Performance Ratio)
-                // Format matches real Mercedes-Benz GLE-Class data (from ECU Modules OBD DATA tab)
-                // Total: 43 bytes (header + IUMPR data using 2-byte counters)
-                uint8_t perf_data[43];
-                perf_data[0] = MODE9_RESPONSE;
-                perf_data[1] = PERF_TRACK_REQUEST;
-
+                // The counters move with the simulated drive cycles (iumpr.cpp);
+                // the response is serialized when a counter changes, so the
+                // request only hands the cached 43 bytes to ISO-TP.
+                //
                 // IUMPR Data Format (SAE J1979 standard with 2-byte counters):
-                // Bytes 0-1:  OBDCOND (OBD Monitoring Conditions) - 2 bytes big-endian
-                // Bytes 2-3:  IGNCNTR (Ignition Counter) - 2 bytes big-endian
-                // Bytes 4-5:  CATCOMP1 (Catalyst Completions Bank 1) - 2 bytes
-                // Bytes 6-7:  CATCOND1 (Catalyst Conditions Bank 1) - 2 bytes
-                // Bytes 8-9:  CATCOMP2 (Catalyst Completions Bank 2) - 2 bytes
-                // Bytes 10-11: CATCOND2 (Catalyst Conditions Bank 2) - 2 bytes
-                // Bytes 12-13: O2SCOMP1 (O2 Sensor Completions Bank 1) - 2 bytes
-                // Bytes 14-15: O2SCOND1 (O2 Sensor Conditions Bank 1) - 2 bytes
-                // Bytes 16-17: O2SCOMP2 (O2 Sensor Completions Bank 2) - 2 bytes
-                // Bytes 18-19: O2SCOND2 (O2 Sensor Conditions Bank 2) - 2 bytes
-                // Bytes 20-21: EGRCOMP (EGR/VVT Completions) - 2 bytes
-                // Bytes 22-23: EGRCOND (EGR/VVT Conditions) - 2 bytes
-                // Bytes 24-25: AIRCOMP (Secondary Air Completions) - 2 bytes
-                // Bytes 26-27: AIRCOND (Secondary Air Conditions) - 2 bytes
-                // Bytes 28-29: EVAPCOMP (EVAP Completions) - 2 bytes
-                // Bytes 30-31: EVAPCOND (EVAP Conditions) - 2 bytes
-                // Bytes 32-33: SO2SCOMP1 (Secondary O2 Completions Bank 1) - 2 bytes
-                // Bytes 34-35: SO2SCOND1 (Secondary O2 Conditions Bank 1) - 2 bytes
-                // Bytes 36-37: SO2SCOMP2 (Secondary O2 Completions Bank 2) - 2 bytes
-                // Bytes 38-39: SO2SCOND2 (Secondary O2 Conditions Bank 2) - 2 bytes
-                // Byte 40: Data item count = 0x01
-
-                uint8_t iumpr_values[] = {
-                    // OBDCOND: 5,136 = 0x1410
-                    0x14, 0x10,
-                    // IGNCNTR: 45,614 = 0xB22E
-                    0xB2, 0x2E,
-
-                    // Catalyst Bank 1 Completions: 65,535 (maxed out) = 0xFFFF
-                    0xFF, 0xFF,
-                    // Catalyst Bank 1 Conditions: 5,136 = 0x1410
-                    0x14, 0x10,
-
-                    // Catalyst Bank 2 Completions: 65,535 (maxed out) = 0xFFFF
-                    0xFF, 0xFF,
-                    // Catalyst Bank 2 Conditions: 26,384 = 0x6710
-                    0x67, 0x10,
-
-                    // O2 Sensor Bank 1 Completions: 65,535 (maxed out) = 0xFFFF
-                    0xFF, 0xFF,
-                    // O2 Sensor Bank 1 Conditions: 5,136 = 0x1410
-                    0x14, 0x10,
-
-                    // O2 Sensor Bank 2: Not equipped
-                    0x00, 0x00,
-                    0x00, 0x00,
-
-                    // EGR/VVT Completions: 45,601 = 0xB221
-                    0xB2, 0x21,
-                    // EGR/VVT Conditions: 3,088 = 0x0C10
-                    0x0C, 0x10,
-
-                    // Secondary Air Completions: 45,568 = 0xB200
-                    0xB2, 0x00,
-                    // Secondary Air Conditions: 0 = 0x0000
-                    0x00, 0x00,
-
-                    // EVAP Completions: 1 = 0x0001
-                    0x00, 0x01,
-                    // EVAP Conditions: 46,851 = 0xB703
-                    0xB7, 0x03,
-
-                    // Secondary O2 Sensor Bank 1 Completions: 6,670 = 0x1A0E
-                    0x1A, 0x0E,
-                    // Secondary O2 Sensor Bank 1 Conditions: 5,136 = 0x1410
-                    0x14, 0x10,
-
-                    // Secondary O2 Sensor Bank 2: Not equipped
-                    0x00, 0x00,
-                    0x00, 0x00,
-
-                    // Data item count
-                    0x01
-                };
-
-                // Copy IUMPR data to response buffer
-                for(int i = 0; i < 41; i++) {
-                    perf_data[i+2] = iumpr_values[i];
-                }
+                // OBDCOND, IGNCNTR, then completions/conditions for catalyst
+                // B1/B2, O2 sensor B1/B2, EGR/VVT, secondary air, EVAP and
+                // secondary O2 B1/B2, followed by the data item count (0x01)
+                uint16_t perf_len = 0;
+                const uint8_t* perf_data = iumpr_response(&perf_len);
 
                 // Initialize ISO-TP transfer for multi-frame response (43 bytes total)
-                ecu_sim->isotp_init_transfer(perf_data, 43, PID_REPLY_ENGINE, MODE9, PERF_TRACK_REQUEST);
+                ecu_sim->isotp_init_transfer(perf_data, perf_len, PID_REPLY_ENGINE, MODE9, PERF_TRACK_REQUEST);
                 ecu_sim->isotp_send_first_frame();
             }
             break;
@@ -642,18 +567,26 @@ bool handle_mode_09(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simC
             can_MsgTx.buf[5] = 0x18;
             can_MsgTx.buf[6] = 0x00;  // Padding
             can_MsgTx.buf[7] = 0x00;  // Padding
-            can1.write(can_MsgTx);
+            ecu_sim->send(can_MsgTx);
             break;
 
         default:
-            // Unsupported Mode 09 PID - don't respond
-            // (Scan tool will timeout if PID not supported)
+            // Unsupported PIDs are answered by the registry (mode_09_supports)
             break;
     }
 
     return true;  // Mode 09 handled the request
 }
 
+/*
+ * Mode 09 Supported PIDs
+ *
+ * The ECM's bitmap; the TCM and FPCM support a subset of it.
+ */
+static bool mode_09_supports(uint8_t pid) {
+    return pid_bitmap_supports(mode_09_supported_ecm, 1, pid);
+}
+
 // Register Mode 09 handler at compile time
 // This makes the mode automatically available to the ECU simulator
-static ModeRegistrar mode_09_registrar(MODE9, handle_mode_09, "Vehicle Information");
+static ModeRegistrar mode_09_registrar(MODE9, handle_mode_09, "Vehicle Information", mode_09_supports);
@@ -0,0 +1,409 @@
+/*
+ * UDS (ISO 14229-1) Diagnostic Services
+ *
+ * Production scan tools are moving from SAE J1979 modes to UDS. This file
+ * adds the core UDS services on top of the mode registry:
+ *
+ * - 0x10 DiagnosticSessionControl: default and extended sessions
+ * - 0x3E TesterPresent: keeps a non-default session alive (S3 timeout)
+ * - 0x22 ReadDataByIdentifier: several DIDs per request, including
+ *        multi-frame requests reassembled by the ISO-TP receive path
+ * - 0x87 LinkControl: verify a bit rate, then switch the bus to it
+ *        without a reset (extended session)
+ *
+ * DID LOOKUP:
+ * Identification DIDs live in a table sorted by DID and are found with a
+ * binary search, so requests for many DIDs stay fast. DIDs 0xF400-0xF4FF
+ * map directly to Mode 01 PIDs and are read from Mode 01's response
+ * cache (mode01_read_pid), so both answer alike.
+ *
+ * NEGATIVE RESPONSES:
+ * 7F [SID] [NRC]. When a response needs ISO-TP while another transfer is
+ * in progress, the ECU answers 0x78 (responsePending) and queues the
+ * final response, which is sent as soon as the bus is free.
+ */
+
+#include "../mode_registry.h"
+#include "../sim_state.h"
+#include "../uds.h"
+#include "../sim_clock.h"
+#include <FlexCAN_T4.h>
+
+// External ECU data structures
+extern sim_state_t sim_state;
+
+#define UDS_MAX_DIDS_PER_REQUEST  32
+#define UDS_MAX_RESPONSE          255
+
+static uint8_t uds_session = UDS_DEFAULT_SESSION;
+static uint32_t uds_last_request = 0;       // For S3 timeout
+static uint32_t uds_verified_baud = 0;      // LinkControl rate awaiting transition
+
+/*
+ * Session Management
+ */
+void uds_session_update(void) {
+    // S3 timeout: fall back to the default session when the tester goes quiet
+    if (uds_session != UDS_DEFAULT_SESSION && (clock_ms() - uds_last_request) > UDS_S3_SERVER) {
+        uds_session = UDS_DEFAULT_SESSION;
+        uds_verified_baud = 0;
+    }
+}
+
+uint8_t uds_active_session(void) {
+    return uds_session;
+}
+
+/*
+ * DID Readers - each writes the DID data and returns its length
+ */
+typedef uint8_t (*DidReader)(uint8_t* data);
+
+typedef struct {
+    uint16_t did;               // Data identifier
+    uint8_t min_session;        // Lowest session the DID is readable in
+    DidReader read;             // Fills the data record
+} did_entry_t;
+
+static uint8_t did_read_string(const char* str, uint8_t* data) {
+    uint8_t len = strlen(str);
+    memcpy(data, str, len);
+    return len;
+}
+
+static uint8_t did_read_session(uint8_t* data) {
+    data[0] = uds_session;
+    return 1;
+}
+
+static uint8_t did_read_part_number(uint8_t* data) {
+    return did_read_string("2769011200", data);
+}
+
+static uint8_t did_read_serial_number(uint8_t* data) {
+    return did_read_string("TE40SIM0000158144", data);
+}
+
+static uint8_t did_read_vin(uint8_t* data) {
+    return did_read_string("4JGDA5HB7JB158144", data);
+}
+
+static uint8_t did_read_hw_version(uint8_t* data) {
+    return did_read_string("TEENSY40-HW1", data);
+}
+
+static uint8_t did_read_sw_version(uint8_t* data) {
+    return did_read_string("0190170", data);
+}
+
+// Sorted by DID - did_lookup() relies on the order
+static const did_entry_t did_table[] PROGMEM = {
+    { DID_ACTIVE_SESSION,    UDS_DEFAULT_SESSION,  did_read_session },
+    { DID_SPARE_PART_NUMBER, UDS_DEFAULT_SESSION,  did_read_part_number },
+    { DID_ECU_SERIAL_NUMBER, UDS_EXTENDED_SESSION, did_read_serial_number },
+    { DID_VIN,               UDS_DEFAULT_SESSION,  did_read_vin },
+    { DID_HW_VERSION,        UDS_DEFAULT_SESSION,  did_read_hw_version },
+    { DID_SW_VERSION,        UDS_DEFAULT_SESSION,  did_read_sw_version },
+};
+
+#define DID_TABLE_SIZE (sizeof(did_table) / sizeof(did_table[0]))
+
+static const did_entry_t* did_lookup(uint16_t did) {
+    uint8_t lo = 0;
+    uint8_t hi = DID_TABLE_SIZE;
+
+    while (lo < hi) {
+        uint8_t mid = (lo + hi) / 2;
+        if (did_table[mid].did == did) {
+            return &did_table[mid];
+        } else if (did_table[mid].did < did) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Read one DID into data; returns data length, 0 if not readable
+ */
+static uint8_t uds_read_did(uint16_t did, uint8_t* data) {
+    if ((did & 0xFF00) == DID_OBD_PID_BASE) {
+        // UDS-on-OBD: DID F4xx = Mode 01 PID xx
+        return mode01_read_pid(did & 0xFF, data);
+    }
+
+    const did_entry_t* entry = did_lookup(did);
+    if (entry == NULL) {
+        return 0;
+    }
+    if (uds_session < entry->min_session) {
+        return 0;  // Not readable in the active session
+    }
+    return entry->read(data);
+}
+
+/*
+ * Response helpers
+ */
+static void uds_send_response(CAN_message_t& can_MsgTx, ecu_simClass* ecu_sim, uint8_t* data, uint16_t len) {
+    uint8_t sid = data[0] - UDS_POSITIVE_OFFSET;
+
+    if (len <= 7) {
+        // Fits in a single frame
+        can_MsgTx.id = PID_REPLY_ENGINE;
+        can_MsgTx.len = 8;
+        can_MsgTx.buf[0] = len;
+        for (uint8_t i = 0; i < 7; i++) {
+            can_MsgTx.buf[i + 1] = (i < len) ? data[i] : 0x00;
+        }
+        ecu_sim->send(can_MsgTx);
+    } else if (!ecu_sim->isotp_busy()) {
+        ecu_sim->isotp_init_transfer(data, len, PID_REPLY_ENGINE, sid, 0);
+        ecu_sim->isotp_send_first_frame();
+    } else if (ecu_sim->isotp_queue_transfer(data, len, PID_REPLY_ENGINE, sid, 0)) {
+        // Another transfer owns the bus - tell the tester to extend its
+        // timeout to P2*, the queued response follows when the bus is free
+        ecu_sim->send_negative_response(sid, NRC_RESPONSE_PENDING);
+    } else {
+        ecu_sim->send_negative_response(sid, NRC_BUSY_REPEAT_REQUEST);
+    }
+}
+
+/*
+ * Only the engine ECU implements UDS
+ */
+static bool uds_is_addressed(CAN_message_t& can_MsgRx) {
+    return can_MsgRx.id == PID_REQUEST || can_MsgRx.id == PID_REQUEST_ENGINE;
+}
+
+/*
+ * 0x10 DiagnosticSessionControl
+ *
+ * Request:  02 10 [session]
+ * Response: 06 50 [session] [P2 hi] [P2 lo] [P2* hi] [P2* lo]
+ */
+bool handle_uds_session_control(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simClass* ecu_sim) {
+    if (can_MsgRx.buf[1] != UDS_SESSION_CONTROL) {
+        return false;  // Not our service
+    }
+    if (!uds_is_addressed(can_MsgRx)) {
+        return true;
+    }
+    uds_last_request = clock_ms();
+
+    if (ecu_sim->request_len != 2) {
+        ecu_sim->send_negative_response(UDS_SESSION_CONTROL, NRC_INCORRECT_LENGTH);
+        return true;
+    }
+
+    uint8_t session = can_MsgRx.buf[2] & ~UDS_SUPPRESS_POS_RESPONSE;
+    if (session != UDS_DEFAULT_SESSION && session != UDS_EXTENDED_SESSION) {
+        // Programming session is not available on the simulator
+        ecu_sim->send_negative_response(UDS_SESSION_CONTROL, NRC_SUBFUNCTION_NOT_SUPPORTED);
+        return true;
+    }
+    uds_session = session;
+    uds_verified_baud = 0;  // A session change discards a verified LinkControl rate
+
+    if (can_MsgRx.buf[2] & UDS_SUPPRESS_POS_RESPONSE) {
+        return true;
+    }
+
+    uint8_t response[6];
+    response[0] = UDS_SESSION_CONTROL + UDS_POSITIVE_OFFSET;
+    response[1] = session;
+    response[2] = (UDS_P2_SERVER_MAX >> 8) & 0xFF;
+    response[3] = UDS_P2_SERVER_MAX & 0xFF;
+    response[4] = ((UDS_P2_STAR_SERVER_MAX / 10) >> 8) & 0xFF;
+    response[5] = (UDS_P2_STAR_SERVER_MAX / 10) & 0xFF;
+    uds_send_response(can_MsgTx, ecu_sim, response, sizeof(response));
+
+    return true;
+}
+
+/*
+ * 0x3E TesterPresent
+ *
+ * Request:  02 3E 00  (or 02 3E 80 to suppress the response)
+ * Response: 02 7E 00
+ */
+bool handle_uds_tester_present(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simClass* ecu_sim) {
+    if (can_MsgRx.buf[1] != UDS_TESTER_PRESENT) {
+        return false;  // Not our service
+    }
+    if (!uds_is_addressed(can_MsgRx)) {
+        return true;
+    }
+    uds_last_request = clock_ms();  // Keeps the session alive
+
+    if (ecu_sim->request_len != 2) {
+        ecu_sim->send_negative_response(UDS_TESTER_PRESENT, NRC_INCORRECT_LENGTH);
+        return true;
+    }
+    if ((can_MsgRx.buf[2] & ~UDS_SUPPRESS_POS_RESPONSE) != 0x00) {
+        ecu_sim->send_negative_response(UDS_TESTER_PRESENT, NRC_SUBFUNCTION_NOT_SUPPORTED);
+        return true;
+    }
+    if (can_MsgRx.buf[2] & UDS_SUPPRESS_POS_RESPONSE) {
+        return true;
+    }
+
+    uint8_t response[2] = { UDS_TESTER_PRESENT + UDS_POSITIVE_OFFSET, 0x00 };
+    uds_send_response(can_MsgTx, ecu_sim, response, sizeof(response));
+
+    return true;
+}
+
+/*
+ * 0x22 ReadDataByIdentifier
+ *
+ * Request:  22 [DID hi] [DID lo] ... (up to 32 DIDs; more than 3 need multi-frame)
+ * Response: 62 [DID hi] [DID lo] [data] ...
+ *
+ * Unsupported DIDs are skipped; if none is supported the ECU answers
+ * NRC 0x31 (requestOutOfRange).
+ */
+bool handle_uds_read_did(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simClass* ecu_sim) {
+    if (can_MsgRx.buf[1] != UDS_READ_DID) {
+        return false;  // Not our service
+    }
+    if (!uds_is_addressed(can_MsgRx)) {
+        return true;
+    }
+    uds_last_request = clock_ms();
+
+    const uint8_t* request = ecu_sim->request_data;
+    uint16_t request_len = ecu_sim->request_len;
+    uint8_t did_count = (request_len - 1) / 2;
+
+    if (request_len < 3 || (request_len - 1) % 2 != 0 || did_count > UDS_MAX_DIDS_PER_REQUEST) {
+        ecu_sim->send_negative_response(UDS_READ_DID, NRC_INCORRECT_LENGTH);
+        return true;
+    }
+
+    uint8_t response[UDS_MAX_RESPONSE];
+    uint16_t len = 0;
+    response[len++] = UDS_READ_DID + UDS_POSITIVE_OFFSET;
+
+    uint8_t data[32];
+    for (uint8_t i = 0; i < did_count; i++) {
+        uint16_t did = (request[1 + i * 2] << 8) | request[2 + i * 2];
+        uint8_t data_len = uds_read_did(did, data);
+        if (data_len == 0) {
+            continue;  // Unsupported DID - skip
+        }
+        if (len + 2 + data_len > UDS_MAX_RESPONSE) {
+            ecu_sim->send_negative_response(UDS_READ_DID, NRC_RESPONSE_TOO_LONG);
+            return true;
+        }
+        response[len++] = (did >> 8) & 0xFF;
+        response[len++] = did & 0xFF;
+        memcpy(&response[len], data, data_len);
+        len += data_len;
+    }
+
+    if (len == 1) {
+        ecu_sim->send_negative_response(UDS_READ_DID, NRC_REQUEST_OUT_OF_RANGE);
+        return true;
+    }
+
+    uds_send_response(can_MsgTx, ecu_sim, response, len);
+
+    return true;
+}
+
+/*
+ * 0x87 LinkControl
+ *
+ * Request:  87 01 [baudrate id]      verify a fixed rate (0x10-0x13)
+ *           87 02 [rate hi mid lo]   verify a specific rate in bit/s
+ *           87 03                    transition to the verified rate
+ * Response: C7 [sub-function]
+ *
+ * The positive response to 87 03 is sent at the old rate; the bus
+ * switches CAN_BAUD_SWITCH_DELAY_MS later. Testers usually send the
+ * transition functionally with the response suppressed (87 83).
+ */
+static uint32_t link_baud_for_id(uint8_t id) {
+    switch (id) {
+        case LINK_BAUD_CAN_125K: return 125000;
+        case LINK_BAUD_CAN_250K: return 250000;
+        case LINK_BAUD_CAN_500K: return 500000;
+        case LINK_BAUD_CAN_1M:   return 1000000;
+        default:                 return 0;
+    }
+}
+
+bool handle_uds_link_control(CAN_message_t& can_MsgRx, CAN_message_t& can_MsgTx, ecu_simClass* ecu_sim) {
+    if (can_MsgRx.buf[1] != UDS_LINK_CONTROL) {
+        return false;  // Not our service
+    }
+    if (!uds_is_addressed(can_MsgRx)) {
+        return true;
+    }
+    uds_last_request = clock_ms();
+
+    if (ecu_sim->request_len < 2) {
+        ecu_sim->send_negative_response(UDS_LINK_CONTROL, NRC_INCORRECT_LENGTH);
+        return true;
+    }
+    if (uds_session != UDS_EXTENDED_SESSION) {
+        ecu_sim->send_negative_response(UDS_LINK_CONTROL, NRC_SERVICE_NOT_IN_SESSION);
+        return true;
+    }
+
+    const uint8_t* request = ecu_sim->request_data;
+    uint8_t sub_function = request[1] & ~UDS_SUPPRESS_POS_RESPONSE;
+    uint8_t expected_len;
+    uint32_t baud = 0;
+
+    switch (sub_function) {
+        case LINK_VERIFY_FIXED_BAUD:    expected_len = 3; break;
+        case LINK_VERIFY_SPECIFIC_BAUD: expected_len = 5; break;
+        case LINK_TRANSITION_BAUD:      expected_len = 2; break;
+        default:
+            ecu_sim->send_negative_response(UDS_LINK_CONTROL, NRC_SUBFUNCTION_NOT_SUPPORTED);
+            return true;
+    }
+    if (ecu_sim->request_len != expected_len) {
+        ecu_sim->send_negative_response(UDS_LINK_CONTROL, NRC_INCORRECT_LENGTH);
+        return true;
+    }
+
+    if (sub_function == LINK_TRANSITION_BAUD) {
+        if (uds_verified_baud == 0) {
+            ecu_sim->send_negative_response(UDS_LINK_CONTROL, NRC_REQUEST_SEQUENCE_ERROR);
+            return true;
+        }
+        can_baud_switch(&ecu_sim->channel->link, uds_verified_baud);
+        uds_verified_baud = 0;
+    } else {
+        if (sub_function == LINK_VERIFY_FIXED_BAUD) {
+            baud = link_baud_for_id(request[2]);
+        } else {
+            baud = ((uint32_t)request[2] << 16) | ((uint32_t)request[3] << 8) | request[4];
+        }
+        if (!can_baud_supported(baud)) {
+            ecu_sim->send_negative_response(UDS_LINK_CONTROL, NRC_REQUEST_OUT_OF_RANGE);
+            return true;
+        }
+        uds_verified_baud = baud;
+    }
+
+    if (request[1] & UDS_SUPPRESS_POS_RESPONSE) {
+        return true;
+    }
+
+    uint8_t response[2] = { UDS_LINK_CONTROL + UDS_POSITIVE_OFFSET, sub_function };
+    uds_send_response(can_MsgTx, ecu_sim, response, sizeof(response));
+
+    return true;
+}
+
+// Register UDS services at compile time
+static ModeRegistrar uds_10_registrar(UDS_SESSION_CONTROL, handle_uds_session_control, "UDS DiagnosticSessionControl");
+static ModeRegistrar uds_22_registrar(UDS_READ_DID, handle_uds_read_did, "UDS ReadDataByIdentifier");
+static ModeRegistrar uds_3e_registrar(UDS_TESTER_PRESENT, handle_uds_tester_present, "UDS TesterPresent");
+static ModeRegistrar uds_87_registrar(UDS_LINK_CONTROL, handle_uds_link_control, "UDS LinkControl");
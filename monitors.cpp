@@ -0,0 +1,258 @@
+/*
+ * On-Board Monitor Engine
+ *
+ * Runs simulated catalyst, O2 sensor, EGR and EVAP monitors off the
+ * driving simulation and keeps their Mode 06 results and readiness bits.
+ * See monitors.h for the overall design.
+ */
+
+#include "monitors.h"
+#include "ecu_sim.h"
+#include "iumpr.h"
+#include "memory_map.h"
+#include "sim_clock.h"
+
+/*
+ * Monitor calibration
+ * Limits are chosen so a healthy simulated vehicle always passes.
+ */
+static const monitor_def_t monitor_defs[] PROGMEM = {
+    // O2 sensors: rich-to-lean (TID 05) and lean-to-rich (TID 06) switch time
+    { OBDMID_O2_B1S1, READY_O2_SENSOR, 300, 2,
+      { { 0x05, UASID_TIME_MS, 0x0000, 0x0078 },        // 0-120 ms
+        { 0x06, UASID_TIME_MS, 0x0000, 0x0078 } } },
+    { OBDMID_O2_B2S1, READY_O2_SENSOR, 300, 2,
+      { { 0x05, UASID_TIME_MS, 0x0000, 0x0078 },
+        { 0x06, UASID_TIME_MS, 0x0000, 0x0078 } } },
+
+    // Catalyst: rear/front O2 switch ratio, above 0.6 indicates lost oxygen storage
+    { OBDMID_CAT_B1, READY_CATALYST, 600, 1,
+      { { 0x80, UASID_RATIO, 0x0000, 0x009A } } },      // 0 - 0.60
+    { OBDMID_CAT_B2, READY_CATALYST, 600, 1,
+      { { 0x80, UASID_RATIO, 0x0000, 0x009A } } },
+
+    // EGR: intake pressure rise during EGR flow test on deceleration
+    { OBDMID_EGR, READY_EGR, 100, 1,
+      { { 0x80, UASID_RAW, 0x0040, 0x0200 } } },
+
+    // EVAP: pressure decay of the sealed system, 0.020" leak check
+    { OBDMID_EVAP_020, READY_EVAP, 1200, 1,
+      { { 0x80, UASID_PRESSURE_PA, 0x0000, 0x00C8 } } }, // 0 - 2.00 kPa
+};
+
+#define MONITOR_COUNT (sizeof(monitor_defs) / sizeof(monitor_defs[0]))
+
+static monitor_result_t monitor_results[MONITOR_COUNT];
+static uint8_t supported_mids[8][4];     // Bitmaps for range MIDs 0x00-0xE0
+
+static int monitor_index(uint8_t mid) {
+    for(uint8_t i = 0; i < MONITOR_COUNT; i++) {
+        if(monitor_defs[i].mid == mid) return i;
+    }
+    return -1;
+}
+
+/*
+ * Serialize one monitor's results into its Mode 06 response table
+ * Each TID becomes a 9-byte record: MID TID UASID VAL MIN MAX
+ */
+static void monitor_build_response(uint8_t index) {
+    const monitor_def_t* def = &monitor_defs[index];
+    monitor_result_t* res = &monitor_results[index];
+    uint8_t* p = res->response;
+
+    for(uint8_t t = 0; t < def->test_count; t++) {
+        const monitor_test_t* test = &def->tests[t];
+        *p++ = def->mid;
+        *p++ = test->test_id;
+        *p++ = test->unit_scaling;
+        *p++ = (res->test_value[t] >> 8) & 0xFF;
+        *p++ = res->test_value[t] & 0xFF;
+        *p++ = (test->min_limit >> 8) & 0xFF;
+        *p++ = test->min_limit & 0xFF;
+        *p++ = (test->max_limit >> 8) & 0xFF;
+        *p++ = test->max_limit & 0xFF;
+    }
+    res->response_len = p - res->response;
+}
+
+/*
+ * Recompute readiness bytes for PID 0x01 and PID 0x41
+ * Byte B: continuous monitors (misfire, fuel, components) supported and complete
+ * Byte C: non-continuous monitors supported (0x01) / enabled this cycle (0x41)
+ * Byte D: non-continuous monitors NOT complete (bit=1 means not ready)
+ */
+static void monitor_update_readiness(void) {
+    uint8_t supported = 0;
+    uint8_t incomplete = 0;
+    uint8_t incomplete_cycle = 0;
+
+    for(uint8_t i = 0; i < MONITOR_COUNT; i++) {
+        uint8_t bit = monitor_defs[i].readiness_bit;
+        supported |= bit;
+        if(!monitor_results[i].complete_since_clear) incomplete |= bit;
+        if(!monitor_results[i].complete_this_cycle) incomplete_cycle |= bit;
+    }
+
+    sim_state.monitor_status[0] = 0x07;          // Misfire, fuel, components: supported, complete
+    sim_state.monitor_status[1] = supported;
+    sim_state.monitor_status[2] = incomplete;
+
+    sim_state.monitor_cycle[0] = 0x07;           // Continuous monitors enabled, complete
+    sim_state.monitor_cycle[1] = supported;
+    sim_state.monitor_cycle[2] = incomplete_cycle;
+}
+
+/*
+ * Enable conditions per monitor group, evaluated against the live state
+ */
+static bool monitor_enabled(uint8_t readiness_bit) {
+    bool warm = sim_state.coolant_temp >= (70 + 40);  // 70°C
+
+    switch(readiness_bit) {
+        case READY_O2_SENSOR:   // Closed loop, vehicle moving
+            return warm && sim_state.vehicle_speed > 0;
+        case READY_CATALYST:    // Steady cruise 40-100 km/h
+            return warm && sim_state.vehicle_speed >= 40 && sim_state.vehicle_speed <= 100 &&
+                   (sim_state.drive_state == CITY || sim_state.drive_state == HIGHWAY);
+        case READY_EGR:         // Deceleration fuel cut-off
+            return warm && sim_state.drive_state == BRAKING;
+        case READY_EVAP:        // Stationary idle
+            return warm && sim_state.drive_state == IDLE;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Simulated test values for a healthy vehicle
+ */
+static void monitor_measure(uint8_t index, uint16_t* values) {
+    switch(monitor_defs[index].readiness_bit) {
+        case READY_O2_SENSOR:
+            values[0] = 40 + random(0, 30);          // 40-70 ms
+            values[1] = 45 + random(0, 30);
+            break;
+        case READY_CATALYST:
+            values[0] = 0x20 + random(0, 0x20);      // ratio 0.12-0.25
+            break;
+        case READY_EGR:
+            values[0] = 0x0100 + random(-0x30, 0x30);
+            break;
+        case READY_EVAP:
+            values[0] = 0x30 + random(0, 0x20);      // 0.48-0.80 kPa
+            break;
+    }
+}
+
+FLASHMEM void monitors_init(void) {
+    memset(monitor_results, 0, sizeof(monitor_results));
+    memset(supported_mids, 0, sizeof(supported_mids));
+
+    // Supported-MID bitmaps: bit 7 of byte 0 is MID (range+1);
+    // the last bit flags that the next range has supported MIDs
+    for(uint8_t i = 0; i < MONITOR_COUNT; i++) {
+        uint8_t mid = monitor_defs[i].mid;
+        uint8_t range = (mid - 1) >> 5;
+        uint8_t offset = (mid - 1) & 0x1F;
+        supported_mids[range][offset >> 3] |= 0x80 >> (offset & 0x07);
+        for(uint8_t r = 0; r < range; r++) {
+            supported_mids[r][3] |= 0x01;
+        }
+    }
+
+    // The simulated vehicle has driving history: every monitor completed
+    // on a previous drive cycle, so readiness since clear starts complete
+    // and Mode 06 reports those results until the tests run again
+    for(uint8_t i = 0; i < MONITOR_COUNT; i++) {
+        monitor_measure(i, monitor_results[i].test_value);
+        monitor_results[i].complete_since_clear = true;
+        monitor_results[i].passed = true;
+        monitor_build_response(i);
+    }
+    monitor_update_readiness();
+}
+
+void monitors_update(void) {
+    static uint32_t lastUpdate = 0;
+
+    // Monitors run at the simulation rate (100ms)
+    if(clock_ms() - lastUpdate < 100) {
+        return;
+    }
+    lastUpdate = clock_ms();
+
+    for(uint8_t i = 0; i < MONITOR_COUNT; i++) {
+        monitor_result_t* res = &monitor_results[i];
+        if(res->complete_this_cycle || !monitor_enabled(monitor_defs[i].readiness_bit)) {
+            continue;  // Non-continuous monitors run once per drive cycle
+        }
+        if(++res->qualified_ticks >= monitor_defs[i].qualify_ticks) {
+            uint16_t values[MAX_MONITOR_TESTS] = { 0 };
+            monitor_measure(i, values);
+            monitors_complete(monitor_defs[i].mid, values);
+        }
+    }
+}
+
+void monitors_complete(uint8_t mid, const uint16_t* values) {
+    int index = monitor_index(mid);
+    if(index < 0) return;
+
+    const monitor_def_t* def = &monitor_defs[index];
+    monitor_result_t* res = &monitor_results[index];
+
+    res->passed = true;
+    for(uint8_t t = 0; t < def->test_count; t++) {
+        res->test_value[t] = values[t];
+        if(values[t] < def->tests[t].min_limit || values[t] > def->tests[t].max_limit) {
+            res->passed = false;
+        }
+    }
+    res->complete_since_clear = true;
+    res->complete_this_cycle = true;
+
+    monitor_build_response(index);
+    monitor_update_readiness();
+    iumpr_monitor_complete(mid);
+}
+
+bool monitors_passed(uint8_t mid) {
+    int index = monitor_index(mid);
+    return index >= 0 && monitor_results[index].passed;
+}
+
+void monitors_clear(void) {
+    for(uint8_t i = 0; i < MONITOR_COUNT; i++) {
+        memset(&monitor_results[i], 0, sizeof(monitor_result_t));
+        monitor_build_response(i);
+    }
+    monitor_update_readiness();
+}
+
+/*
+ * A new drive cycle clears this-cycle completion (PID 0x41) and the
+ * qualified time; results and readiness since clear are kept
+ */
+void monitors_ignition_cycle(void) {
+    for(uint8_t i = 0; i < MONITOR_COUNT; i++) {
+        monitor_results[i].complete_this_cycle = false;
+        monitor_results[i].qualified_ticks = 0;
+    }
+    monitor_update_readiness();
+}
+
+const uint8_t* monitors_response(uint8_t mid, uint8_t* len) {
+    int index = monitor_index(mid);
+    if(index < 0) return NULL;
+
+    *len = monitor_results[index].response_len;
+    return monitor_results[index].response;
+}
+
+bool monitors_supported(uint8_t range_mid, uint8_t* bitmap) {
+    if((range_mid & 0x1F) != 0) return false;  // Not a range MID
+
+    memcpy(bitmap, supported_mids[range_mid >> 5], 4);
+    return true;
+}
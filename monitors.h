@@ -0,0 +1,104 @@
+#ifndef MONITORS_H
+#define MONITORS_H
+
+#include <Arduino.h>
+#include "sim_state.h"
+
+/*
+ * On-Board Monitor Engine (Mode 06 test results, readiness status)
+ *
+ * Simulates the non-continuous emissions monitors of the engine ECU
+ * (catalyst, O2 sensors, EGR, EVAP). Each monitor accumulates time while
+ * its enable conditions are met by the driving simulation; once enough
+ * qualified time has passed the test completes, its test values are
+ * computed against fixed limits, and the result is stored per OBDMID.
+ *
+ * Completed results are serialized into per-monitor Mode 06 response
+ * tables at completion time, so the Mode 06 handler only copies bytes.
+ * The same completion flags drive the readiness bits of PID 0x01 and
+ * PID 0x41, which are written into sim_state.
+ */
+
+#define MAX_MONITOR_TESTS     2         // TIDs per OBDMID
+#define MODE6_RECORD_LEN      9         // MID TID UASID VAL(2) MIN(2) MAX(2)
+
+/*
+ * Monitor IDs (OBDMID) - SAE J1979 Appendix D
+ */
+#define OBDMID_O2_B1S1        0x01      // Oxygen sensor monitor bank 1 sensor 1
+#define OBDMID_O2_B2S1        0x05      // Oxygen sensor monitor bank 2 sensor 1
+#define OBDMID_CAT_B1         0x21      // Catalyst monitor bank 1
+#define OBDMID_CAT_B2         0x22      // Catalyst monitor bank 2
+#define OBDMID_EGR            0x31      // EGR monitor bank 1
+#define OBDMID_EVAP_020       0x3C      // EVAP monitor (0.020")
+
+/*
+ * Unit and Scaling IDs (UASID) - SAE J1979 Appendix E
+ */
+#define UASID_RAW             0x01      // Raw value, 1 per bit
+#define UASID_TIME_MS         0x10      // Time, 1 ms per bit
+#define UASID_PRESSURE_PA     0x17      // Pressure, 0.01 kPa per bit
+#define UASID_RATIO           0x20      // Ratio, 0.0039062 per bit
+
+/*
+ * Readiness bits (PID 0x01 / 0x41 bytes C and D)
+ */
+#define READY_CATALYST        0x01
+#define READY_EVAP            0x04
+#define READY_O2_SENSOR       0x20
+#define READY_EGR             0x80
+
+/*
+ * Test definition - limits and scaling are fixed per calibration
+ */
+typedef struct {
+    uint8_t test_id;           // TID (Test ID)
+    uint8_t unit_scaling;      // UASID
+    uint16_t min_limit;        // Minimum acceptable
+    uint16_t max_limit;        // Maximum acceptable
+} monitor_test_t;
+
+/*
+ * Monitor definition - one per OBDMID
+ */
+typedef struct {
+    uint8_t mid;                             // OBDMID
+    uint8_t readiness_bit;                   // Bit in PID 0x01 byte C/D
+    uint16_t qualify_ticks;                  // 100ms ticks of enable conditions to complete
+    uint8_t test_count;                      // Number of TIDs
+    monitor_test_t tests[MAX_MONITOR_TESTS];
+} monitor_def_t;
+
+/*
+ * Monitor runtime state and precomputed Mode 06 response
+ */
+typedef struct {
+    uint16_t test_value[MAX_MONITOR_TESTS];  // Last measured values
+    uint16_t qualified_ticks;                // Enable-condition time this cycle
+    bool complete_since_clear;               // Drives PID 0x01 readiness
+    bool complete_this_cycle;                // Drives PID 0x41 readiness
+    bool passed;                             // All tests within limits
+    uint8_t response_len;                    // Bytes in response[]
+    uint8_t response[MAX_MONITOR_TESTS * MODE6_RECORD_LEN];  // Encoded records
+} monitor_result_t;
+
+/*
+ * Monitor Engine Interface
+ */
+void monitors_init(void);                    // Reset all results, build tables
+void monitors_update(void);                  // Run enabled tests (main loop)
+void monitors_clear(void);                   // Mode 04: clear results and readiness
+void monitors_ignition_cycle(void);          // New drive cycle: every test runs again
+void monitors_complete(uint8_t mid, const uint16_t* values);  // Record a finished test
+bool monitors_passed(uint8_t mid);           // Last result within limits
+
+/*
+ * Mode 06 lookup
+ * monitors_response() returns the encoded records for one OBDMID
+ * (without the 0x46 response byte), or NULL if the MID is not supported.
+ * monitors_supported() fills the 4-byte bitmap for a range MID (0x00, 0x20, ...).
+ */
+const uint8_t* monitors_response(uint8_t mid, uint8_t* len);
+bool monitors_supported(uint8_t range_mid, uint8_t* bitmap);
+
+#endif // MONITORS_H
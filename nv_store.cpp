@@ -0,0 +1,204 @@
+/*
+ * Non-Volatile Diagnostic State - Journal
+ *
+ * Slot journal over the emulated EEPROM (or a file without ARDUINO).
+ * See nv_store.h for the record layout and write policy.
+ */
+
+#include "nv_store.h"
+#include "sim_clock.h"
+
+static_assert(NV_SLOT_COUNT >= 2, "NV journal needs at least two slots");
+
+/*
+ * Storage backend - byte access to NV_SIZE bytes
+ */
+#ifdef ARDUINO
+#include <EEPROM.h>
+
+static void nv_backend_open(void) {
+}
+
+static uint8_t nv_backend_read(uint16_t addr) {
+    return EEPROM.read(addr);
+}
+
+static void nv_backend_write(uint16_t addr, uint8_t value) {
+    EEPROM.update(addr, value);  // Only programs bytes that change
+}
+
+static void nv_backend_sync(void) {
+}
+
+#else
+#include <stdio.h>
+
+static FILE* nv_file = NULL;
+
+static void nv_backend_open(void) {
+    nv_file = fopen(NV_HOST_FILE, "r+b");
+    if(nv_file == NULL) {
+        // New store, filled with the erased value like blank flash
+        nv_file = fopen(NV_HOST_FILE, "w+b");
+        if(nv_file == NULL) return;
+        for(uint16_t i = 0; i < NV_SIZE; i++) fputc(0xFF, nv_file);
+        fflush(nv_file);
+    }
+}
+
+static uint8_t nv_backend_read(uint16_t addr) {
+    if(nv_file == NULL || fseek(nv_file, addr, SEEK_SET) != 0) return 0xFF;
+    int value = fgetc(nv_file);
+    return (value == EOF) ? 0xFF : value;
+}
+
+static void nv_backend_write(uint16_t addr, uint8_t value) {
+    if(nv_file == NULL || fseek(nv_file, addr, SEEK_SET) != 0) return;
+    fputc(value, nv_file);
+}
+
+static void nv_backend_sync(void) {
+    if(nv_file != NULL) fflush(nv_file);
+}
+#endif
+
+/*
+ * Journal state
+ */
+static nv_image_t nv_staging;           // Snapshot being written (or loaded)
+static nv_header_t nv_staging_header;   // Header written after the image
+static uint8_t nv_next_slot = 0;        // Slot the next record goes to
+static uint32_t nv_sequence = 0;        // Sequence number of the newest record
+static uint16_t nv_write_offset = 0;    // Bytes of the record written so far
+static bool nv_saving = false;
+
+static bool nv_dirty = false;
+static bool nv_urgent = false;
+static uint32_t nv_first_mark = 0;      // First change since the last save
+static uint32_t nv_last_mark = 0;       // Latest urgent change
+
+static void nv_read(uint16_t addr, void* data, uint16_t len) {
+    uint8_t* p = (uint8_t*)data;
+    for(uint16_t i = 0; i < len; i++) {
+        p[i] = nv_backend_read(addr + i);
+    }
+}
+
+/*
+ * CRC-16/CCITT (poly 0x1021), covering the sequence number and image
+ */
+static uint16_t nv_crc16(uint16_t crc, const uint8_t* data, uint16_t len) {
+    while(len--) {
+        crc ^= (uint16_t)(*data++) << 8;
+        for(uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+static uint16_t nv_record_crc(uint32_t sequence, const nv_image_t* image) {
+    uint16_t crc = nv_crc16(0xFFFF, (const uint8_t*)&sequence, sizeof(sequence));
+    return nv_crc16(crc, (const uint8_t*)image, sizeof(nv_image_t));
+}
+
+bool nv_init(nv_image_t* image) {
+    bool found = false;
+
+    nv_backend_open();
+
+    // Scan every slot, keep the valid record with the highest sequence
+    for(uint8_t slot = 0; slot < NV_SLOT_COUNT; slot++) {
+        uint16_t base = slot * NV_RECORD_SIZE;
+        nv_header_t header;
+
+        nv_read(base, &header, sizeof(header));
+        if(header.magic != NV_MAGIC || header.version != NV_VERSION ||
+           header.length != sizeof(nv_image_t)) {
+            continue;  // Blank slot or older layout
+        }
+        if(found && header.sequence <= nv_sequence) {
+            continue;  // Older than the record already found
+        }
+
+        nv_read(base + sizeof(nv_header_t), &nv_staging, sizeof(nv_image_t));
+        if(nv_record_crc(header.sequence, &nv_staging) != header.crc) {
+            continue;  // Interrupted save
+        }
+
+        memcpy(image, &nv_staging, sizeof(nv_image_t));
+        nv_sequence = header.sequence;
+        nv_next_slot = (slot + 1) % NV_SLOT_COUNT;
+        found = true;
+    }
+
+    return found;
+}
+
+void nv_mark_dirty(bool urgent) {
+    uint32_t now = clock_ms();
+
+    if(!nv_dirty) {
+        nv_first_mark = now;
+        nv_dirty = true;
+    }
+    if(urgent) {
+        nv_urgent = true;
+        nv_last_mark = now;
+    }
+}
+
+bool nv_save_due(void) {
+    if(!nv_dirty || nv_saving) {
+        return false;
+    }
+    if(nv_urgent) {
+        return (clock_ms() - nv_last_mark) >= NV_SETTLE_MS;
+    }
+    return (clock_ms() - nv_first_mark) >= NV_COUNTER_PERIOD_MS;
+}
+
+void nv_save(const nv_image_t* image) {
+    memcpy(&nv_staging, image, sizeof(nv_image_t));
+
+    nv_sequence++;
+    nv_staging_header.magic = NV_MAGIC;
+    nv_staging_header.version = NV_VERSION;
+    nv_staging_header.reserved = 0;
+    nv_staging_header.sequence = nv_sequence;
+    nv_staging_header.length = sizeof(nv_image_t);
+    nv_staging_header.crc = nv_record_crc(nv_sequence, &nv_staging);
+
+    // Changes made from here on belong to the next save
+    nv_dirty = false;
+    nv_urgent = false;
+    nv_write_offset = 0;
+    nv_saving = true;
+}
+
+void nv_update(void) {
+    if(!nv_saving) {
+        return;
+    }
+
+    uint16_t base = nv_next_slot * NV_RECORD_SIZE;
+    const uint8_t* image = (const uint8_t*)&nv_staging;
+    const uint8_t* header = (const uint8_t*)&nv_staging_header;
+
+    // Image first, header last: the header commits the record
+    for(uint8_t n = 0; n < NV_CHUNK_BYTES && nv_write_offset < NV_RECORD_SIZE; n++) {
+        if(nv_write_offset < sizeof(nv_image_t)) {
+            nv_backend_write(base + sizeof(nv_header_t) + nv_write_offset, image[nv_write_offset]);
+        } else {
+            uint16_t offset = nv_write_offset - sizeof(nv_image_t);
+            nv_backend_write(base + offset, header[offset]);
+        }
+        nv_write_offset++;
+    }
+
+    if(nv_write_offset >= NV_RECORD_SIZE) {
+        nv_backend_sync();
+        nv_next_slot = (nv_next_slot + 1) % NV_SLOT_COUNT;
+        nv_saving = false;
+    }
+}
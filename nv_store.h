@@ -0,0 +1,80 @@
+#ifndef NV_STORE_H
+#define NV_STORE_H
+
+#include <Arduino.h>
+#include "ecu_sim.h"
+#include "iumpr.h"
+
+/*
+ * Non-Volatile Diagnostic State
+ *
+ * Stored DTCs, freeze frames, the distance/run-time counters and the IUMPR
+ * counters survive a power cycle, as they do on a production ECU. They are
+ * kept in the Teensy's emulated EEPROM as a journal of complete records:
+ *
+ * - WEAR LEVELLING: the EEPROM is divided into slots, each holding one
+ *   record. Every save goes to the slot after the newest one, so writes
+ *   rotate through the whole area instead of hammering the same bytes.
+ * - POWER-FAIL SAFETY: a record's header (sequence number and CRC) is
+ *   written after its data. A save interrupted by power loss leaves a
+ *   record that fails its CRC, and the previous record is used instead.
+ * - WRITE COALESCING: state changes only mark the store dirty. A DTC
+ *   change is saved once the state has been quiet for NV_SETTLE_MS, so a
+ *   burst of changes (set DTC, capture two freeze frames) is one write.
+ *   Counters change continuously while driving and are saved at most
+ *   every NV_COUNTER_PERIOD_MS.
+ * - NEVER ON THE REQUEST PATH: handlers only call nv_mark_dirty(). The
+ *   record is written from the main loop by nv_update(), NV_CHUNK_BYTES
+ *   at a time, so a save never delays a response by more than one chunk.
+ *
+ * Without ARDUINO defined the same journal is kept in a plain file,
+ * NV_HOST_FILE, in the working directory. The tree has no such build;
+ * it would need its own Arduino shims.
+ */
+
+#define NV_SIZE               1080      // Teensy 4.0 emulated EEPROM (bytes)
+#define NV_MAGIC              0x4E56    // "NV"
+#define NV_VERSION            1         // Bump when nv_image_t changes
+#define NV_SETTLE_MS          500       // Quiet time before saving a DTC change
+#define NV_COUNTER_PERIOD_MS  60000     // Maximum deferral of counter-only changes
+#define NV_CHUNK_BYTES        16        // Bytes written per nv_update() call
+#define NV_HOST_FILE          "ecu_sim_nv.bin"
+
+/*
+ * Persistent image - everything that must survive a power cycle
+ * Plain data only: the image is stored byte for byte.
+ */
+typedef struct {
+    uint8_t dtc;                                    // ecu.dtc
+    uint8_t freeze_frame_head;                      // Freeze frame ring position
+    uint8_t freeze_frame_count;
+    freeze_frame_t freeze_frame[MAX_FREEZE_FRAMES]; // Mode 02 snapshots
+    sim_counters_t counters;                        // Distance and run-time counters
+    uint16_t iumpr[IUMPR_COUNTER_COUNT];            // Mode 09 PID 08 counters
+} nv_image_t;
+
+/*
+ * Record header, stored in front of each image
+ */
+typedef struct {
+    uint16_t magic;           // NV_MAGIC
+    uint8_t version;          // NV_VERSION
+    uint8_t reserved;
+    uint32_t sequence;        // Increments with every save, newest wins
+    uint16_t length;          // sizeof(nv_image_t)
+    uint16_t crc;             // CRC-16/CCITT over sequence and image
+} nv_header_t;
+
+#define NV_RECORD_SIZE        (sizeof(nv_header_t) + sizeof(nv_image_t))
+#define NV_SLOT_COUNT         (NV_SIZE / NV_RECORD_SIZE)
+
+/*
+ * NV Store Interface
+ */
+bool nv_init(nv_image_t* image);  // Load the newest valid record, false if none
+void nv_mark_dirty(bool urgent);  // State changed; urgent for DTCs and freeze frames
+bool nv_save_due(void);           // Dirty state has settled and no save is running
+void nv_save(const nv_image_t* image);  // Start saving a snapshot of the state
+void nv_update(void);             // Write the next chunk of a save (main loop)
+
+#endif // NV_STORE_H
@@ -0,0 +1,103 @@
+/*
+ * On-Board System Tests (Mode 08)
+ *
+ * EVAP leak test state machine. The phases and their durations follow a
+ * typical vacuum-decay leak check: seal the system, pull vacuum through
+ * the purge valve, hold and measure the pressure rise, then vent.
+ */
+
+#include "onboard_test.h"
+#include "monitors.h"
+#include "sim_state.h"
+#include "sim_clock.h"
+
+// Phase durations (milliseconds)
+#define EVAP_SEAL_TIME        2000
+#define EVAP_EVACUATE_TIME    5000
+#define EVAP_HOLD_TIME        10000
+#define EVAP_VENT_TIME        1000
+#define EVAP_TOTAL_TIME       (EVAP_SEAL_TIME + EVAP_EVACUATE_TIME + EVAP_HOLD_TIME + EVAP_VENT_TIME)
+
+static evap_phase_t evap_phase = EVAP_IDLE;
+static onboard_test_status_t evap_status = TEST_NOT_RUN;
+static uint32_t evap_phase_start = 0;     // When the current phase started
+static uint32_t evap_test_start = 0;      // When the test started
+static uint16_t evap_decay = 0;           // Measured pressure decay (0.01 kPa)
+
+static void evap_enter(evap_phase_t phase) {
+    evap_phase = phase;
+    evap_phase_start = clock_ms();
+}
+
+bool onboard_test_start_evap(void) {
+    // Safety interlock: the leak test seals the fuel system and is only
+    // allowed with the vehicle stationary
+    if (sim_state.vehicle_speed != 0) {
+        return false;
+    }
+
+    if (evap_phase == EVAP_IDLE) {
+        evap_status = TEST_RUNNING;
+        evap_test_start = clock_ms();
+        evap_enter(EVAP_SEALING);
+    }
+    return true;
+}
+
+void onboard_test_update(void) {
+    if (evap_phase == EVAP_IDLE) {
+        return;
+    }
+
+    // Abort if the vehicle starts moving
+    if (sim_state.vehicle_speed != 0) {
+        evap_status = TEST_ABORTED;
+        evap_phase = EVAP_IDLE;
+        return;
+    }
+
+    uint32_t elapsed = clock_ms() - evap_phase_start;
+
+    switch (evap_phase) {
+        case EVAP_SEALING:
+            if (elapsed >= EVAP_SEAL_TIME) evap_enter(EVAP_EVACUATING);
+            break;
+
+        case EVAP_EVACUATING:
+            if (elapsed >= EVAP_EVACUATE_TIME) evap_enter(EVAP_HOLDING);
+            break;
+
+        case EVAP_HOLDING:
+            if (elapsed >= EVAP_HOLD_TIME) {
+                // Pressure rise over the hold period - a sealed system stays low
+                evap_decay = 0x30 + random(0, 0x20);  // 0.48-0.80 kPa
+                evap_enter(EVAP_VENTING);
+            }
+            break;
+
+        case EVAP_VENTING:
+            if (elapsed >= EVAP_VENT_TIME) {
+                // Report to the monitor engine: updates Mode 06 MID 0x3C
+                // and marks the EVAP monitor complete for readiness
+                uint16_t values[MAX_MONITOR_TESTS] = { evap_decay, 0 };
+                monitors_complete(OBDMID_EVAP_020, values);
+                evap_status = monitors_passed(OBDMID_EVAP_020) ? TEST_PASSED : TEST_FAILED;
+                evap_phase = EVAP_IDLE;
+            }
+            break;
+
+        default:
+            evap_phase = EVAP_IDLE;
+            break;
+    }
+}
+
+onboard_test_status_t onboard_test_evap_status(uint8_t* progress) {
+    if (evap_status == TEST_RUNNING) {
+        uint32_t elapsed = clock_ms() - evap_test_start;
+        *progress = (elapsed >= EVAP_TOTAL_TIME) ? 99 : (elapsed * 100) / EVAP_TOTAL_TIME;
+    } else {
+        *progress = (evap_status == TEST_PASSED || evap_status == TEST_FAILED) ? 100 : 0;
+    }
+    return evap_status;
+}
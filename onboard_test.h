@@ -0,0 +1,62 @@
+#ifndef ONBOARD_TEST_H
+#define ONBOARD_TEST_H
+
+#include <Arduino.h>
+
+/*
+ * On-Board System Tests (Mode 08)
+ *
+ * A Mode 08 request only starts a test; the test itself runs as a
+ * background state machine advanced by onboard_test_update() from the
+ * main loop, so the simulator keeps answering other requests at full
+ * rate while it runs. Testers poll the test status with further Mode 08
+ * requests. Results are fed into the monitor engine, updating the Mode 06
+ * data and readiness bits.
+ */
+
+/*
+ * Mode 08 Test IDs
+ */
+#define TID_SUPPORTED         0x00      // Supported TIDs [01-20]
+#define TID_EVAP_LEAK_TEST    0x01      // Evaporative system leak test (SAE J1979)
+#define TID_EVAP_TEST_STATUS  0x81      // EVAP leak test status (manufacturer-specific, poll only)
+
+/*
+ * Test status, reported as the first data byte of Mode 08 responses
+ */
+typedef enum {
+    TEST_NOT_RUN = 0x00,      // Never run this drive cycle
+    TEST_RUNNING = 0x01,      // In progress
+    TEST_PASSED  = 0x02,      // Completed, within limits
+    TEST_FAILED  = 0x03,      // Completed, leak detected
+    TEST_ABORTED = 0x04       // Enable conditions lost
+} onboard_test_status_t;
+
+/*
+ * EVAP leak test phases
+ */
+typedef enum {
+    EVAP_IDLE,                // No test in progress
+    EVAP_SEALING,             // Closing canister vent valve
+    EVAP_EVACUATING,          // Purge valve pulls vacuum on tank
+    EVAP_HOLDING,             // System sealed, measuring pressure decay
+    EVAP_VENTING              // Opening vent, restoring normal operation
+} evap_phase_t;
+
+/*
+ * Start the EVAP leak test
+ * Returns false if enable conditions are not met (vehicle must be stationary)
+ */
+bool onboard_test_start_evap(void);
+
+/*
+ * Advance running tests - called from the main loop, never blocks
+ */
+void onboard_test_update(void);
+
+/*
+ * Current EVAP test status and progress (0-100%)
+ */
+onboard_test_status_t onboard_test_evap_status(uint8_t* progress);
+
+#endif // ONBOARD_TEST_H
@@ -0,0 +1,233 @@
+/*
+ * Per-ECU Response Timing (P2) Emulation
+ *
+ * Profiles, delay sampling and the response deadline queue. See
+ * response_timing.h.
+ */
+
+#include "response_timing.h"
+#include "ecu_sim.h"
+#include "bus_load.h"
+#include "memory_map.h"
+#include "sim_clock.h"
+
+typedef struct {
+    uint32_t due;                 // clock_us() deadline
+    uint32_t seq;                 // Queue order, breaks deadline ties
+    CanTransport* transport;
+    can_frame_t frame;
+} resp_entry_t;
+
+static resp_timing_profile_t profiles[RESP_TIMING_ECUS];
+static uint32_t last_due[RESP_TIMING_ECUS];   // Keeps each ECU's responses in order
+
+// heap[] holds entry indices, the earliest deadline at heap[0];
+// free_slots[] the entries not in use
+static resp_entry_t entries[RESP_QUEUE_DEPTH];
+static uint8_t heap[RESP_QUEUE_DEPTH];
+static uint8_t free_slots[RESP_QUEUE_DEPTH];
+static volatile uint8_t queue_count = 0;
+static uint32_t next_seq = 0;
+static volatile bool running = false;
+
+static uint32_t random_state = 0x6C8E9CF5;
+
+static uint32_t next_random(void) {
+    random_state ^= random_state << 13;   // xorshift32
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static int8_t ecu_index(uint8_t ecu) {
+    switch(ecu) {
+        case ECU_ECM:  return 0;
+        case ECU_TCM:  return 1;
+        case ECU_FPCM: return 2;
+        default:       return -1;
+    }
+}
+
+/*
+ * Delay for one response
+ */
+static uint32_t sample_delay(const resp_timing_profile_t* p) {
+    switch(p->type) {
+        case RESP_TIMING_UNIFORM:
+            return p->min_us + next_random() % (p->max_us - p->min_us + 1);
+
+        case RESP_TIMING_HISTOGRAM: {
+            uint16_t total = 0;
+            for(uint8_t i = 0; i < p->bins; i++) total += p->weights[i];
+
+            uint16_t pick = next_random() % total;
+            uint8_t bin = 0;
+            while(pick >= p->weights[bin]) {
+                pick -= p->weights[bin];
+                bin++;
+            }
+            return p->min_us + bin * p->bin_us + next_random() % p->bin_us;
+        }
+
+        default:
+            return p->min_us;
+    }
+}
+
+// Every response frame leaves through here; the first one after a
+// request ends the latency measurement (bus_load.h)
+static void resp_write(CanTransport* transport, const can_frame_t& frame) {
+    transport->write(frame);
+    bus_load_response_sent();
+}
+
+/*
+ * Deadline heap
+ */
+static bool earlier(uint8_t a, uint8_t b) {
+    int32_t diff = (int32_t)(entries[a].due - entries[b].due);
+    return diff < 0 || (diff == 0 && (int32_t)(entries[a].seq - entries[b].seq) < 0);
+}
+
+static void swap(uint8_t a, uint8_t b) {
+    uint8_t tmp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = tmp;
+}
+
+static void sift_up(uint8_t pos) {
+    while(pos > 0) {
+        uint8_t parent = (pos - 1) / 2;
+        if(!earlier(heap[pos], heap[parent])) break;
+        swap(pos, parent);
+        pos = parent;
+    }
+}
+
+static void sift_down(uint8_t pos) {
+    for(;;) {
+        uint8_t first = pos;
+        uint8_t left = pos * 2 + 1;
+        uint8_t right = left + 1;
+        if(left < queue_count && earlier(heap[left], heap[first])) first = left;
+        if(right < queue_count && earlier(heap[right], heap[first])) first = right;
+        if(first == pos) break;
+        swap(pos, first);
+        pos = first;
+    }
+}
+
+FLASHMEM void resp_timing_init(void) {
+    for(uint8_t i = 0; i < RESP_TIMING_ECUS; i++) {
+        memset(&profiles[i], 0, sizeof(profiles[i]));
+        profiles[i].type = RESP_TIMING_FIXED;
+        profiles[i].min_us = i * 5000;    // ECM 0, TCM 5 ms, FPCM 10 ms
+        last_due[i] = clock_us();
+    }
+    for(uint8_t i = 0; i < RESP_QUEUE_DEPTH; i++) {
+        free_slots[i] = i;
+    }
+    queue_count = 0;
+}
+
+bool resp_timing_set(uint8_t ecu_index, const resp_timing_profile_t* profile) {
+    if(ecu_index >= RESP_TIMING_ECUS) {
+        return false;
+    }
+    // Capping the longest delay also keeps the UNIFORM span (max - min + 1)
+    // from wrapping to zero and deadlines within the signed compare range
+    switch(profile->type) {
+        case RESP_TIMING_FIXED:
+            if(profile->min_us > RESP_TIMING_MAX_US) return false;
+            break;
+        case RESP_TIMING_UNIFORM:
+            if(profile->max_us < profile->min_us || profile->max_us > RESP_TIMING_MAX_US) return false;
+            break;
+        case RESP_TIMING_HISTOGRAM: {
+            uint16_t total = 0;
+            if(profile->bins == 0 || profile->bins > RESP_TIMING_BINS || profile->bin_us == 0) return false;
+            if(profile->min_us + (uint64_t)profile->bins * profile->bin_us > RESP_TIMING_MAX_US) return false;
+            for(uint8_t i = 0; i < profile->bins; i++) total += profile->weights[i];
+            if(total == 0) return false;
+            break;
+        }
+        default:
+            return false;
+    }
+
+    profiles[ecu_index] = *profile;
+    return true;
+}
+
+const resp_timing_profile_t* resp_timing_get(uint8_t ecu_index) {
+    return (ecu_index < RESP_TIMING_ECUS) ? &profiles[ecu_index] : NULL;
+}
+
+uint32_t resp_timing_send(CanTransport* transport, const can_frame_t& frame, uint8_t ecu, uint32_t request_us) {
+    int8_t index = ecu_index(ecu);
+    uint32_t delay = (index < 0) ? 0 : sample_delay(&profiles[index]);
+
+    return resp_timing_send_at(transport, frame, ecu, request_us + delay);
+}
+
+uint32_t resp_timing_send_at(CanTransport* transport, const can_frame_t& frame, uint8_t ecu, uint32_t due) {
+    int8_t index = ecu_index(ecu);
+
+    if(index < 0) {
+        resp_write(transport, frame);
+        return clock_us();
+    }
+    if((int32_t)(due - last_due[index]) < 0) {
+        due = last_due[index];
+    }
+    last_due[index] = due;
+
+    noInterrupts();               // The timer interrupt pops the heap
+    if(queue_count == RESP_QUEUE_DEPTH) {
+        interrupts();
+        resp_write(transport, frame);  // Late rather than lost
+        return clock_us();
+    }
+    uint8_t slot = free_slots[RESP_QUEUE_DEPTH - 1 - queue_count];
+    entries[slot].due = due;
+    entries[slot].seq = next_seq++;
+    entries[slot].transport = transport;
+    entries[slot].frame = frame;
+    heap[queue_count] = slot;
+    queue_count++;
+    sift_up(queue_count - 1);
+    interrupts();
+
+    resp_timing_run();            // Zero delay: out now
+    return due;
+}
+
+FASTRUN void resp_timing_run(void) {
+    noInterrupts();
+    if(running) {
+        interrupts();
+        return;  // The main loop pass in progress sends them, in order
+    }
+    running = true;
+
+    while(queue_count > 0 && (int32_t)(clock_us() - entries[heap[0]].due) >= 0) {
+        uint8_t slot = heap[0];
+        queue_count--;
+        heap[0] = heap[queue_count];
+        sift_down(0);
+        free_slots[RESP_QUEUE_DEPTH - 1 - queue_count] = slot;
+        interrupts();
+
+        // The slot is free again, but only resp_timing_send() reuses
+        // slots and it never runs inside this loop
+        resp_write(entries[slot].transport, entries[slot].frame);
+        noInterrupts();
+    }
+
+    running = false;
+    interrupts();
+}
+
+uint8_t resp_timing_pending(void) {
+    return queue_count;
+}
@@ -0,0 +1,78 @@
+#ifndef RESPONSE_TIMING_H
+#define RESPONSE_TIMING_H
+
+#include <Arduino.h>
+#include "can_transport.h"
+
+/*
+ * Per-ECU Response Timing (P2) Emulation
+ *
+ * Real ECUs answer a request 5-40 ms after it ends, each with its own
+ * characteristic spread; scan tool bugs often only show with that timing
+ * (a response arriving just inside P2, two ECUs answering out of order).
+ * Every simulated ECU carries a response-time profile:
+ *
+ * - FIXED:      always the same delay
+ * - UNIFORM:    any delay from min_us to max_us, equally likely
+ * - HISTOGRAM:  a delay distribution recorded from a real vehicle - bins
+ *               of bin_us from min_us on, weighted by how often responses
+ *               fell into each; uniform within the chosen bin
+ *
+ * A response is not sent from the request handler. The first frame of
+ * each response (the Single Frame, or the First Frame of a multi-frame
+ * response) goes into a deadline-ordered queue, due at the request's
+ * receive timestamp plus a delay drawn from the answering ECU's profile.
+ * Consecutive frames follow the tester's flow control as before.
+ *
+ * resp_timing_run() sends the frames that are due. It runs from the 1 ms
+ * timer interrupt and at the top of every main loop pass, so a response
+ * goes out within a millisecond of its deadline - usually within one loop
+ * pass - without the loop ever waiting. An ECU's responses never overtake
+ * each other: a response is due no earlier than the ECU's previous one.
+ * Different ECUs do overtake each other, as on a real bus.
+ *
+ * The defaults keep the simulator's historic staggering of multi-ECU
+ * answers: ECM at once, TCM after 5 ms, FPCM after 10 ms. Profiles are
+ * changed with resp_timing_set() or the host link (SET_RESPONSE_TIMING).
+ */
+
+#define RESP_TIMING_ECUS        3         // ECM, TCM, FPCM
+#define RESP_TIMING_BINS        32        // Histogram bins
+#define RESP_QUEUE_DEPTH        16        // Responses waiting for their deadline
+#define RESP_TIMING_MAX_US      10000000  // Longest delay a profile may produce (10 s)
+
+/*
+ * Profile types
+ */
+typedef enum {
+    RESP_TIMING_FIXED,
+    RESP_TIMING_UNIFORM,
+    RESP_TIMING_HISTOGRAM
+} resp_timing_type_t;
+
+typedef struct {
+    uint8_t type;                 // resp_timing_type_t
+    uint32_t min_us;              // FIXED: the delay; UNIFORM, HISTOGRAM: shortest delay
+    uint32_t max_us;              // UNIFORM: longest delay
+    uint32_t bin_us;              // HISTOGRAM: bin width
+    uint8_t bins;                 // HISTOGRAM: bins used
+    uint8_t weights[RESP_TIMING_BINS];  // HISTOGRAM: relative frequency per bin
+} resp_timing_profile_t;
+
+/*
+ * Response Timing Interface
+ */
+void resp_timing_init(void);                    // Default profiles, empty queue
+bool resp_timing_set(uint8_t ecu_index, const resp_timing_profile_t* profile);  // False if invalid or too long
+const resp_timing_profile_t* resp_timing_get(uint8_t ecu_index);
+
+// Send a response's first frame once the ECU's (ECU_ECM ...) delay after
+// request_us has passed; other ECU values send at once. Both return the
+// clock_us() time the frame is due on the bus (now if sent at once).
+uint32_t resp_timing_send(CanTransport* transport, const can_frame_t& frame, uint8_t ecu, uint32_t request_us);
+// The same at a given clock_us() deadline, without the profile's delay
+uint32_t resp_timing_send_at(CanTransport* transport, const can_frame_t& frame, uint8_t ecu, uint32_t due);
+void resp_timing_run(void);                     // Send due frames (timer interrupt, main loop)
+uint8_t resp_timing_pending(void);              // Frames waiting for their deadline
+
+#endif // RESPONSE_TIMING_H
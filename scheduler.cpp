@@ -0,0 +1,98 @@
+/*
+ * Cooperative Main Loop Scheduler
+ *
+ * Task table, deadline checks and the idle sleep. See scheduler.h.
+ */
+
+#include "scheduler.h"
+#include "sim_clock.h"
+
+typedef struct {
+    sched_task_fn fn;
+    uint32_t period_ms;           // 0 = one-shot
+    uint32_t due;                 // clock_ms() deadline
+    bool armed;                   // Waiting for its deadline
+} sched_task_t;
+
+static sched_task_t tasks[SCHED_TASKS];
+static uint8_t task_count = 0;
+static sched_poll_fn poll_fn = NULL;
+
+static uint32_t slept_ms = 0;
+static uint32_t slept_us = 0;     // Below one millisecond, carried over
+
+int8_t sched_add(sched_task_fn fn, uint32_t period_ms) {
+    if(task_count >= SCHED_TASKS) {
+        return -1;
+    }
+    sched_task_t* task = &tasks[task_count];
+    task->fn = fn;
+    task->period_ms = period_ms;
+    task->due = clock_ms() + period_ms;
+    task->armed = (period_ms != 0);
+    return task_count++;
+}
+
+void sched_after(int8_t task, uint32_t delay_ms) {
+    if(task < 0 || task >= task_count) {
+        return;
+    }
+    tasks[task].due = clock_ms() + delay_ms;
+    tasks[task].armed = true;
+}
+
+void sched_set_poll(sched_poll_fn poll) {
+    poll_fn = poll;
+}
+
+/*
+ * Halt until the next interrupt. Interrupts are masked around the check
+ * so one arriving just before WFI still ends the sleep at once. In
+ * virtual time the next interrupt is the next tick, reached at once.
+ */
+static void sched_sleep(void) {
+#if defined(ARDUINO) || SIM_CLOCK_VIRTUAL
+    uint32_t start = clock_us();
+
+#if SIM_CLOCK_VIRTUAL
+    clock_advance_to_tick();
+#else
+    noInterrupts();
+    asm volatile("dsb\n\twfi" ::: "memory");
+    interrupts();
+#endif
+
+    slept_us += clock_us() - start;
+    slept_ms += slept_us / 1000;
+    slept_us %= 1000;
+#endif
+}
+
+void sched_run(void) {
+    uint32_t now = clock_ms();
+
+    for(uint8_t i = 0; i < task_count; i++) {
+        sched_task_t* task = &tasks[i];
+        if(!task->armed || (int32_t)(now - task->due) < 0) {
+            continue;
+        }
+        if(task->period_ms == 0) {
+            task->armed = false;
+        } else {
+            task->due += task->period_ms;
+            if((int32_t)(now - task->due) >= 0) {
+                task->due = now + task->period_ms;  // Skip missed runs
+            }
+        }
+        task->fn();
+    }
+
+    if(poll_fn != NULL && poll_fn() != 0) {
+        return;  // More to do at once
+    }
+    sched_sleep();
+}
+
+uint32_t sched_sleep_ms(void) {
+    return slept_ms;
+}
@@ -0,0 +1,54 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+
+/*
+ * Cooperative Main Loop Scheduler
+ *
+ * Runs the main loop's work as tasks with millisecond deadlines instead
+ * of tick counters bumped by the timer interrupt:
+ *
+ * - periodic tasks run every period_ms (heartbeat LED, potentiometers)
+ * - one-shot tasks run once, delay_ms after sched_after() arms them
+ *   (request LED off); re-arming pushes the deadline back
+ * - the poll function (ecu_sim.update()) runs on every pass
+ *
+ * Deadlines are taken from clock_ms() (sim_clock.h), which the main loop
+ * reads atomically, so no counter is shared between the interrupt and
+ * the main loop. A periodic task's next deadline follows from its
+ * previous one, so lateness does not accumulate; a task more than one
+ * period behind skips the missed runs.
+ *
+ * SLEEP:
+ * When the poll function reports nothing left to do, sched_run() halts
+ * the core with WFI until the next interrupt: the 1 ms system tick and
+ * timer tick (which also send the periodic broadcasts and due responses),
+ * or USB serial. Every deadline is a whole millisecond, so no task runs
+ * late, and a received CAN frame is picked up within a millisecond; its
+ * hardware receive timestamp keeps response timing (response_timing.h)
+ * exact. While frames keep arriving, or an ISO-TP transfer is sending
+ * back-to-back consecutive frames, the poll function reports work and
+ * the loop runs flat out, as before.
+ *
+ * Tasks run in the main loop, not in interrupt context. Add them in
+ * setup().
+ */
+
+#define SCHED_TASKS             8         // Task capacity
+
+typedef void (*sched_task_fn)(void);
+typedef uint8_t (*sched_poll_fn)(void);  // Nonzero = more work, don't sleep
+
+/*
+ * Scheduler Interface
+ */
+// Add a task running every period_ms, or a one-shot task armed by
+// sched_after() if period_ms is 0; returns the task, -1 when full
+int8_t sched_add(sched_task_fn fn, uint32_t period_ms);
+void sched_after(int8_t task, uint32_t delay_ms);  // Next run delay_ms from now
+void sched_set_poll(sched_poll_fn poll);  // Called every pass
+void sched_run(void);                     // One pass; sleeps when idle (loop())
+uint32_t sched_sleep_ms(void);            // Time spent halted since power-up
+
+#endif // SCHEDULER_H
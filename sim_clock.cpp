@@ -0,0 +1,39 @@
+/*
+ * Simulator Clock
+ *
+ * Virtual time for off-target builds. See sim_clock.h.
+ */
+
+#include "sim_clock.h"
+
+#if SIM_CLOCK_VIRTUAL
+
+uint64_t clock_now_us = 0;
+static clock_tick_fn tick_fn = NULL;
+
+void clock_set_us(uint64_t us) {
+    clock_now_us = us;
+}
+
+void clock_set_tick(clock_tick_fn fn) {
+    tick_fn = fn;
+}
+
+void clock_advance_us(uint32_t us) {
+    uint64_t end = clock_now_us + us;
+
+    // Stop at each millisecond so the tick sees the time it would on hardware
+    for(uint64_t next = (clock_now_us / 1000 + 1) * 1000; next <= end; next += 1000) {
+        clock_now_us = next;
+        if(tick_fn != NULL) {
+            tick_fn();
+        }
+    }
+    clock_now_us = end;
+}
+
+void clock_advance_to_tick(void) {
+    clock_advance_us(1000 - (uint32_t)(clock_now_us % 1000));
+}
+
+#endif // SIM_CLOCK_VIRTUAL
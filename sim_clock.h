@@ -0,0 +1,76 @@
+#ifndef SIM_CLOCK_H
+#define SIM_CLOCK_H
+
+#include <Arduino.h>
+
+/*
+ * Simulator Clock
+ *
+ * Every timer in the simulator reads the time through clock_ms() and
+ * clock_us() instead of calling millis() and micros() directly. That
+ * covers the ISO-TP timeouts, the driving simulation step, the monitor
+ * and IUMPR updates, the UDS S3 timer, the scheduler's deadlines and
+ * response timing. On the Teensy the two functions are millis() and
+ * micros(), inlined, so nothing changes there.
+ *
+ * VIRTUAL TIME (off-target builds, not provided in this tree):
+ * With SIM_CLOCK_VIRTUAL set to 1, time is a counter that moves only
+ * when it is advanced:
+ *
+ * - clock_advance_us() steps it. At every millisecond it crosses it calls
+ *   the tick function (clock_set_tick), which stands in for the sketch's
+ *   1 ms timer interrupt.
+ * - The scheduler's idle sleep (scheduler.h) jumps straight to the next
+ *   millisecond instead of waiting for it.
+ *
+ * A loop calling sched_run() therefore runs the simulator as fast as the
+ * CPU allows, and every timer sees the same sequence of times it would
+ * see on the bench. Such a build also needs Arduino and FlexCAN_T4 shims,
+ * which are not part of the tree. With a looping drive cycle (drive_cycle.h) each
+ * pass is an ignition cycle, so IUMPR counts build up over many simulated
+ * drive cycles in one run. clock_set_us() starts the clock anywhere,
+ * for example just before the 49.7-day wrap of the millisecond count.
+ *
+ * Both counts wrap like millis() and micros(). Compare times by
+ * subtraction, never by magnitude.
+ */
+
+#ifndef SIM_CLOCK_VIRTUAL
+#define SIM_CLOCK_VIRTUAL       0         // 1 = virtual time (off-target builds)
+#endif
+
+#if SIM_CLOCK_VIRTUAL
+
+typedef void (*clock_tick_fn)(void);
+
+extern uint64_t clock_now_us;             // Virtual time since power-up
+
+static inline uint32_t clock_ms(void) {
+    return (uint32_t)(clock_now_us / 1000);
+}
+
+static inline uint32_t clock_us(void) {
+    return (uint32_t)clock_now_us;
+}
+
+/*
+ * Virtual Clock Interface
+ */
+void clock_set_us(uint64_t us);           // Jump to a time; no ticks run
+void clock_set_tick(clock_tick_fn fn);    // Run at every whole millisecond
+void clock_advance_us(uint32_t us);       // Move time on, running the ticks
+void clock_advance_to_tick(void);         // Move on to the next millisecond
+
+#else
+
+static inline uint32_t clock_ms(void) {
+    return millis();
+}
+
+static inline uint32_t clock_us(void) {
+    return micros();
+}
+
+#endif // SIM_CLOCK_VIRTUAL
+
+#endif // SIM_CLOCK_H
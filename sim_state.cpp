@@ -0,0 +1,254 @@
+/*
+ * Simulated Powertrain State - Driving Simulation
+ *
+ * Realistic driving simulation with five states (IDLE, CITY, ACCELERATING,
+ * HIGHWAY, BRAKING), based on logged data from a Mercedes-Benz GLE-Class.
+ * All dynamic Mode 01 values live in sim_state so that they can be
+ * snapshotted as a whole into a freeze frame.
+ *
+ * A drive cycle (drive_cycle.h), when one is selected, replaces
+ * the random states and drives speed, RPM, load, throttle and MAF.
+ */
+
+#include "sim_state.h"
+#include "ecu_sim.h"
+#include "nv_store.h"
+#include "sim_clock.h"
+#include "drive_cycle.h"
+#include "monitors.h"
+#include "iumpr.h"
+
+sim_state_t sim_state = {
+    0x0990,     // engine_rpm: 612 RPM idle
+    0x0099,     // maf_airflow: scales with RPM
+    0x00,       // vehicle_speed: stationary
+    0x3E,       // engine_load: ~24%
+    0x1E,       // throttle_position: 11.8%
+    0x80,       // o2_voltage: oscillates once simulation runs
+    0x87,       // coolant_temp: 95°C (from Mercedes)
+    IDLE,       // drive_state
+    false,      // mil_on
+    0,          // dtc_count
+    { 0x07, 0x00, 0x00 },   // monitor_status: set by monitor engine
+    { 0x07, 0x00, 0x00 },   // monitor_cycle: set by monitor engine
+    0,          // warm_ups: counters below are derived from sim_counters
+    0,          // run_time
+    0,          // distance_mil
+    0,          // distance_clear
+    0,          // time_mil
+    0           // time_clear
+};
+
+sim_counters_t sim_counters;     // Zero until restored from NV storage
+
+static uint16_t held_value[SIG_COUNT];
+static uint8_t held_mask = 0;             // Bit per SimSignal
+static bool drive_state_pinned = false;
+
+/*
+ * Write a raw value into its sim_state field
+ */
+static void sim_state_write_signal(uint8_t signal, uint16_t raw) {
+    switch(signal) {
+        case SIG_ENGINE_RPM:    sim_state.engine_rpm = raw; break;
+        case SIG_VEHICLE_SPEED: sim_state.vehicle_speed = raw; break;
+        case SIG_ENGINE_LOAD:   sim_state.engine_load = raw; break;
+        case SIG_THROTTLE:      sim_state.throttle_position = raw; break;
+        case SIG_O2_VOLTAGE:    sim_state.o2_voltage = raw; break;
+        case SIG_COOLANT_TEMP:  sim_state.coolant_temp = raw; break;
+        case SIG_MAF_AIRFLOW:   sim_state.maf_airflow = raw; break;
+    }
+}
+
+// Held values override whatever the simulation step produced
+static void sim_state_apply_held(void) {
+    for(uint8_t i = 0; i < SIG_COUNT; i++) {
+        if(held_mask & (1 << i)) sim_state_write_signal(i, held_value[i]);
+    }
+}
+
+bool sim_state_hold_signal(uint8_t signal, uint16_t raw) {
+    if(signal >= SIG_COUNT) {
+        return false;
+    }
+    held_value[signal] = raw;
+    held_mask |= (1 << signal);
+    sim_state_write_signal(signal, raw);
+    return true;
+}
+
+void sim_state_release_signal(uint8_t signal) {
+    if(signal == SIG_ALL) {
+        held_mask = 0;
+    } else if(signal < SIG_COUNT) {
+        held_mask &= ~(1 << signal);
+    }
+}
+
+bool sim_state_set_drive_state(uint8_t state) {
+    if(state != DRIVE_STATE_AUTO && state > BRAKING) {
+        return false;
+    }
+    drive_cycle_select(DRIVE_CYCLE_NONE, false);  // States replace a drive cycle
+
+    if(state == DRIVE_STATE_AUTO) {
+        drive_state_pinned = false;
+        return true;
+    }
+    sim_state.drive_state = state;
+    drive_state_pinned = true;
+    return true;
+}
+
+static uint32_t run_time_s = 0;         // Since engine start, not persisted
+static bool warmed_up = false;          // This ignition cycle
+
+/*
+ * Advance the distance and run-time counters by the elapsed time
+ * Fractions of a metre and of a second carry over to the next step.
+ */
+static void sim_counters_update(uint32_t elapsed_ms) {
+    static uint32_t distance_rem = 0;   // km/h x ms; 3600 = 1 metre
+    static uint32_t time_rem = 0;       // ms
+
+    distance_rem += (uint32_t)sim_state.vehicle_speed * elapsed_ms;
+    uint32_t metres = distance_rem / 3600;
+    distance_rem %= 3600;
+
+    time_rem += elapsed_ms;
+    uint32_t seconds = time_rem / 1000;
+    time_rem %= 1000;
+
+    run_time_s += seconds;
+    sim_counters.distance_clear_m += metres;
+    sim_counters.time_clear_s += seconds;
+    if(sim_state.mil_on) {
+        sim_counters.distance_mil_m += metres;
+        sim_counters.time_mil_s += seconds;
+    }
+
+    // One warm-up per ignition cycle, when coolant reaches 70°C
+    if(!warmed_up && sim_state.coolant_temp >= (70 + 40)) {
+        warmed_up = true;
+        if(sim_counters.warm_ups < 0xFF) sim_counters.warm_ups++;
+    }
+
+    if(metres || seconds) {
+        nv_mark_dirty(false);  // Saved periodically, not on every step
+    }
+
+    // Reported values saturate at their PID maximum
+    sim_state.warm_ups = sim_counters.warm_ups;
+    sim_state.run_time = min(run_time_s, (uint32_t)0xFFFF);
+    sim_state.distance_mil = min(sim_counters.distance_mil_m / 1000, (uint32_t)0xFFFF);
+    sim_state.distance_clear = min(sim_counters.distance_clear_m / 1000, (uint32_t)0xFFFF);
+    sim_state.time_mil = min(sim_counters.time_mil_s / 60, (uint32_t)0xFFFF);
+    sim_state.time_clear = min(sim_counters.time_clear_s / 60, (uint32_t)0xFFFF);
+}
+
+void sim_counters_clear(void) {
+    sim_counters.distance_mil_m = 0;
+    sim_counters.distance_clear_m = 0;
+    sim_counters.time_mil_s = 0;
+    sim_counters.time_clear_s = 0;
+    sim_counters.warm_ups = 0;
+    sim_counters_update(0);
+}
+
+void sim_state_ignition_cycle(void) {
+    run_time_s = 0;
+    warmed_up = false;
+    sim_counters_update(0);
+    monitors_ignition_cycle();
+    iumpr_ignition_cycle();
+}
+
+void sim_state_update(void) {
+    static uint32_t stateChangeTime = 0;
+    static uint32_t lastUpdate = 0;
+    static bool started = false;
+
+    // Time is counted from the first call, wherever the clock started
+    // (sim_clock.h can start it just before the millisecond wrap)
+    if(!started) {
+        stateChangeTime = lastUpdate = clock_ms();
+        started = true;
+    }
+
+    // MIL and DTC count follow the stored emissions DTCs
+    sim_state.mil_on = (ecu.dtc != 0);
+    sim_state.dtc_count = ecu.dtc ? 2 : 0;
+
+    // Update driving state every few seconds
+    if(!drive_state_pinned && drive_cycle_current() == DRIVE_CYCLE_NONE &&
+       clock_ms() - stateChangeTime > 10000) {  // Change state every 10 seconds
+        sim_state.drive_state = random(0, 5);
+        stateChangeTime = clock_ms();
+    }
+
+    // Update values based on driving state (every 100ms for smooth changes)
+    if(clock_ms() - lastUpdate <= 100) {
+        return;
+    }
+
+    // Count the distance covered at the previous speed
+    sim_counters_update(clock_ms() - lastUpdate);
+
+    // A drive cycle sets the driving values itself
+    if(!drive_cycle_step(clock_ms() - lastUpdate, &sim_state)) {
+        switch(sim_state.drive_state) {
+            case IDLE:
+                // Idle: 600-650 RPM, 0 km/h
+                sim_state.engine_rpm = 0x0990 + random(-20, 30);  // 600-650 RPM
+                sim_state.vehicle_speed = 0x00;
+                sim_state.engine_load = 0x3D + random(-2, 3);     // ~24%
+                sim_state.throttle_position = 0x1E;               // 11.8%
+                break;
+
+            case CITY:
+                // City: 1000-1500 RPM, 15-50 km/h
+                sim_state.engine_rpm = 0x0FA0 + random(-50, 100);  // ~1000-1500 RPM
+                sim_state.vehicle_speed = 0x0F + random(0, 0x23);  // 15-50 km/h
+                sim_state.engine_load = 0x50 + random(-5, 10);     // ~35%
+                sim_state.throttle_position = 0x40;                // 25%
+                break;
+
+            case ACCELERATING:
+                // Accelerating: 1800-2500 RPM, increasing speed
+                sim_state.engine_rpm = 0x1C20 + random(-100, 200);  // 1800-2500 RPM
+                if(sim_state.vehicle_speed < 0x50) sim_state.vehicle_speed += 2;  // Increase speed
+                sim_state.engine_load = 0x80 + random(-10, 10);     // ~50%
+                sim_state.throttle_position = 0x80;                 // 50%
+                break;
+
+            case HIGHWAY:
+                // Highway: 1600-1700 RPM, 78-79 km/h (from Mercedes data)
+                sim_state.engine_rpm = 0x1900 + random(-50, 50);    // ~1600 RPM
+                sim_state.vehicle_speed = 0x4E + random(-1, 2);     // 78-79 km/h
+                sim_state.engine_load = 0x60 + random(-5, 5);       // ~38%
+                sim_state.throttle_position = 0x4A;                 // 29%
+                break;
+
+            case BRAKING:
+                // Braking: decreasing RPM and speed
+                if(sim_state.engine_rpm > 0x0990) sim_state.engine_rpm -= 0x50;  // Decrease RPM
+                if(sim_state.vehicle_speed >= 3) sim_state.vehicle_speed -= 3;   // Decrease speed
+                    else sim_state.vehicle_speed = 0;
+                sim_state.engine_load = 0x20;                       // Low load
+                sim_state.throttle_position = 0x00;                 // 0% throttle
+                break;
+        }
+
+        // MAF scales with RPM - typical 2-25 g/s
+        sim_state.maf_airflow = (sim_state.engine_rpm >> 4) + random(-5, 6);
+    }
+
+    // O2 sensor oscillation (rich/lean cycling around stoichiometric)
+    // Formula: Voltage = A × 0.005V per SAE J1979
+    // Target: 0.35V-0.55V (70-110 decimal) for proper closed-loop operation
+    sim_state.o2_voltage = 0x46 + random(0, 0x28);  // 0x46=70, range 40 = 70-110 = 0.35V-0.55V
+
+    sim_state_apply_held();
+
+    lastUpdate = clock_ms();
+}
@@ -0,0 +1,142 @@
+#ifndef SIM_STATE_H
+#define SIM_STATE_H
+
+#include <Arduino.h>
+
+/*
+ * Simulated Powertrain State
+ *
+ * Every live value reported through Mode 01 is held in a single flat
+ * structure. The driving simulation updates it in place, and a freeze
+ * frame is simply a copy of it taken when a DTC is set. Because Mode 01
+ * and Mode 02 both encode PIDs from a sim_state_t, a freeze frame can
+ * answer any PID that Mode 01 supports, with identical scaling.
+ *
+ * Keep this structure small and free of pointers: freeze frame capture
+ * is a single struct assignment and runs inside the fault detection path.
+ */
+typedef struct {
+        uint16_t engine_rpm;          // PID 0x0C raw value (RPM x 4)
+        uint16_t maf_airflow;         // PID 0x10 raw value (g/s x 100)
+        uint8_t vehicle_speed;        // PID 0x0D (km/h)
+        uint8_t engine_load;          // PID 0x04 (A x 100 / 255 %)
+        uint8_t throttle_position;    // PID 0x11 (A x 100 / 255 %)
+        uint8_t o2_voltage;           // PID 0x14/0x15 (A x 0.005 V)
+        uint8_t coolant_temp;         // PID 0x05 (A - 40 degC)
+        uint8_t drive_state;          // Simulation state (IDLE, CITY, ...)
+        bool mil_on;                  // PID 0x01 byte A bit 7
+        uint8_t dtc_count;            // PID 0x01 byte A bits 0-6
+        uint8_t monitor_status[3];    // PID 0x01 bytes B-D (readiness since clear)
+        uint8_t monitor_cycle[3];     // PID 0x41 bytes B-D (this drive cycle)
+        uint8_t warm_ups;             // PID 0x30 (count since DTCs cleared)
+        uint16_t run_time;            // PID 0x1F (s since engine start)
+        uint16_t distance_mil;        // PID 0x21 (km with MIL on)
+        uint16_t distance_clear;      // PID 0x31 (km since DTCs cleared)
+        uint16_t time_mil;            // PID 0x4D (min with MIL on)
+        uint16_t time_clear;          // PID 0x4E (min since DTCs cleared)
+} sim_state_t;
+
+/*
+ * Distance and Run-Time Counters
+ *
+ * Full-resolution accumulators behind PIDs 0x21, 0x30, 0x31, 0x4D and
+ * 0x4E. They are kept in non-volatile storage (nv_store.h) so they carry
+ * across power cycles; sim_state holds the scaled, saturated values that
+ * Mode 01 reports.
+ */
+typedef struct {
+        uint32_t distance_mil_m;      // Metres driven with MIL on
+        uint32_t distance_clear_m;    // Metres driven since DTCs cleared
+        uint32_t time_mil_s;          // Engine run time with MIL on (s)
+        uint32_t time_clear_s;        // Engine run time since DTCs cleared (s)
+        uint8_t warm_ups;             // Warm-up cycles since DTCs cleared
+} sim_counters_t;
+
+// Driving simulation states
+enum DriveState { IDLE, CITY, ACCELERATING, HIGHWAY, BRAKING };
+#define DRIVE_STATE_AUTO    0xFF        // Random state changes every 10 s
+
+/*
+ * Held Signals
+ *
+ * An external controller (host_link.h) can pin a live value: the driving
+ * simulation keeps running but the held value replaces its output until
+ * released. Values are raw PID encodings, as stored in sim_state.
+ */
+enum SimSignal {
+        SIG_ENGINE_RPM,               // engine_rpm (RPM x 4)
+        SIG_VEHICLE_SPEED,            // vehicle_speed (km/h)
+        SIG_ENGINE_LOAD,              // engine_load
+        SIG_THROTTLE,                 // throttle_position
+        SIG_O2_VOLTAGE,               // o2_voltage
+        SIG_COOLANT_TEMP,             // coolant_temp
+        SIG_MAF_AIRFLOW,              // maf_airflow
+        SIG_COUNT
+};
+#define SIG_ALL             0xFF        // sim_state_release_signal(): every signal
+
+extern sim_state_t sim_state;    // Live state, updated by sim_state_update()
+extern sim_counters_t sim_counters;  // Persistent counters, updated with sim_state
+
+/*
+ * Advance the driving simulation
+ * Called from ecu_simClass::update() on every pass of the main loop;
+ * values change every 100ms, driving state every 10 seconds.
+ */
+void sim_state_update(void);
+
+/*
+ * Hold a signal at a raw value (takes effect at once), or release it
+ * back to the simulation. Returns false for an unknown signal.
+ */
+bool sim_state_hold_signal(uint8_t signal, uint16_t raw);
+void sim_state_release_signal(uint8_t signal);
+
+/*
+ * Pin the driving state (IDLE ... BRAKING), or DRIVE_STATE_AUTO to
+ * resume random changes. Returns false for an unknown state.
+ */
+bool sim_state_set_drive_state(uint8_t state);
+
+/*
+ * Reset the counters that Mode 04 clears (distance, time and warm-ups
+ * since DTCs cleared, distance and time with MIL on)
+ */
+void sim_counters_clear(void);
+
+/*
+ * Simulated key-off/key-on: run time restarts, the next warm-up counts,
+ * the monitors run again (monitors_ignition_cycle) and IUMPR starts a new
+ * ignition and drive cycle (iumpr_ignition_cycle). Power-up is the first.
+ */
+void sim_state_ignition_cycle(void);
+
+/*
+ * Mode 01 PID Encoder (modes/mode_01.cpp)
+ *
+ * Writes the data bytes for a Mode 01 PID, as they appear after the
+ * "41 PID" header, from the given state. Shared by Mode 01 (live state)
+ * and Mode 02 (freeze frame snapshot).
+ *
+ * Returns the number of data bytes written (at most 4),
+ * or 0 if the PID is not supported by the engine ECU.
+ */
+uint8_t mode01_encode_pid(const sim_state_t* state, uint8_t pid, uint8_t* data);
+
+/*
+ * Mode 01 Response Cache (modes/mode_01.cpp)
+ *
+ * mode01_read_pid() returns the live state's encoding of a PID, as
+ * mode01_encode_pid(&sim_state, ...) would, from a cache rebuilt only
+ * when sim_state changes. mode01_cache_refresh() rebuilds it if stale;
+ * ecu_simClass::update() calls it every pass.
+ */
+void mode01_cache_refresh(void);
+uint8_t mode01_read_pid(uint8_t pid, uint8_t* data);
+
+/*
+ * True if the engine ECU's supported-PID bitmaps list the Mode 01 PID
+ */
+bool mode_01_supports(uint8_t pid);
+
+#endif // SIM_STATE_H
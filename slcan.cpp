@@ -0,0 +1,256 @@
+/*
+ * SLCAN (Lawicel) Gateway
+ *
+ * Command parser, frame queue and batched output. See slcan.h.
+ */
+
+#include "slcan.h"
+#include "ecu_sim.h"
+#include "memory_map.h"
+#include "sim_clock.h"
+
+#if USE_SLCAN
+
+typedef struct {
+    uint32_t id;
+    uint32_t time_us;
+    uint8_t len;
+    bool extended;
+    uint8_t data[CAN_MAX_LEN];
+} slcan_frame_t;
+
+DMAMEM static slcan_frame_t queue[SLCAN_QUEUE_DEPTH];
+static volatile uint16_t queue_head = 0;
+static volatile uint16_t queue_count = 0;
+
+static can_frame_t inject[SLCAN_INJECT_DEPTH];
+static uint8_t inject_head = 0;
+static uint8_t inject_count = 0;
+static can_frame_t sending;               // PC frame being written; not echoed
+
+static char line[SLCAN_LINE_MAX];
+static uint8_t line_len = 0;
+static char batch[SLCAN_BATCH_MAX];
+static uint16_t batch_len = 0;
+
+static bool channel_open = false;
+static bool listen_only = false;
+static bool timestamps = false;
+static uint8_t status_flags = 0;          // SLCAN_FLAG_*, cleared by 'F'
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+/*
+ * Frame tap: queue the gateway bus's traffic while the channel is open
+ */
+static void slcan_tap(CanTransport* transport, const can_frame_t& frame, bool tx) {
+    if(!channel_open || transport != can_transports[SLCAN_BUS] || &frame == &sending) {
+        return;
+    }
+    if(frame.len > CAN_MAX_LEN) {
+        return;  // CAN FD - no SLCAN form
+    }
+
+    noInterrupts();               // Main loop and timer interrupt both send
+    if(queue_count == SLCAN_QUEUE_DEPTH) {
+        status_flags |= SLCAN_FLAG_OVERRUN;
+    } else {
+        slcan_frame_t* entry = &queue[(queue_head + queue_count) % SLCAN_QUEUE_DEPTH];
+        entry->id = frame.id;
+        entry->time_us = tx ? clock_us() : frame.time_us;
+        entry->len = frame.len;
+        entry->extended = frame.extended;
+        memcpy(entry->data, frame.buf, frame.len);
+        queue_count++;
+    }
+    interrupts();
+}
+
+/*
+ * Output batch
+ */
+static void put_hex(uint32_t value, uint8_t digits) {
+    while(digits-- > 0) {
+        batch[batch_len++] = hex_digits[(value >> (digits * 4)) & 0x0F];
+    }
+}
+
+static void put_reply(const char* text) {
+    while(*text && batch_len < SLCAN_BATCH_MAX) batch[batch_len++] = *text++;
+}
+
+// tiiildd..[tttt]\r or Tiiiiiiiildd..[tttt]\r
+static void put_frame(const slcan_frame_t* frame) {
+    batch[batch_len++] = frame->extended ? 'T' : 't';
+    put_hex(frame->id, frame->extended ? 8 : 3);
+    put_hex(frame->len, 1);
+    for(uint8_t i = 0; i < frame->len; i++) {
+        put_hex(frame->data[i], 2);
+    }
+    if(timestamps) {
+        put_hex((frame->time_us / 1000) % 60000, 4);
+    }
+    batch[batch_len++] = '\r';
+}
+
+static bool parse_hex(const char* text, uint8_t digits, uint32_t* value) {
+    *value = 0;
+    for(uint8_t i = 0; i < digits; i++) {
+        char c = text[i];
+        uint8_t nibble;
+        if(c >= '0' && c <= '9') nibble = c - '0';
+        else if(c >= 'A' && c <= 'F') nibble = c - 'A' + 10;
+        else if(c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+        else return false;
+        *value = (*value << 4) | nibble;
+    }
+    return true;
+}
+
+/*
+ * 't'/'T': send on the bus and pass to the simulated ECUs
+ */
+static bool slcan_transmit(bool extended) {
+    uint8_t id_digits = extended ? 8 : 3;
+    uint32_t id, len, byte;
+
+    if(!channel_open || listen_only || line_len < 2 + id_digits) {
+        return false;
+    }
+    if(!parse_hex(&line[1], id_digits, &id) || !parse_hex(&line[1 + id_digits], 1, &len) ||
+       len > CAN_MAX_LEN || line_len != 2 + id_digits + len * 2) {
+        return false;
+    }
+    if(id > (extended ? 0x1FFFFFFFUL : 0x7FFUL)) {
+        return false;
+    }
+
+    sending.id = id;
+    sending.extended = extended;
+    sending.fd = false;
+    sending.len = len;
+    for(uint8_t i = 0; i < len; i++) {
+        if(!parse_hex(&line[2 + id_digits + i * 2], 2, &byte)) return false;
+        sending.buf[i] = byte;
+    }
+    sending.time_us = clock_us();
+
+    if(can_channels[SLCAN_BUS].link.detecting) {
+        return false;  // Listen-only until the bit rate is known
+    }
+    can_transports[SLCAN_BUS]->write(sending);
+
+    if(inject_count < SLCAN_INJECT_DEPTH) {
+        inject[(inject_head + inject_count) % SLCAN_INJECT_DEPTH] = sending;
+        inject_count++;
+    }
+    return true;
+}
+
+/*
+ * Execute one command line (without the CR)
+ */
+static void slcan_command(void) {
+    char flags[5];
+    bool ok = true;
+
+    switch(line[0]) {
+        case 'S':                         // Bit rate: the simulator's
+            ok = (line_len == 2 && line[1] >= '0' && line[1] <= '8');
+            break;
+        case 'O':
+        case 'L':
+            noInterrupts();           // Start from an empty queue
+            queue_head = queue_count = 0;
+            interrupts();
+            channel_open = true;
+            listen_only = (line[0] == 'L');
+            break;
+        case 'C':
+            channel_open = false;
+            break;
+        case 'Z':
+            ok = (line_len == 2 && (line[1] == '0' || line[1] == '1'));
+            if(ok) timestamps = (line[1] == '1');
+            break;
+        case 'M':                         // Acceptance filters: everything passes
+        case 'm':
+            break;
+        case 'V':
+            put_reply("V1013");
+            break;
+        case 'N':
+            put_reply("NT40S");
+            break;
+        case 'F':
+            flags[0] = 'F';
+            flags[1] = hex_digits[status_flags >> 4];
+            flags[2] = hex_digits[status_flags & 0x0F];
+            flags[3] = '\0';
+            put_reply(flags);
+            status_flags = 0;
+            break;
+        case 't':
+            ok = slcan_transmit(false);
+            if(ok) put_reply("z");
+            break;
+        case 'T':
+            ok = slcan_transmit(true);
+            if(ok) put_reply("Z");
+            break;
+        default:                          // 's', 'r', 'R' and the rest
+            ok = false;
+            break;
+    }
+    put_reply(ok ? "\r" : "\a");
+}
+
+FLASHMEM void slcan_init(void) {
+    can_tap_add(slcan_tap);
+}
+
+void slcan_update(void) {
+    // Commands: only the bytes already here
+    int available = SLCAN_PORT.available();
+    while(available-- > 0) {
+        char c = SLCAN_PORT.read();
+        if(c == '\r') {
+            if(line_len > 0) slcan_command();
+            line_len = 0;
+        } else if(c != '\n' && line_len < SLCAN_LINE_MAX) {
+            line[line_len++] = c;
+        }
+    }
+
+    // Frames, as many as the USB buffer takes in one write
+    int room = min(SLCAN_PORT.availableForWrite(), SLCAN_BATCH_MAX);
+    while(queue_count > 0) {
+        if(batch_len + 1 + 8 + 1 + 16 + 4 + 1 > room) break;  // Longest frame line
+        put_frame(&queue[queue_head]);
+
+        noInterrupts();
+        queue_head = (queue_head + 1) % SLCAN_QUEUE_DEPTH;
+        queue_count--;
+        interrupts();
+    }
+    if(batch_len > 0 && batch_len <= room) {
+        SLCAN_PORT.write((const uint8_t*)batch, batch_len);
+        batch_len = 0;
+    }
+}
+
+bool slcan_take(can_frame_t& frame) {
+    if(inject_count == 0) {
+        return false;
+    }
+    frame = inject[inject_head];
+    inject_head = (inject_head + 1) % SLCAN_INJECT_DEPTH;
+    inject_count--;
+    return true;
+}
+
+#else
+void slcan_init(void) {}
+void slcan_update(void) {}
+bool slcan_take(can_frame_t& frame) { return false; }
+#endif
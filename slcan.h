@@ -0,0 +1,67 @@
+#ifndef SLCAN_H
+#define SLCAN_H
+
+#include <Arduino.h>
+#include "can_transport.h"
+
+/*
+ * SLCAN (Lawicel) Gateway
+ *
+ * With USE_SLCAN set to 1 the Teensy also shows up on the PC as an SLCAN
+ * serial CAN adapter on the bus it serves (SLCAN_BUS), so standard tools
+ * watch and inject traffic without a second adapter:
+ *
+ *   slcand -o -c /dev/ttyACM1 can0 && ip link set can0 up && candump can0
+ *
+ * The gateway uses the second USB serial port (Tools > USB Type > Dual
+ * Serial), leaving the first to the text log and the host link.
+ *
+ * - SEEN ON THE PC: every frame the controller receives and every frame
+ *   the simulator sends on that bus - responses, J1939 broadcasts and
+ *   background traffic alike - in bus order.
+ * - SENT FROM THE PC: 't'/'T' frames go out on the bus and are also
+ *   handed to the simulated ECUs, as any other node's frames would be;
+ *   they are not echoed back.
+ * - TIMESTAMPS ('Z1'): milliseconds 0-59999, taken from the controller's
+ *   receive timestamp for received frames.
+ * - BIT RATE: always the simulator's (configured or detected). 'S' is
+ *   acknowledged so slcand's setup succeeds, but changes nothing.
+ *
+ * Frames are queued from a frame tap (can_tap_add) and formatted into
+ * one batched USB write per main loop pass, as large as the USB buffer
+ * will take. The queue holds SLCAN_QUEUE_DEPTH frames - over 100 ms of a
+ * fully loaded 500 kbit/s bus. Frames lost to a full queue set the data
+ * overrun bit in the 'F' status flags. CAN FD frames longer than 8 bytes
+ * have no SLCAN form and are skipped; remote frames are not supported.
+ */
+
+#ifndef USE_SLCAN
+#define USE_SLCAN             0         // 1 = SLCAN gateway on the second USB serial port
+#endif
+
+#if USE_SLCAN
+#if defined(USB_DUAL_SERIAL) || defined(USB_TRIPLE_SERIAL)
+#define SLCAN_PORT            SerialUSB1
+#elif defined(ARDUINO)
+#error "USE_SLCAN needs a second USB serial port: set Tools > USB Type > Dual Serial"
+#else
+#define SLCAN_PORT            Serial    // Builds without ARDUINO
+#endif
+#endif
+
+#define SLCAN_BUS             CAN_BUS_CAN1
+#define SLCAN_QUEUE_DEPTH     512
+#define SLCAN_INJECT_DEPTH    16        // PC frames waiting for the ECUs
+#define SLCAN_LINE_MAX        32        // Longest command: T + 8 + 1 + 16 + CR
+#define SLCAN_BATCH_MAX       2048      // Bytes per USB write
+
+#define SLCAN_FLAG_OVERRUN    0x08      // 'F' status: data overrun
+
+/*
+ * SLCAN Interface
+ */
+void slcan_init(void);
+void slcan_update(void);                // Main loop: commands in, frames out
+bool slcan_take(can_frame_t& frame);    // Next PC frame for the simulated ECUs
+
+#endif // SLCAN_H
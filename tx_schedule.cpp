@@ -0,0 +1,96 @@
+/*
+ * Periodic Transmit Scheduler - Deadline Heap
+ *
+ * See tx_schedule.h. heap[] holds job indices ordered by due time, the
+ * earliest deadline at heap[0].
+ */
+
+#include "tx_schedule.h"
+#include "sim_clock.h"
+
+typedef struct {
+    uint32_t due;                 // Next deadline (millis)
+    uint16_t period;              // ms
+    uint16_t arg;                 // Passed to fn
+    tx_job_fn fn;
+} tx_job_t;
+
+static tx_job_t jobs[TX_SCHEDULE_MAX];
+static uint16_t heap[TX_SCHEDULE_MAX];
+static uint16_t job_count = 0;
+static uint32_t max_lateness = 0;
+
+// Deadline order, safe across the clock_ms() wrap
+static bool earlier(uint16_t a, uint16_t b) {
+    return (int32_t)(jobs[a].due - jobs[b].due) < 0;
+}
+
+static void sift_up(uint16_t pos) {
+    while(pos > 0) {
+        uint16_t parent = (pos - 1) / 2;
+        if(!earlier(heap[pos], heap[parent])) break;
+        uint16_t tmp = heap[pos];
+        heap[pos] = heap[parent];
+        heap[parent] = tmp;
+        pos = parent;
+    }
+}
+
+static void sift_down(uint16_t pos) {
+    for(;;) {
+        uint16_t first = pos;
+        uint16_t left = pos * 2 + 1;
+        uint16_t right = left + 1;
+        if(left < job_count && earlier(heap[left], heap[first])) first = left;
+        if(right < job_count && earlier(heap[right], heap[first])) first = right;
+        if(first == pos) break;
+        uint16_t tmp = heap[pos];
+        heap[pos] = heap[first];
+        heap[first] = tmp;
+        pos = first;
+    }
+}
+
+bool tx_schedule_add(uint16_t period_ms, uint16_t offset_ms, tx_job_fn fn, uint16_t arg) {
+    if(job_count >= TX_SCHEDULE_MAX || period_ms == 0) {
+        return false;
+    }
+
+    tx_job_t* job = &jobs[job_count];
+    job->due = clock_ms() + offset_ms;
+    job->period = period_ms;
+    job->arg = arg;
+    job->fn = fn;
+
+    heap[job_count] = job_count;
+    job_count++;
+    sift_up(job_count - 1);
+    return true;
+}
+
+void tx_schedule_run(void) {
+    uint32_t now = clock_ms();
+
+    // Only the root can be due if it is not
+    while(job_count > 0 && (int32_t)(now - jobs[heap[0]].due) >= 0) {
+        tx_job_t* job = &jobs[heap[0]];
+        uint32_t late = now - job->due;
+
+        if(late > max_lateness) max_lateness = late;
+        job->fn(job->arg);
+
+        job->due += job->period;
+        if((int32_t)(now - job->due) >= 0) {
+            job->due = now + job->period;  // Fell behind - skip, don't burst
+        }
+        sift_down(0);
+    }
+}
+
+uint16_t tx_schedule_count(void) {
+    return job_count;
+}
+
+uint32_t tx_schedule_max_lateness(void) {
+    return max_lateness;
+}
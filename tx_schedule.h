@@ -0,0 +1,43 @@
+#ifndef TX_SCHEDULE_H
+#define TX_SCHEDULE_H
+
+#include <Arduino.h>
+
+/*
+ * Periodic Transmit Scheduler
+ *
+ * Runs periodic jobs - typically "encode and send one broadcast frame" -
+ * at fixed rates from 1 ms upward. Jobs are kept in a binary min-heap
+ * ordered by their next deadline, so a pass only looks at the jobs that
+ * are due: with hundreds of jobs at mixed 10 ms-1 s periods, a pass where
+ * nothing is due costs one comparison, and a due job costs O(log n).
+ *
+ * TIMING:
+ * tx_schedule_run() is called from the 1 ms timer interrupt (see the
+ * sketch), not from the main loop, so request handling and ISO-TP
+ * transfers never delay a deadline: a job runs at most one tick late.
+ * Deadlines advance by the period from the previous deadline, not from
+ * the time the job ran, so lateness does not accumulate. A job that
+ * falls more than one period behind skips the missed runs instead of
+ * sending a burst.
+ *
+ * Jobs run in interrupt context: they must be short and must only touch
+ * the bus through a CanTransport (whose writes are interrupt-safe). Add
+ * jobs during init, before the timer starts.
+ */
+
+#define TX_SCHEDULE_MAX       256       // Job capacity
+
+typedef void (*tx_job_fn)(uint16_t arg);
+
+/*
+ * Scheduler Interface
+ */
+// Add a job running every period_ms, first after offset_ms (staggers jobs
+// with the same period); returns false when the scheduler is full
+bool tx_schedule_add(uint16_t period_ms, uint16_t offset_ms, tx_job_fn fn, uint16_t arg);
+void tx_schedule_run(void);             // Run due jobs (1 ms timer interrupt)
+uint16_t tx_schedule_count(void);       // Jobs scheduled
+uint32_t tx_schedule_max_lateness(void);  // Worst deadline miss seen (ms)
+
+#endif // TX_SCHEDULE_H
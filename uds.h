@@ -0,0 +1,84 @@
+#ifndef UDS_H
+#define UDS_H
+
+#include <Arduino.h>
+
+/*
+ * UDS (ISO 14229-1) Diagnostic Services
+ *
+ * UDS services are registered with the ModeRegistry like OBD modes: the
+ * service ID takes the place of the mode number. They are served by the
+ * engine ECU (requests on 0x7DF and 0x7E0, responses on 0x7E8).
+ */
+
+/*
+ * Service IDs
+ */
+#define UDS_SESSION_CONTROL       0x10      // DiagnosticSessionControl
+#define UDS_READ_DID              0x22      // ReadDataByIdentifier
+#define UDS_TESTER_PRESENT        0x3E      // TesterPresent
+#define UDS_LINK_CONTROL          0x87      // LinkControl
+#define UDS_POSITIVE_OFFSET       0x40      // Positive response SID = SID + 0x40
+#define UDS_NEGATIVE_RESPONSE     0x7F
+
+#define UDS_SUPPRESS_POS_RESPONSE 0x80      // Sub-function bit: no positive response
+
+/*
+ * Diagnostic sessions
+ */
+#define UDS_DEFAULT_SESSION       0x01
+#define UDS_PROGRAMMING_SESSION   0x02
+#define UDS_EXTENDED_SESSION      0x03
+
+/*
+ * Negative Response Codes
+ */
+#define NRC_SERVICE_NOT_SUPPORTED           0x11
+#define NRC_SUBFUNCTION_NOT_SUPPORTED       0x12
+#define NRC_INCORRECT_LENGTH                0x13
+#define NRC_RESPONSE_TOO_LONG               0x14
+#define NRC_BUSY_REPEAT_REQUEST             0x21
+#define NRC_CONDITIONS_NOT_CORRECT          0x22
+#define NRC_REQUEST_SEQUENCE_ERROR          0x24
+#define NRC_REQUEST_OUT_OF_RANGE            0x31
+#define NRC_RESPONSE_PENDING                0x78
+#define NRC_SERVICE_NOT_IN_SESSION          0x7F
+
+/*
+ * Session timing (reported in DiagnosticSessionControl response)
+ */
+#define UDS_P2_SERVER_MAX         50        // ms
+#define UDS_P2_STAR_SERVER_MAX    5000      // ms (sent in 10 ms units)
+#define UDS_S3_SERVER             5000      // ms without request before session times out
+
+/*
+ * LinkControl sub-functions and fixed baudrate identifiers
+ */
+#define LINK_VERIFY_FIXED_BAUD    0x01      // 87 01 [baudrate id]
+#define LINK_VERIFY_SPECIFIC_BAUD 0x02      // 87 02 [rate, 3 bytes, bit/s]
+#define LINK_TRANSITION_BAUD      0x03      // 87 03 - switch to the verified rate
+
+#define LINK_BAUD_CAN_125K        0x10
+#define LINK_BAUD_CAN_250K        0x11
+#define LINK_BAUD_CAN_500K        0x12
+#define LINK_BAUD_CAN_1M          0x13
+
+/*
+ * Data Identifiers
+ * 0xF400-0xF4FF map to Mode 01 PIDs (UDS-on-OBD, ISO 27145)
+ */
+#define DID_ACTIVE_SESSION        0xF186
+#define DID_SPARE_PART_NUMBER     0xF187
+#define DID_ECU_SERIAL_NUMBER     0xF18C
+#define DID_VIN                   0xF190
+#define DID_HW_VERSION            0xF191
+#define DID_SW_VERSION            0xF195
+#define DID_OBD_PID_BASE          0xF400
+
+/*
+ * Session management - called from the main loop for the S3 timeout
+ */
+void uds_session_update(void);
+uint8_t uds_active_session(void);
+
+#endif // UDS_H
@@ -0,0 +1,86 @@
+#ifndef VEHICLE_CONFIG_H
+#define VEHICLE_CONFIG_H
+
+#include <Arduino.h>
+
+/*
+ * Compile-Time Vehicle Configuration
+ *
+ * Production fixtures run fixed-function variants of the simulator - an
+ * engine-only Mode 01 responder, a UDS-only ECU, and so on. Every variant
+ * is built from this tree. Only the set of services, ECUs and Mode 01
+ * PIDs changes, chosen here or with -D build flags:
+ *
+ *   SIM_SERVICES            SIM_SVC_* mask of the request handlers built in
+ *   SIM_ECUS                ECU_* mask of the ECUs answering on the OBD port
+ *   SIM_MODE01_PIDS_01_20   Mode 01 PIDs answered, one bit per PID laid out
+ *   SIM_MODE01_PIDS_21_40   as in the supported-PID bitmaps (bit 31 = PID
+ *   SIM_MODE01_PIDS_41_60   01, 21 or 41)
+ *
+ * What is left out is removed at compile time, not skipped at run time:
+ *
+ * - A service's handler file is not included (mode_includes.h), so its
+ *   code and tables are not in the image. The registry is sized for the
+ *   handlers that remain, and requests for a removed service get
+ *   serviceNotSupported.
+ * - Each Mode 01 PID case tests a constant (sim_mode01_pid), so the
+ *   compiler drops the encoders of the PIDs left out. The supported-PID
+ *   bitmaps follow from the same constants, and so do the NRC fast path,
+ *   Mode 02 and the UDS F4xx DIDs.
+ *
+ * The defaults build everything.
+ */
+
+/*
+ * Services (handler files)
+ */
+#define SIM_SVC_MODE01          0x0001    // Current data
+#define SIM_SVC_MODE02          0x0002    // Freeze frame
+#define SIM_SVC_MODE03          0x0004    // Emissions DTCs
+#define SIM_SVC_MODE04          0x0008    // Clear diagnostic information
+#define SIM_SVC_MODE06          0x0010    // On-board monitoring results
+#define SIM_SVC_MODE08          0x0020    // On-board system control
+#define SIM_SVC_MODE09          0x0040    // Vehicle information
+#define SIM_SVC_UDS             0x0080    // UDS 0x10, 0x22, 0x3E, 0x87
+#define SIM_SVC_ALL             0x00FF
+
+#ifndef SIM_SERVICES
+#define SIM_SERVICES            SIM_SVC_ALL
+#endif
+
+#ifndef SIM_ECUS
+#define SIM_ECUS                ECU_ALL   // ecu_sim.h
+#endif
+
+#ifndef SIM_MODE01_PIDS_01_20
+#define SIM_MODE01_PIDS_01_20   0xFFFFFFFF
+#endif
+#ifndef SIM_MODE01_PIDS_21_40
+#define SIM_MODE01_PIDS_21_40   0xFFFFFFFF
+#endif
+#ifndef SIM_MODE01_PIDS_41_60
+#define SIM_MODE01_PIDS_41_60   0xFFFFFFFF
+#endif
+
+constexpr uint8_t sim_bit_count(uint32_t mask) {
+    return mask ? (mask & 1) + sim_bit_count(mask >> 1) : 0;
+}
+
+// Handlers the registry holds: one per service, four for UDS
+constexpr uint8_t SIM_HANDLER_COUNT =
+    sim_bit_count((SIM_SERVICES) & ~SIM_SVC_UDS) + (((SIM_SERVICES) & SIM_SVC_UDS) ? 4 : 0);
+
+// Configured Mode 01 PIDs of range 0 (01-20), 1 (21-40) or 2 (41-60)
+constexpr uint32_t sim_mode01_pids(uint8_t range) {
+    return range == 0 ? (uint32_t)(SIM_MODE01_PIDS_01_20)
+         : range == 1 ? (uint32_t)(SIM_MODE01_PIDS_21_40)
+         : range == 2 ? (uint32_t)(SIM_MODE01_PIDS_41_60) : 0;
+}
+
+// Mode 01 PID 01-60 is configured
+constexpr bool sim_mode01_pid(uint8_t pid) {
+    return pid >= 1 && pid <= 0x60 &&
+           (sim_mode01_pids((pid - 1) / 32) & (0x80000000u >> ((pid - 1) % 32))) != 0;
+}
+
+#endif // VEHICLE_CONFIG_H
@@ -0,0 +1,63 @@
+/*
+ * Worst-Case Execution Time Probes
+ *
+ * Probe storage and the tick-to-nanosecond conversion. See wcet.h.
+ */
+
+#include "wcet.h"
+#include "memory_map.h"
+
+#if USE_WCET
+
+typedef struct {
+    uint32_t count;
+    uint32_t max;                 // Ticks: CPU cycles, or ns on the host
+    uint64_t total;
+} wcet_probe_t;
+
+static wcet_probe_t probes[WCET_PROBES];
+
+static uint32_t wcet_ticks_to_ns(uint64_t ticks) {
+#ifdef ARDUINO
+    return (uint32_t)(ticks * 1000 / (F_CPU_ACTUAL / 1000000));
+#else
+    return (uint32_t)ticks;
+#endif
+}
+
+FLASHMEM void wcet_init(void) {
+#ifdef ARDUINO
+    // Already running on Teensy 4; enabled here so nothing depends on it
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+#endif
+    wcet_reset();
+}
+
+void wcet_reset(void) {
+    noInterrupts();  // The tick ISR records its own probe
+    memset(probes, 0, sizeof(probes));
+    interrupts();
+}
+
+FASTRUN void wcet_record(uint8_t probe, uint32_t ticks) {
+    wcet_probe_t* p = &probes[probe];
+
+    p->count++;
+    p->total += ticks;
+    if(ticks > p->max) {
+        p->max = ticks;
+    }
+}
+
+void wcet_get(uint8_t probe, wcet_stats_t* stats) {
+    noInterrupts();
+    wcet_probe_t p = probes[probe];
+    interrupts();
+
+    stats->count = p.count;
+    stats->mean_ns = p.count ? wcet_ticks_to_ns(p.total / p.count) : 0;
+    stats->max_ns = wcet_ticks_to_ns(p.max);
+}
+
+#endif // USE_WCET
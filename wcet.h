@@ -0,0 +1,103 @@
+#ifndef WCET_H
+#define WCET_H
+
+#include <Arduino.h>
+#include "vehicle_config.h"
+
+/*
+ * Worst-Case Execution Time Probes
+ *
+ * Measures how long each path of the request chain takes, so the P2
+ * response budget (50 ms, and the much shorter per-ECU response times of
+ * response_timing.h) can be checked as services are added. Each probe
+ * keeps the maximum, the total and the number of runs of one path:
+ *
+ *   WCET_TICK_ISR      the 1 ms timer interrupt (broadcasts, due responses)
+ *   WCET_UPDATE_POTS   update_pots() - potentiometer ADC reads
+ *   WCET_RECEIVE       one received frame, from receive() to its return
+ *   WCET_ISOTP_RX      ISO-TP receive side: flow control, first and
+ *                      consecutive frames of a request
+ *   WCET_ISOTP_TX      ISO-TP send side: one pass of the transfer queue
+ *   WCET_HANDLER + n   registered mode handler n (registry order)
+ *
+ * Probes nest: WCET_RECEIVE includes the handler it dispatched to. A
+ * main loop probe also includes any interrupt that preempted it, which is
+ * part of that path's real worst case.
+ *
+ * TIME BASE:
+ * On the Teensy a probe reads the Cortex-M7 DWT cycle counter, which costs
+ * a single load (about 2 ns at 600 MHz). Without ARDUINO the probes read
+ * std::chrono::steady_clock instead; the tree has no such build, so that
+ * path is only a fallback. Times are reported in nanoseconds either way.
+ *
+ * Build with USE_WCET set to 1 to measure. Without it the probes, their
+ * storage and the host link command compile to nothing. The results are
+ * read with the host link command READ_WCET (host_link.h).
+ */
+
+#ifndef USE_WCET
+#define USE_WCET                0         // 1 = build the probes in
+#endif
+
+enum {
+    WCET_TICK_ISR,
+    WCET_UPDATE_POTS,
+    WCET_RECEIVE,
+    WCET_ISOTP_RX,
+    WCET_ISOTP_TX,
+    WCET_HANDLER,                 // First of SIM_HANDLER_COUNT handler probes
+    WCET_PROBES = WCET_HANDLER + SIM_HANDLER_COUNT
+};
+
+typedef struct {
+    uint32_t count;               // Runs measured
+    uint32_t mean_ns;
+    uint32_t max_ns;
+} wcet_stats_t;
+
+#if USE_WCET
+
+#ifndef ARDUINO
+#include <chrono>
+#endif
+
+static inline uint32_t wcet_now(void) {
+#ifdef ARDUINO
+    return ARM_DWT_CYCCNT;
+#else
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void wcet_record(uint8_t probe, uint32_t ticks);
+
+// Times the rest of the enclosing scope, whichever way it is left
+class WcetScope {
+public:
+    explicit WcetScope(uint8_t probe) : probe(probe), start(wcet_now()) {}
+    ~WcetScope() { wcet_record(probe, wcet_now() - start); }
+
+private:
+    uint8_t probe;
+    uint32_t start;
+};
+
+#define WCET_PROBE(probe)       WcetScope wcet_scope(probe)
+
+/*
+ * WCET Interface
+ */
+void wcet_init(void);                     // Start the cycle counter, clear all
+void wcet_reset(void);                    // Clear all probes
+void wcet_get(uint8_t probe, wcet_stats_t* stats);
+
+#else
+
+#define WCET_PROBE(probe)       do {} while(0)
+
+static inline void wcet_init(void) {}
+
+#endif // USE_WCET
+
+#endif // WCET_H